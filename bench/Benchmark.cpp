@@ -0,0 +1,172 @@
+// Benchmark.cpp
+// Times every compile() phase on generated sources and reports throughput,
+// heap allocations and peak RSS.
+
+#include "ATmega328Compiler.hpp"
+#include "Assembler.hpp"
+#include "SourceGenerator.hpp"
+#include "TimeReport.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+    std::atomic<size_t> allocationCount{0};
+    std::atomic<size_t> allocationBytes{0};
+}
+
+void* operator new(size_t size) {
+    ++allocationCount;
+    allocationBytes += size;
+    if (void* block = std::malloc(size == 0 ? 1 : size)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept {
+    std::free(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    std::free(block);
+}
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "Options:\n"
+              << "  --lines <n>         Source lines per generated program (default 10000)\n"
+              << "  --iterations <n>    Compiles per mix, phase times are averaged (default 20)\n"
+              << "  --mix <name>        labels, branches, immediate, data, incbin, flash-limit or all\n"
+              << "                      (default all)\n"
+              << "  --format <hex/bin>  Output format (default hex)\n"
+              << "  --single-pass       Benchmark the single-pass mode\n"
+              << "  --in-memory         Reuse one Assembler on the source buffer, no file I/O\n"
+              << "  --keep              Keep the generated sources in the temp directory\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t lines = 10000;
+    size_t iterations = 20;
+    std::string mixName = "all";
+    std::string format = "hex";
+    bool singlePass = false;
+    bool keep = false;
+    bool inMemory = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--lines" && i + 1 < argc) {
+            lines = std::stoul(argv[++i]);
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--mix" && i + 1 < argc) {
+            mixName = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc) {
+            format = argv[++i];
+        } else if (arg == "--single-pass") {
+            singlePass = true;
+        } else if (arg == "--in-memory") {
+            inMemory = true;
+        } else if (arg == "--keep") {
+            keep = true;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<SourceGenerator::Mix> mixes;
+    SourceGenerator::Mix mix;
+    if (mixName == "all") {
+        mixes = {SourceGenerator::Mix::Labels, SourceGenerator::Mix::Branches, SourceGenerator::Mix::Immediate,
+                 SourceGenerator::Mix::Data, SourceGenerator::Mix::Incbin, SourceGenerator::Mix::FlashLimit};
+    } else if (SourceGenerator::parseMix(mixName, mix)) {
+        mixes.push_back(mix);
+    } else {
+        std::cerr << "Unknown mix: " << mixName << "\n";
+        return 1;
+    }
+
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path();
+    try {
+        for (SourceGenerator::Mix current : mixes) {
+            std::string source = SourceGenerator::generate(current, lines, 328);
+            std::filesystem::path input = tempDir / ("atmega328_bench_" + std::string(SourceGenerator::name(current)) + ".asm");
+            std::filesystem::path output = input;
+            output.replace_extension(format);
+            const std::string table = SourceGenerator::table(328);
+            const std::filesystem::path tableFile = tempDir / SourceGenerator::TABLE_FILE;
+            const bool incbin = current == SourceGenerator::Mix::Incbin;
+            if (!inMemory) {
+                std::ofstream file(input, std::ios::binary);
+                file << source;
+                if (incbin) {
+                    std::ofstream binary(tableFile, std::ios::binary);
+                    binary << table;
+                }
+            }
+
+            std::vector<PhaseTime> average;
+            size_t allocations = 0;
+            size_t allocated = 0;
+            size_t sourceLines = 0;
+            Assembler assembler;  // reused by every --in-memory run
+            assembler.setSinglePass(singlePass);
+            assembler.setBinaryResolver([&table](std::string_view, const std::string&, Assembler::IncludeFile& file) {
+                file.path = SourceGenerator::TABLE_FILE;
+                file.text = table;
+                return true;
+            });
+            for (size_t run = 0; run < iterations; ++run) {
+                ATmega328Compiler compiler(format, input.string(), output.string());
+                compiler.setSinglePass(singlePass);
+                size_t countBefore = allocationCount;
+                size_t bytesBefore = allocationBytes;
+                if (!inMemory) {
+                    compiler.compile();
+                } else if (!assembler.assemble(source)) {
+                    throw std::runtime_error(assembler.getDiagnostics().front().message);
+                }
+                allocations += allocationCount - countBefore;
+                allocated += allocationBytes - bytesBefore;
+                sourceLines = inMemory ? assembler.getLineCount() : compiler.getLineCount();
+
+                const std::vector<PhaseTime>& phases = inMemory ? assembler.getPhaseTimes() : compiler.getPhaseTimes();
+                if (average.empty()) {
+                    average.assign(phases.begin(), phases.end());
+                    for (PhaseTime& phase : average) {
+                        phase.milliseconds = 0.0;
+                    }
+                }
+                for (size_t i = 0; i < phases.size(); ++i) {
+                    average[i].milliseconds += phases[i].milliseconds / iterations;
+                }
+            }
+
+            std::cout << SourceGenerator::name(current) << ": " << sourceLines << " lines, "
+                      << source.size() << " bytes, " << iterations << " iteration(s)\n";
+            printTimeReport(std::cout, average, source.size(), sourceLines);
+            std::cout << "  allocations " << allocations / iterations << " per compile, "
+                      << allocated / iterations / 1024 << " KiB\n\n";
+
+            if (!keep) {
+                std::filesystem::remove(input);
+                std::filesystem::remove(tableFile);
+            }
+            std::filesystem::remove(output);
+        }
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+
+    std::cout << "peak RSS " << peakResidentBytes() / 1024 << " KiB\n";
+    return 0;
+}
@@ -0,0 +1,183 @@
+// SourceGenerator.cpp
+// Synthetic assembly sources of configurable size and instruction mix
+
+#include "SourceGenerator.hpp"
+#include <string>
+
+namespace {
+    const size_t FLASH_LIMIT = 0x8000;
+    const size_t TABLE_LINES = 20;  // of 16 bytes each, every other one .dw
+    const size_t TABLE_BYTES = TABLE_LINES * 16;
+    const size_t TABLE_CODE = 4;    // instructions in front of each table
+
+    // Small deterministic LCG so runs are reproducible across platforms
+    class Random {
+    public:
+        explicit Random(uint32_t seed) : state(seed * 2654435761u + 1) {}
+        uint32_t next(uint32_t bound) {
+            state = state * 1664525u + 1013904223u;
+            return (state >> 8) % bound;
+        }
+    private:
+        uint32_t state;
+    };
+
+    struct Writer {
+        std::string text;
+        size_t bytes = 0;
+        size_t lines = 0;
+
+        void label(size_t index) {
+            text += "L" + std::to_string(index) + ":\n";
+            ++lines;
+        }
+        void instruction(const std::string& line, size_t size) {
+            text += "    " + line + "\n";
+            bytes += size;
+            ++lines;
+        }
+    };
+
+    std::string hex(uint32_t value, int digits) {
+        const char* symbols = "0123456789ABCDEF";
+        std::string text = "0x";
+        for (int shift = 4 * (digits - 1); shift >= 0; shift -= 4) {
+            text += symbols[(value >> shift) & 0xF];
+        }
+        return text;
+    }
+
+    // The table as .db lines of 16 bytes and .dw lines of 8 little-endian words
+    void dataTable(Writer& out, const std::string& bytes) {
+        for (size_t line = 0; line < TABLE_LINES; ++line) {
+            const uint8_t* row = reinterpret_cast<const uint8_t*>(bytes.data()) + line * 16;
+            std::string text = line % 2 == 0 ? ".db " : ".dw ";
+            for (size_t i = 0; i < 16; i += line % 2 == 0 ? 1 : 2) {
+                text += i == 0 ? "" : ", ";
+                text += line % 2 == 0 ? hex(row[i], 2) : hex(row[i] | row[i + 1] << 8, 4);
+            }
+            out.instruction(text, 16);
+        }
+    }
+
+    std::string reg(uint32_t number) {
+        return "R" + std::to_string(number);
+    }
+
+    std::string label(size_t index) {
+        return "L" + std::to_string(index);
+    }
+
+    void straightLine(Writer& out, Random& rng) {
+        switch (rng.next(7)) {
+            case 0: out.instruction("LDI " + reg(16 + rng.next(16)) + ", 0x" + std::to_string(10 + rng.next(89)), 2); break;
+            case 1: out.instruction("OUT 0x" + std::to_string(10 + rng.next(29)) + ", " + reg(rng.next(32)) + "    ; port write", 2); break;
+            case 2: out.instruction("IN " + reg(rng.next(32)) + ", " + std::to_string(rng.next(64)), 2); break;
+            case 3: out.instruction("ADD " + reg(rng.next(32)) + ", " + reg(rng.next(32)), 2); break;
+            case 4: out.instruction("SUB " + reg(rng.next(32)) + ", " + reg(rng.next(32)), 2); break;
+            case 5: out.instruction("CP " + reg(rng.next(32)) + ", " + reg(rng.next(32)), 2); break;
+            default: out.instruction("DEC " + reg(rng.next(32)), 2); break;
+        }
+    }
+}
+
+const char* SourceGenerator::name(Mix mix) {
+    switch (mix) {
+        case Mix::Labels: return "labels";
+        case Mix::Branches: return "branches";
+        case Mix::Immediate: return "immediate";
+        case Mix::Data: return "data";
+        case Mix::Incbin: return "incbin";
+        case Mix::FlashLimit: return "flash-limit";
+    }
+    return "";
+}
+
+bool SourceGenerator::parseMix(const std::string& text, Mix& mix) {
+    for (Mix candidate : {Mix::Labels, Mix::Branches, Mix::Immediate, Mix::Data, Mix::Incbin, Mix::FlashLimit}) {
+        if (text == name(candidate)) {
+            mix = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string SourceGenerator::table(uint32_t seed) {
+    Random rng(seed);
+    std::string bytes(TABLE_BYTES, '\0');
+    for (char& byte : bytes) {
+        byte = static_cast<char>(rng.next(256));
+    }
+    return bytes;
+}
+
+std::string SourceGenerator::generate(Mix mix, size_t lineCount, uint32_t seed) {
+    Random rng(seed);
+    Writer out;
+    out.text.reserve(lineCount * 24);
+    out.text += "; generated benchmark source (" + std::string(name(mix)) + ")\n";
+
+    // Labels are numbered in order; a block is the code between two labels
+    const bool tables = mix == Mix::Data || mix == Mix::Incbin;
+    const size_t blockSize = mix == Mix::Labels ? 1 : mix == Mix::Branches ? 6 : tables ? TABLE_CODE : 24;
+    const size_t blockBytes = tables ? 2 * TABLE_CODE + TABLE_BYTES : 4 * (blockSize + 1);
+    const size_t reserve = 16;  // room for the closing label and jumps
+    const std::string bytes = tables ? table(seed) : std::string();
+    size_t block = 0;
+
+    for (;;) {
+        if (mix == Mix::FlashLimit) {
+            if (out.bytes + blockBytes + reserve > FLASH_LIMIT) {
+                break;
+            }
+        } else if (out.lines >= lineCount || out.bytes + blockBytes + reserve > FLASH_LIMIT) {
+            break;
+        }
+
+        out.label(block);
+        if (tables) {
+            // Straight-line code only: branches could not reach across the tables
+            for (size_t i = 0; i < blockSize; ++i) {
+                straightLine(out, rng);
+            }
+            if (mix == Mix::Data) {
+                dataTable(out, bytes);
+            } else {
+                // Counts as the lines it replaces, so both mixes fill the same flash
+                out.instruction(".incbin \"" + std::string(TABLE_FILE) + "\"", TABLE_BYTES);
+                out.lines += TABLE_LINES - 1;
+            }
+            ++block;
+            continue;
+        }
+        for (size_t i = 0; i < blockSize; ++i) {
+            uint32_t pick = rng.next(mix == Mix::Branches ? 10 : mix == Mix::Labels ? 4 : 40);
+            // Forward targets never go past the next label, which always exists
+            size_t near = rng.next(2) == 0 || block == 0 ? block + 1 : block - 1;
+            size_t far = rng.next(static_cast<uint32_t>(block + 2));
+            if (pick == 0) {
+                out.instruction("BRNE " + label(near), 2);
+            } else if (pick == 1) {
+                out.instruction("BRGE " + label(near), 2);
+            } else if (pick == 2) {
+                out.instruction("BRLT " + label(near), 2);
+            } else if (pick == 3) {
+                out.instruction("RJMP " + label(near), 2);
+            } else if (pick == 4 && mix != Mix::Labels) {
+                out.instruction("RCALL " + label(near), 2);
+            } else if (pick == 5 && mix != Mix::Labels) {
+                out.instruction("JMP " + label(far), 4);
+            } else if (pick == 6 && mix != Mix::Labels) {
+                out.instruction("CALL " + label(far), 4);
+            } else {
+                straightLine(out, rng);
+            }
+        }
+        ++block;
+    }
+
+    out.label(block);
+    out.instruction("RET", 2);
+    return out.text;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Builds synthetic assembly sources for the benchmark. Every generated
+// program assembles cleanly and fits into the 32 KB of flash.
+class SourceGenerator {
+public:
+    enum class Mix {
+        Labels,     // a label every other instruction
+        Branches,   // mostly BRxx/RJMP/RCALL/JMP/CALL to nearby and far labels
+        Immediate,  // immediate and I/O heavy straight-line code
+        Data,       // .db/.dw tables of hex literals between short code blocks
+        Incbin,     // the data mix with every table taken from TABLE_FILE
+        FlashLimit  // mixed code filling the flash up to the 0x8000 limit
+    };
+
+    // File the incbin mix includes, in the directory of the source
+    static constexpr const char* TABLE_FILE = "atmega328_bench_table.bin";
+
+    static const char* name(Mix mix);
+    static bool parseMix(const std::string& text, Mix& mix);
+
+    // Contents of TABLE_FILE. The data mix writes the same bytes, so data and
+    // incbin sources with the same seed and lineCount give the same image.
+    static std::string table(uint32_t seed);
+
+    // Generates about lineCount source lines. FlashLimit ignores lineCount.
+    static std::string generate(Mix mix, size_t lineCount, uint32_t seed);
+};
@@ -7,13 +7,13 @@
 
 ; Initialize LED pin
     LDI R16, 0x20       ; Set bit 5 (0b00100000)
-    OUT 0x24, R16       ; DDRB - configure Pin 5 as output
+    OUT 0x04, R16       ; DDRB - configure Pin 5 as output
     CLR R17             ; Clear R17 for LED off state
 
 MAIN:
-    OUT 0x25, R16       ; PORTB - LED ON
+    OUT 0x05, R16       ; PORTB - LED ON
     RCALL DELAY         ; Wait 1 second
-    OUT 0x25, R17       ; PORTB - LED OFF
+    OUT 0x05, R17       ; PORTB - LED OFF
     RCALL DELAY         ; Wait 1 second
     RJMP MAIN           ; Repeat forever
 
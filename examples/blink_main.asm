@@ -0,0 +1,16 @@
+; Blink program split into modules, see delay.asm
+; Assemble each module to an object file and link them:
+;   ATmega328Compiler --batch obj blink_main.asm blink_main.obj delay.asm delay.obj
+;   ATmega328Compiler --link hex blink.hex blink_main.obj delay.obj
+
+; Initialize LED pin
+    LDI R16, 0x20       ; Set bit 5 (0b00100000)
+    OUT 0x04, R16       ; DDRB - configure Pin 5 as output
+    CLR R17             ; Clear R17 for LED off state
+
+MAIN:
+    OUT 0x05, R16       ; PORTB - LED ON
+    RCALL DELAY         ; Wait 1 second, DELAY is in delay.asm
+    OUT 0x05, R17       ; PORTB - LED OFF
+    RCALL DELAY         ; Wait 1 second
+    RJMP MAIN           ; Repeat forever
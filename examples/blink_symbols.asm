@@ -0,0 +1,38 @@
+; This code is designed for ATmega328 CPUs and can be compiled wit ATmega328Compiler
+
+; LED Blink using the device header instead of raw I/O addresses
+; Frequency: 16MHz
+; LED: Pin 5 (PORTB)
+
+.include "m328Pdef.inc"
+
+.equ LED_MASK = 0x20    ; PB5
+.set DELAY_OUTER = 82   ; Outer delay count, about 1 second at 16MHz
+.def led_on = r16
+.def led_off = r17
+
+    LDI led_on, LED_MASK
+    OUT DDRB, led_on    ; Configure the LED pin as output
+    CLR led_off
+
+MAIN:
+    OUT PORTB, led_on   ; LED ON
+    RCALL DELAY
+    OUT PORTB, led_off  ; LED OFF
+    RCALL DELAY
+    RJMP MAIN
+
+DELAY:
+    LDI R18, DELAY_OUTER
+    LDI R19, 255
+    LDI R20, 255
+DELAY_LOOP:
+    DEC R20
+    BRNE DELAY_LOOP
+    DEC R19
+    LDI R20, 255
+    BRNE DELAY_LOOP
+    DEC R18
+    LDI R19, 255
+    BRNE DELAY_LOOP
+    RET
@@ -0,0 +1,27 @@
+; This code is designed for ATmega328 CPUs and can be compiled wit ATmega328Compiler
+
+; ATmega328 LED Blink with a data table behind the code
+; The table shows the data directives; the program doesn't read it.
+
+.equ LED_MASK = 0x20
+
+    LDI R16, LED_MASK   ; Set bit 5 (0b00100000)
+    OUT 0x04, R16       ; DDRB - configure Pin 5 as output
+    CLR R17             ; Clear R17 for LED off state
+
+MAIN:
+    OUT 0x05, R16       ; PORTB - LED ON
+    OUT 0x05, R17       ; PORTB - LED OFF
+    RJMP MAIN           ; Repeat forever
+
+.org 0x0100
+PATTERN:
+    .db 0x01, 0x03, 0x07, $0F, 0b00011111, LED_MASK, -1, 255
+DURATIONS:
+    .dw 1000, 0x01F4, -2, LED_MASK
+NAME:
+    .db "blink", 0      ; odd length, padded with one zero byte
+GREETING:
+    .ascii "LED on\r\n"
+WALK:
+    .incbin "blink_pattern.bin"
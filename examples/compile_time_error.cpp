@@ -0,0 +1,12 @@
+// AVR_PROGRAM() checks operands while the C++ compiler runs: the immediate of
+// LDI is 0-255, so this file must not compile. CTest builds it once with
+// PROGRAM set to a valid program, then without.
+
+#include "CompileTimeAssembler.hpp"
+
+#ifndef PROGRAM
+#define PROGRAM "LDI R16, 300"
+#endif
+
+constexpr auto program = AVR_PROGRAM(PROGRAM);
+static_assert(program.size() == 2);
@@ -0,0 +1,23 @@
+; This code is designed for ATmega328 CPUs and can be compiled wit ATmega328Compiler
+
+; Single counter loop with a bound the cycle analysis infers:
+; LDI before the loop, DEC/BRNE at its end
+
+    LDI R16, 0x20       ; Set bit 5 (0b00100000)
+    OUT 0x04, R16       ; DDRB - configure Pin 5 as output
+    CLR R17             ; Clear R17 for LED off state
+
+MAIN:
+    OUT 0x05, R16       ; PORTB - LED ON
+    RCALL WAIT          ; Wait 404 cycles
+    OUT 0x05, R17       ; PORTB - LED OFF
+    RCALL WAIT          ; Wait 404 cycles
+    RJMP MAIN           ; Repeat forever
+
+WAIT:
+    LDI R18, 100        ; 100 iterations (1 cycle)
+WAIT_LOOP:
+    NOP                 ; 1 cycle
+    DEC R18             ; 1 cycle
+    BRNE WAIT_LOOP      ; 2 cycles taken, 1 at the end
+    RET                 ; 4 cycles
@@ -0,0 +1,13 @@
+; This code is designed for ATmega328 CPUs and can be compiled wit ATmega328Compiler
+
+; Data whose words decode as branches the disassembler can't label:
+; one into the second word of a JMP, one past the end of the flash.
+; --round-trip has to write them back as .dw.
+
+START:
+    JMP START
+    .dw 0xCFFE          ; RJMP into the second word of the JMP above
+
+.org 0x3F00
+TABLE:
+    .dw 0xC7FF, 0x0102  ; RJMP 2047 words ahead, past the flash
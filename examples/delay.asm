@@ -0,0 +1,17 @@
+; 1 second delay at 16MHz, a module of blink_main.asm
+.global DELAY
+
+DELAY:
+    LDI R18, 82         ; Load outer counter once
+    LDI R19, 255        ; Load middle counter once
+    LDI R20, 255        ; Load inner counter once
+DELAY_LOOP:
+    DEC R20             ; Decrement inner (1 cycle)
+    BRNE DELAY_LOOP     ; Branch if not zero (2 cycles)
+    DEC R19             ; Decrement middle (1 cycle)
+    LDI R20, 255        ; Reload inner counter (1 cycle)
+    BRNE DELAY_LOOP     ; Branch back to inner loop (2 cycles)
+    DEC R18             ; Decrement outer (1 cycle)
+    LDI R19, 255        ; Reload middle counter (1 cycle)
+    BRNE DELAY_LOOP     ; Branch back to middle loop (2 cycles)
+    RET                 ; Return (4 cycles)
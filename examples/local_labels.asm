@@ -0,0 +1,25 @@
+; This code is designed for ATmega328 CPUs and can be compiled wit ATmega328Compiler
+
+; Numeric local labels: 1b/1f find the closest definition before/after the
+; reference. local_labels_expected.asm is the same program with unique names.
+
+.equ LED_MASK = 0x20
+
+    LDI R16, LED_MASK   ; Set bit 5 (0b00100000)
+    OUT 0x04, R16       ; DDRB - configure Pin 5 as output
+    CLR R17
+1:  RCALL 2f            ; forward to the first 2: below
+    OUT 0x05, R16       ; PORTB - LED ON
+    RCALL 2f
+    OUT 0x05, R17       ; PORTB - LED OFF
+    JMP 1b              ; back to the RCALL
+
+; Delay, with the same numbers again
+2:  LDI R18, 10
+3:  LDI R19, 200
+1:  DEC R19
+    BRNE 1b             ; the DEC, not the RCALL above
+    DEC R18
+    BREQ 1f             ; to the RET
+    RJMP 3b
+1:  RET
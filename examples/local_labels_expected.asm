@@ -0,0 +1,25 @@
+; local_labels.asm with a unique name for every label
+.equ LED_MASK = 0x20
+
+    LDI R16, LED_MASK
+    OUT 0x04, R16
+    CLR R17
+MAIN:
+    RCALL DELAY
+    OUT 0x05, R16
+    RCALL DELAY
+    OUT 0x05, R17
+    JMP MAIN
+
+DELAY:
+    LDI R18, 10
+OUTER:
+    LDI R19, 200
+INNER:
+    DEC R19
+    BRNE INNER
+    DEC R18
+    BREQ DONE
+    RJMP OUTER
+DONE:
+    RET
@@ -8,10 +8,10 @@
 ; Minimal LED Test Without Loop
 START:
     LDI R16, 0x20       ; Set bit 5 (0b00100000)
-    OUT 0x24, R16       ; DDRB - configure Pin 5 as output
-    OUT 0x25, R16       ; PORTB - LED ON
+    OUT 0x04, R16       ; DDRB - configure Pin 5 as output
+    OUT 0x05, R16       ; PORTB - LED ON
     CLR R17             ; Clear R17
-    OUT 0x25, R17       ; PORTB - LED OFF
+    OUT 0x05, R17       ; PORTB - LED OFF
     RET                 ; Return
 
 ; Return causes that the Program restarts - so we have a blinking LED in this case
\ No newline at end of file
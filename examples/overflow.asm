@@ -0,0 +1,18 @@
+; This code is designed for ATmega328 CPUs and can be compiled wit ATmega328Compiler
+
+; A program that doesn't fit: the handler behind the sine table runs past the
+; end of the flash. --map still shows what was laid out up to that point.
+
+START:
+    LDI R16, 0x20       ; Set bit 5 (0b00100000)
+    OUT 0x04, R16       ; DDRB - configure Pin 5 as output
+MAIN:
+    OUT 0x05, R16       ; PORTB - LED ON
+    RJMP MAIN           ; Repeat forever
+
+.org 0x3FF0             ; the last 32 bytes of the flash
+SINE:
+    .dw 0, 3212, 6393, 9512, 12539, 15446, 18204, 20787
+    .dw 23170, 25330, 27245, 28898, 30273, 31356, 32137, 32609
+HANDLER:
+    JMP START           ; 4 bytes too many
@@ -0,0 +1,14 @@
+; clr-ldi input, see clr_ldi_expected.asm
+    CLR R16
+    LDI R16, 5
+    ADD R18, R19        ; overwrites the flags: the CLR goes
+    CLR R20
+    LDI R20, 7
+    IN R17, 0x3F        ; reads SREG: the CLR stays
+    ADD R18, R19
+    CLR R21
+    LDI R21, 1
+    PUSH R21
+    BRNE done           ; reads Z: the CLR stays
+done:
+    RJMP done
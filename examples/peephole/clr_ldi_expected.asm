@@ -0,0 +1,13 @@
+; clr_ldi.asm after --peephole clr-ldi
+    LDI R16, 5
+    ADD R18, R19
+    CLR R20
+    LDI R20, 7
+    IN R17, 0x3F
+    ADD R18, R19
+    CLR R21
+    LDI R21, 1
+    PUSH R21
+    BRNE done
+done:
+    RJMP done
@@ -0,0 +1,13 @@
+; jump-chain input, see jump_chain_expected.asm
+    RCALL first
+    BRNE second
+first:
+    RJMP second
+    NOP
+second:
+    JMP done
+    NOP
+done:
+    LDI R16, 1
+halt:
+    RJMP halt
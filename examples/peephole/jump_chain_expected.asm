@@ -0,0 +1,13 @@
+; jump_chain.asm after --peephole jump-chain
+    RCALL done
+    BRNE done
+first:
+    RJMP done
+    NOP
+second:
+    JMP done
+    NOP
+done:
+    LDI R16, 1
+halt:
+    RJMP halt
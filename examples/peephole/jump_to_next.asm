@@ -0,0 +1,9 @@
+; jump-to-next input, see jump_to_next_expected.asm
+    RJMP load
+load:
+    LDI R16, 1
+    BREQ far
+far:
+    JMP halt
+halt:
+    RJMP halt
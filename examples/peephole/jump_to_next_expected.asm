@@ -0,0 +1,4 @@
+; jump_to_next.asm after --peephole jump-to-next
+    LDI R16, 1
+halt:
+    RJMP halt
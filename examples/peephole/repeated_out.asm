@@ -0,0 +1,11 @@
+; repeated-out input, see repeated_out_expected.asm
+    LDI R16, 0x20
+    OUT 0x04, R16       ; DDRB only stores the value: the second OUT goes
+    OUT 0x04, R16
+    LDI R17, 1
+    OUT 0x15, R17       ; TIFR0 clears flags on every write: both stay
+    OUT 0x15, R17
+    OUT 0x26, R17       ; TCNT0 counts between the writes: both stay
+    OUT 0x26, R17
+halt:
+    RJMP halt
@@ -0,0 +1,10 @@
+; repeated_out.asm after --peephole repeated-out
+    LDI R16, 0x20
+    OUT 0x04, R16
+    LDI R17, 1
+    OUT 0x15, R17
+    OUT 0x15, R17
+    OUT 0x26, R17
+    OUT 0x26, R17
+halt:
+    RJMP halt
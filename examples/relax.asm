@@ -0,0 +1,24 @@
+; This code is designed for ATmega328 CPUs and can be compiled wit ATmega328Compiler
+
+; Every case of --relax: a JMP that reaches with RJMP, an RJMP that doesn't
+; and a BRNE too far from its target. relax_expected.asm is the result.
+
+START:
+    LDI R16, 0x20       ; Set bit 5 (0b00100000)
+    OUT 0x04, R16       ; DDRB - configure Pin 5 as output
+    JMP MAIN            ; shortened to RJMP
+MAIN:
+    DEC R16
+    BRNE BLINK          ; 256 words away, expanded to BREQ over RJMP
+    RJMP HIGH           ; 8K words away, lengthened to JMP
+
+.org 0x0100
+BLINK:
+    OUT 0x05, R16       ; PORTB
+    RJMP MAIN
+
+.org 0x2000
+HIGH:
+    CLR R16
+    OUT 0x05, R16       ; PORTB - LED OFF
+    RJMP HIGH
@@ -0,0 +1,22 @@
+; relax.asm after --relax
+START:
+    LDI R16, 0x20
+    OUT 0x04, R16
+    RJMP MAIN
+MAIN:
+    DEC R16
+    BREQ skip
+    RJMP BLINK
+skip:
+    JMP HIGH
+
+.org 0x0100
+BLINK:
+    OUT 0x05, R16
+    RJMP MAIN
+
+.org 0x2000
+HIGH:
+    CLR R16
+    OUT 0x05, R16
+    RJMP HIGH
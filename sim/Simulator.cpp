@@ -0,0 +1,493 @@
+// Simulator.cpp
+// Predecoded dispatch loop for the ATmega328 instruction subset
+
+#include "Simulator.hpp"
+#include "Disassembler.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <string_view>
+
+namespace {
+    using State = Simulator::State;
+    using Decoded = Simulator::Decoded;
+
+    constexpr uint32_t PC_MASK = Simulator::FLASH_WORDS - 1;
+    constexpr uint8_t ARITHMETIC_FLAGS = Simulator::H | Simulator::S | Simulator::V | Simulator::N
+                                       | Simulator::Z | Simulator::C;
+
+    struct NamedRegister {
+        const char* name;
+        uint16_t address;
+    };
+
+    constexpr NamedRegister NAMED_REGISTERS[] = {
+        {"PINB", 0x23}, {"DDRB", 0x24}, {"PORTB", 0x25},
+        {"PINC", 0x26}, {"DDRC", 0x27}, {"PORTC", 0x28},
+        {"PIND", 0x29}, {"DDRD", 0x2A}, {"PORTD", 0x2B},
+        {"SPL", Simulator::SPL}, {"SPH", Simulator::SPH}, {"SREG", Simulator::SREG}
+    };
+
+    inline uint16_t stackPointer(const State& s) {
+        return static_cast<uint16_t>(s.data[Simulator::SPL] | s.data[Simulator::SPH] << 8);
+    }
+
+    inline void setStackPointer(State& s, uint16_t sp) {
+        s.data[Simulator::SPL] = sp & 0xFF;
+        s.data[Simulator::SPH] = sp >> 8;
+    }
+
+    inline void writeData(State& s, uint32_t address, uint8_t value) {
+        if (address >= Simulator::DATA_SIZE) {
+            return;
+        }
+        s.data[address] = value;
+        if (s.portWrites != nullptr && address >= Simulator::IO_BASE && address < 0x100) {
+            s.portWrites->push_back({s.cycles, static_cast<uint16_t>(address), value});
+        }
+    }
+
+    inline uint8_t readData(const State& s, uint32_t address) {
+        return address < Simulator::DATA_SIZE ? s.data[address] : 0;
+    }
+
+    inline void push(State& s, uint8_t value) {
+        uint16_t sp = stackPointer(s);
+        writeData(s, sp, value);
+        setStackPointer(s, sp - 1);
+    }
+
+    inline uint8_t pop(State& s) {
+        uint16_t sp = stackPointer(s) + 1;
+        setStackPointer(s, sp);
+        return readData(s, sp);
+    }
+
+    // Return addresses are pushed low byte first
+    inline void pushPc(State& s, uint32_t pc) {
+        push(s, pc & 0xFF);
+        push(s, (pc >> 8) & 0xFF);
+    }
+
+    inline void setFlags(State& s, uint8_t mask, uint8_t flags) {
+        s.data[Simulator::SREG] = static_cast<uint8_t>((s.data[Simulator::SREG] & ~mask) | flags);
+    }
+
+    inline uint8_t resultFlags(uint8_t result, bool overflow) {
+        uint8_t flags = 0;
+        if (result & 0x80) flags |= Simulator::N;
+        if (overflow) flags |= Simulator::V;
+        if (result == 0) flags |= Simulator::Z;
+        if (((result & 0x80) != 0) != overflow) flags |= Simulator::S;
+        return flags;
+    }
+
+    inline uint8_t subtract(State& s, uint8_t d, uint8_t r) {
+        uint8_t result = static_cast<uint8_t>(d - r);
+        uint8_t borrows = (~d & r) | (r & result) | (result & ~d);
+        bool overflow = ((d & ~r & ~result) | (~d & r & result)) & 0x80;
+        uint8_t flags = resultFlags(result, overflow);
+        if (borrows & 0x08) flags |= Simulator::H;
+        if (borrows & 0x80) flags |= Simulator::C;
+        setFlags(s, ARITHMETIC_FLAGS, flags);
+        return result;
+    }
+
+    inline void next(State& s, const Decoded& d) {
+        s.pc = (s.pc + d.words) & PC_MASK;
+        s.cycles += d.cycles;
+    }
+
+    inline void jump(State& s, uint32_t target, uint8_t cycles) {
+        target &= PC_MASK;
+        s.halted = target == s.pc;
+        s.pc = target;
+        s.cycles += cycles;
+    }
+
+    void nop(State& s, const Decoded& d) {
+        next(s, d);
+    }
+
+    void ldi(State& s, const Decoded& d) {
+        s.data[d.values[0]] = static_cast<uint8_t>(d.values[1]);
+        next(s, d);
+    }
+
+    void add(State& s, const Decoded& d) {
+        uint8_t a = s.data[d.values[0]];
+        uint8_t b = s.data[d.values[1]];
+        uint8_t result = static_cast<uint8_t>(a + b);
+        uint8_t carries = (a & b) | (b & ~result) | (~result & a);
+        bool overflow = ((a & b & ~result) | (~a & ~b & result)) & 0x80;
+        uint8_t flags = resultFlags(result, overflow);
+        if (carries & 0x08) flags |= Simulator::H;
+        if (carries & 0x80) flags |= Simulator::C;
+        setFlags(s, ARITHMETIC_FLAGS, flags);
+        s.data[d.values[0]] = result;
+        next(s, d);
+    }
+
+    void sub(State& s, const Decoded& d) {
+        s.data[d.values[0]] = subtract(s, s.data[d.values[0]], s.data[d.values[1]]);
+        next(s, d);
+    }
+
+    void cp(State& s, const Decoded& d) {
+        subtract(s, s.data[d.values[0]], s.data[d.values[1]]);
+        next(s, d);
+    }
+
+    void clr(State& s, const Decoded& d) {
+        s.data[d.values[0]] = 0;
+        setFlags(s, Simulator::S | Simulator::V | Simulator::N | Simulator::Z, Simulator::Z);
+        next(s, d);
+    }
+
+    void dec(State& s, const Decoded& d) {
+        uint8_t value = s.data[d.values[0]];
+        uint8_t result = static_cast<uint8_t>(value - 1);
+        setFlags(s, Simulator::S | Simulator::V | Simulator::N | Simulator::Z, resultFlags(result, value == 0x80));
+        s.data[d.values[0]] = result;
+        next(s, d);
+    }
+
+    void in(State& s, const Decoded& d) {
+        s.data[d.values[0]] = s.data[Simulator::IO_BASE + d.values[1]];
+        next(s, d);
+    }
+
+    void out(State& s, const Decoded& d) {
+        writeData(s, Simulator::IO_BASE + d.values[0], s.data[d.values[1]]);
+        next(s, d);
+    }
+
+    void ld(State& s, const Decoded& d) {
+        s.data[d.values[0]] = readData(s, s.data[26] | s.data[27] << 8);
+        next(s, d);
+    }
+
+    void st(State& s, const Decoded& d) {
+        writeData(s, s.data[26] | s.data[27] << 8, s.data[d.values[1]]);
+        next(s, d);
+    }
+
+    void pushRegister(State& s, const Decoded& d) {
+        push(s, s.data[d.values[0]]);
+        next(s, d);
+    }
+
+    void popRegister(State& s, const Decoded& d) {
+        s.data[d.values[0]] = pop(s);
+        next(s, d);
+    }
+
+    void jmp(State& s, const Decoded& d) {
+        jump(s, static_cast<uint32_t>(d.values[0]), d.cycles);
+    }
+
+    void rjmp(State& s, const Decoded& d) {
+        jump(s, static_cast<uint32_t>(static_cast<int32_t>(s.pc) + 1 + d.values[0]), d.cycles);
+    }
+
+    void call(State& s, const Decoded& d) {
+        pushPc(s, (s.pc + 2) & PC_MASK);
+        jump(s, static_cast<uint32_t>(d.values[0]), d.cycles);
+    }
+
+    void rcall(State& s, const Decoded& d) {
+        pushPc(s, (s.pc + 1) & PC_MASK);
+        jump(s, static_cast<uint32_t>(static_cast<int32_t>(s.pc) + 1 + d.values[0]), d.cycles);
+    }
+
+    void ret(State& s, const Decoded& d) {
+        uint32_t high = pop(s);
+        uint32_t low = pop(s);
+        s.pc = (high << 8 | low) & PC_MASK;
+        s.cycles += d.cycles;
+    }
+
+    // BRBS/BRBC: bit 10 clear tests for a set flag, the low three bits pick it
+    void branch(State& s, const Decoded& d) {
+        uint32_t opcode = d.desc->opcode;
+        bool set = (s.data[Simulator::SREG] >> (opcode & 0x07)) & 1;
+        if (set == ((opcode & 0x0400) == 0)) {
+            jump(s, static_cast<uint32_t>(static_cast<int32_t>(s.pc) + 1 + d.values[0]), d.cyclesTaken);
+        } else {
+            next(s, d);
+        }
+    }
+
+    void illegal(State& s, const Decoded&) {
+        s.halted = true;
+        s.illegal = true;
+    }
+
+    struct HandlerEntry {
+        std::string_view mnemonic;
+        Simulator::Handler handler;
+    };
+
+    constexpr HandlerEntry HANDLERS[] = {
+        {"NOP", nop}, {"LDI", ldi}, {"ADD", add}, {"SUB", sub}, {"CP", cp}, {"CLR", clr}, {"DEC", dec},
+        {"IN", in}, {"OUT", out}, {"LD", ld}, {"ST", st}, {"PUSH", pushRegister}, {"POP", popRegister},
+        {"JMP", jmp}, {"RJMP", rjmp}, {"CALL", call}, {"RCALL", rcall}, {"RET", ret},
+        {"BREQ", branch}, {"BRNE", branch}, {"BRGE", branch}, {"BRLT", branch}
+    };
+
+    void writeHex(std::ostream& out, uint32_t value, int digits) {
+        out << "0x" << std::hex << std::uppercase << std::setw(digits) << std::setfill('0') << value
+            << std::dec << std::nouppercase << std::setfill(' ');
+    }
+}
+
+Simulator::Simulator() : decoded(FLASH_WORDS) {
+    clearFlash();
+}
+
+void Simulator::clearFlash() {
+    std::fill(std::begin(flash), std::end(flash), 0xFFFF);
+    std::fill(decoded.begin(), decoded.end(), Decoded{illegal, nullptr, {0, 0}, 1, 0, 0});
+    reset();
+}
+
+void Simulator::loadFlash(uint32_t address, const uint8_t* bytes, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        uint32_t byteAddress = (address + static_cast<uint32_t>(i)) & (FLASH_WORDS * 2 - 1);
+        uint16_t& word = flash[byteAddress / 2];
+        word = (byteAddress & 1) ? static_cast<uint16_t>((word & 0x00FF) | bytes[i] << 8)
+                                 : static_cast<uint16_t>((word & 0xFF00) | bytes[i]);
+    }
+    // The word before may be the first half of a two-word instruction
+    uint32_t first = address / 2;
+    uint32_t last = (address + static_cast<uint32_t>(size) + 1) / 2;
+    for (uint32_t pc = first == 0 ? 0 : first - 1; pc <= last && pc < FLASH_WORDS; ++pc) {
+        decodeWord(pc);
+    }
+}
+
+void Simulator::decodeWord(uint32_t pc) {
+    Decoded& entry = decoded[pc];
+    entry = Decoded{illegal, nullptr, {0, 0}, 1, 0, 0};
+    uint32_t word = flash[pc];
+    if (word == 0xFFFF) {
+        return;  // Erased flash
+    }
+    // The first word selects the descriptor through the disassembler's table
+    const Opcodes::Descriptor* desc = Disassembler::lookup(static_cast<uint16_t>(word));
+    int32_t values[2];
+    uint32_t code = desc != nullptr && desc->size == 4 ? word << 16 | flash[(pc + 1) & PC_MASK] : word;
+    if (desc == nullptr || !Opcodes::decode(*desc, code, values)) {
+        return;
+    }
+    for (const HandlerEntry& handler : HANDLERS) {
+        if (handler.mnemonic == desc->mnemonic) {
+            entry = Decoded{handler.handler, desc, {values[0], values[1]},
+                            static_cast<uint8_t>(desc->size / 2), desc->cycles, desc->cyclesTaken};
+            return;
+        }
+    }
+}
+
+void Simulator::reset() {
+    std::memset(state.data, 0, sizeof(state.data));
+    setStackPointer(state, RAMEND);
+    state.pc = 0;
+    state.cycles = 0;
+    state.halted = false;
+    state.illegal = false;
+    state.portWrites = nullptr;
+    instructions = 0;
+    portWrites.clear();
+    std::fill(counters.begin(), counters.end(), Counter{0, 0});
+}
+
+Simulator::StopReason Simulator::run(const Options& options, std::ostream* trace) {
+    state.halted = false;
+    state.portWrites = options.tracePorts ? &portWrites : nullptr;
+    if (options.profile && counters.empty()) {
+        counters.assign(FLASH_WORDS, Counter{0, 0});
+    }
+    if (trace != nullptr) {
+        return options.profile ? loop<true, true>(options, trace) : loop<false, true>(options, trace);
+    }
+    return options.profile ? loop<true, false>(options, trace) : loop<false, false>(options, trace);
+}
+
+template <bool Profile, bool Trace>
+Simulator::StopReason Simulator::loop(const Options& options, std::ostream* trace) {
+    State& s = state;
+    const Decoded* table = decoded.data();
+    uint64_t executed = instructions;
+    StopReason reason = StopReason::Halted;
+
+    while (!s.halted) {
+        if (s.cycles >= options.maxCycles) {
+            reason = StopReason::CycleLimit;
+            break;
+        }
+        if (executed >= options.maxInstructions) {
+            reason = StopReason::InstructionLimit;
+            break;
+        }
+        uint32_t pc = s.pc;
+        const Decoded& d = table[pc];
+        if constexpr (Trace) {
+            *trace << std::setw(10) << s.cycles << "  ";
+            writeHex(*trace, pc * 2, 4);
+            *trace << "  ";
+            disassemble(pc, *trace);
+            *trace << "\n";
+        }
+        uint64_t before = s.cycles;
+        d.handler(s, d);
+        ++executed;
+        if constexpr (Profile) {
+            counters[pc].executions += 1;
+            counters[pc].cycles += s.cycles - before;
+        }
+    }
+
+    if (s.illegal) {
+        --executed;  // Never ran
+        if constexpr (Profile) {
+            counters[s.pc].executions -= 1;
+        }
+        reason = StopReason::IllegalOpcode;
+    }
+    instructions = executed;
+    return reason;
+}
+
+uint32_t Simulator::getPc() const {
+    return state.pc;
+}
+
+uint64_t Simulator::getCycles() const {
+    return state.cycles;
+}
+
+uint64_t Simulator::getInstructions() const {
+    return instructions;
+}
+
+uint8_t Simulator::getRegister(uint8_t index) const {
+    return state.data[index & 0x1F];
+}
+
+uint8_t Simulator::getData(uint16_t address) const {
+    return readData(state, address);
+}
+
+uint16_t Simulator::getStackPointer() const {
+    return stackPointer(state);
+}
+
+const std::vector<Simulator::PortWrite>& Simulator::getPortWrites() const {
+    return portWrites;
+}
+
+const std::vector<Simulator::Counter>& Simulator::getCounters() const {
+    return counters;
+}
+
+bool Simulator::addressOf(const std::string& name, uint16_t& address) {
+    std::string upper(name);
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    for (const NamedRegister& named : NAMED_REGISTERS) {
+        if (upper == named.name) {
+            address = named.address;
+            return true;
+        }
+    }
+    if (upper.size() >= 2 && upper.size() <= 3 && upper[0] == 'R'
+        && std::all_of(upper.begin() + 1, upper.end(), ::isdigit)) {
+        int index = std::stoi(upper.substr(1));
+        if (index < 32) {
+            address = static_cast<uint16_t>(index);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* Simulator::nameOf(uint16_t address) {
+    for (const NamedRegister& named : NAMED_REGISTERS) {
+        if (named.address == address) {
+            return named.name;
+        }
+    }
+    return nullptr;
+}
+
+void Simulator::disassemble(uint32_t pc, std::ostream& out) const {
+    const Decoded& d = decoded[pc & PC_MASK];
+    if (d.desc == nullptr) {
+        out << ".dw ";
+        writeHex(out, flash[pc & PC_MASK], 4);
+        return;
+    }
+    out << d.desc->mnemonic;
+    for (uint8_t i = 0; i < d.desc->operandCount; ++i) {
+        out << (i == 0 ? " " : ", ");
+        int32_t value = d.values[i];
+        switch (d.desc->operands[i]) {
+            case Opcodes::OperandKind::Register:
+            case Opcodes::OperandKind::UpperRegister:
+                out << "R" << value;
+                break;
+            case Opcodes::OperandKind::PointerX:
+                out << "X";
+                break;
+            case Opcodes::OperandKind::Absolute22:
+                writeHex(out, static_cast<uint32_t>(value) * 2, 4);
+                break;
+            case Opcodes::OperandKind::Relative12:
+            case Opcodes::OperandKind::Relative7:
+                writeHex(out, ((static_cast<int32_t>(pc) + 1 + value) & PC_MASK) * 2, 4);
+                break;
+            default:
+                writeHex(out, static_cast<uint32_t>(value), 2);
+                break;
+        }
+    }
+}
+
+void Simulator::dump(std::ostream& out) const {
+    for (uint8_t i = 0; i < 32; ++i) {
+        out << (i % 8 == 0 ? "  " : " ") << "R" << std::setw(2) << std::left << static_cast<int>(i) << std::right << "=";
+        writeHex(out, state.data[i], 2);
+        if (i % 8 == 7) {
+            out << "\n";
+        }
+    }
+
+    const char flagNames[] = "CZNVSHTI";
+    out << "  SREG=";
+    for (int bit = 7; bit >= 0; --bit) {
+        bool set = (state.data[SREG] >> bit) & 1;
+        out << static_cast<char>(set ? flagNames[bit] : flagNames[bit] + ('a' - 'A'));
+    }
+    out << "  SP=";
+    writeHex(out, stackPointer(state), 4);
+    out << "  PC=";
+    writeHex(out, state.pc * 2, 4);
+    out << "  cycles=" << state.cycles << "\n";
+
+    for (uint16_t address = IO_BASE; address < 0x100; ++address) {
+        if (address == SPL || address == SPH || address == SREG || state.data[address] == 0) {
+            continue;
+        }
+        const char* name = nameOf(address);
+        out << "  " << (name != nullptr ? name : "IO") << " (";
+        writeHex(out, address, 2);
+        out << ")=";
+        writeHex(out, state.data[address], 2);
+        out << "\n";
+    }
+}
+
+template Simulator::StopReason Simulator::loop<true, true>(const Options&, std::ostream*);
+template Simulator::StopReason Simulator::loop<true, false>(const Options&, std::ostream*);
+template Simulator::StopReason Simulator::loop<false, true>(const Options&, std::ostream*);
+template Simulator::StopReason Simulator::loop<false, false>(const Options&, std::ostream*);
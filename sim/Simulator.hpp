@@ -0,0 +1,120 @@
+#pragma once
+#include "OpcodeMap.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Headless ATmega328 core for the instructions in Opcodes::TABLE. Flash is
+// decoded once into a handler per word; run() is a tight dispatch loop over
+// that table. Interrupts and peripherals are not simulated, I/O registers are
+// plain memory.
+class Simulator {
+public:
+    static constexpr uint32_t FLASH_WORDS = 0x4000;   // 32 KB
+    static constexpr uint32_t DATA_SIZE = 0x0900;     // registers, I/O, extended I/O, 2 KB SRAM
+    static constexpr uint16_t RAMEND = DATA_SIZE - 1;
+    static constexpr uint16_t IO_BASE = 0x20;         // data address of I/O register 0
+    static constexpr uint16_t SPL = 0x5D;
+    static constexpr uint16_t SPH = 0x5E;
+    static constexpr uint16_t SREG = 0x5F;
+
+    // SREG bits
+    enum Flag : uint8_t { C = 0x01, Z = 0x02, N = 0x04, V = 0x08, S = 0x10, H = 0x20, T = 0x40, I = 0x80 };
+
+    enum class StopReason {
+        CycleLimit,
+        InstructionLimit,
+        Halted,         // a jump to itself, the usual end of a test program
+        IllegalOpcode   // erased flash or an instruction outside Opcodes::TABLE
+    };
+
+    struct Options {
+        uint64_t maxCycles = 100000000;
+        uint64_t maxInstructions = UINT64_MAX;
+        bool profile = false;     // count executions and cycles per flash word
+        bool tracePorts = false;  // record every write to the I/O space
+    };
+
+    // Write to an I/O or extended I/O register
+    struct PortWrite {
+        uint64_t cycle;
+        uint16_t address;  // data address
+        uint8_t value;
+    };
+
+    // Executions and cycles spent at one flash word
+    struct Counter {
+        uint64_t executions;
+        uint64_t cycles;
+    };
+
+    Simulator();
+
+    // Erases flash and resets the core
+    void clearFlash();
+    // Copies bytes into flash at a byte address and decodes the words they cover
+    void loadFlash(uint32_t address, const uint8_t* bytes, size_t size);
+    // Power-on state: registers and SRAM cleared, SP = RAMEND, PC = 0
+    void reset();
+
+    // Runs until a limit is hit or the program halts. With trace, every
+    // instruction is printed before it executes.
+    StopReason run(const Options& options, std::ostream* trace = nullptr);
+
+    uint32_t getPc() const;          // word address
+    uint64_t getCycles() const;
+    uint64_t getInstructions() const;
+    uint8_t getRegister(uint8_t index) const;
+    uint8_t getData(uint16_t address) const;
+    uint16_t getStackPointer() const;
+    const std::vector<PortWrite>& getPortWrites() const;
+    const std::vector<Counter>& getCounters() const;  // indexed by word address
+
+    // Data address of a register name (R0-R31, SREG, SPL, SPH, PINB, DDRB,
+    // PORTB, ...). Returns false for unknown names.
+    static bool addressOf(const std::string& name, uint16_t& address);
+    // Name of an I/O register, or nullptr
+    static const char* nameOf(uint16_t address);
+
+    // Writes registers, SREG, SP and the non-zero I/O registers
+    void dump(std::ostream& out) const;
+    // "LDI R16, 0x20" style text of the instruction at a word address
+    void disassemble(uint32_t pc, std::ostream& out) const;
+
+    // Execution state seen by the instruction handlers
+    struct State {
+        uint8_t data[DATA_SIZE];
+        uint32_t pc;
+        uint64_t cycles;
+        bool halted;
+        bool illegal;
+        std::vector<PortWrite>* portWrites;  // nullptr unless ports are traced
+    };
+
+    struct Decoded;
+    using Handler = void (*)(State&, const Decoded&);
+
+    // One predecoded flash word
+    struct Decoded {
+        Handler handler;
+        const Opcodes::Descriptor* desc;  // nullptr for illegal opcodes
+        int32_t values[2];
+        uint8_t words;
+        uint8_t cycles;
+        uint8_t cyclesTaken;
+    };
+
+private:
+    uint16_t flash[FLASH_WORDS];
+    std::vector<Decoded> decoded;
+    State state;
+    uint64_t instructions = 0;
+    std::vector<PortWrite> portWrites;
+    std::vector<Counter> counters;
+
+    void decodeWord(uint32_t pc);
+    template <bool Profile, bool Trace>
+    StopReason loop(const Options& options, std::ostream* trace);
+};
@@ -0,0 +1,389 @@
+#include "Simulator.hpp"
+#include "Assembler.hpp"
+#include "CompileTimeAssembler.hpp"
+#include "IntelHex.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] <image.hex|image.bin> [<image> ...]\n"
+              << "Options:\n"
+              << "  --cycles <n>        Stop after n cycles (default 100000000)\n"
+              << "  --instructions <n>  Stop after n instructions\n"
+              << "  --trace             Print every instruction before it executes\n"
+              << "  --trace-ports       Print every write to an I/O register\n"
+              << "  --dump              Print registers, SREG, SP and I/O registers at the end\n"
+              << "  --profile           Print the instructions that used the most cycles\n"
+              << "  --line-map <file>   Source lines for the profile, from the assembler's --line-map\n"
+              << "  --expect <reg>=<v>  Fail unless a register (R0-R31, SREG, SP, PORTB, ...) or data\n"
+              << "                      address holds v at the end\n"
+              << "  --require-halt      Fail unless the program reaches a jump to itself\n"
+              << "  --self-test         Run the built-in test programs\n";
+}
+
+struct Expectation {
+    std::string name;
+    uint16_t address;  // data address, or SP_EXPECTATION
+    uint32_t value;
+};
+
+static constexpr uint16_t SP_EXPECTATION = 0xFFFF;
+
+// Reads "name=value" where name is a register or a data address
+static bool parseExpectation(const std::string& text, Expectation& expectation) {
+    size_t equals = text.find('=');
+    if (equals == 0 || equals == std::string::npos || equals + 1 == text.size()) {
+        return false;
+    }
+    expectation.name = text.substr(0, equals);
+    try {
+        size_t used = 0;
+        unsigned long value = std::stoul(text.substr(equals + 1), &used, 0);
+        if (used != text.size() - equals - 1 || value > 0xFFFF) {
+            return false;
+        }
+        expectation.value = static_cast<uint32_t>(value);
+
+        std::string upper = expectation.name;
+        std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+        if (upper == "SP") {
+            expectation.address = SP_EXPECTATION;
+            return true;
+        }
+        if (Simulator::addressOf(expectation.name, expectation.address)) {
+            return expectation.value <= 0xFF;
+        }
+        unsigned long address = std::stoul(expectation.name, &used, 0);
+        expectation.address = static_cast<uint16_t>(address);
+        return used == expectation.name.size() && address < Simulator::DATA_SIZE && expectation.value <= 0xFF;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+static std::vector<uint8_t> readFile(const std::string& fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open image: " + fileName);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// .hex files are parsed as Intel HEX, everything else is a raw binary at 0
+static void loadImage(Simulator& simulator, const std::string& fileName) {
+    std::vector<uint8_t> bytes = readFile(fileName);
+    simulator.clearFlash();
+    if (endsWith(fileName, ".hex") || endsWith(fileName, ".HEX")) {
+        IntelHex::ParseResult image = IntelHex::parse(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+        for (const IntelHex::Block& block : image.blocks) {
+            if (block.address + block.data.size() > Simulator::FLASH_WORDS * 2) {
+                throw std::runtime_error(fileName + " does not fit into 32 KB of flash");
+            }
+            simulator.loadFlash(block.address, block.data.data(), block.data.size());
+        }
+    } else {
+        if (bytes.size() > Simulator::FLASH_WORDS * 2) {
+            throw std::runtime_error(fileName + " does not fit into 32 KB of flash");
+        }
+        simulator.loadFlash(0, bytes.data(), bytes.size());
+    }
+}
+
+// Source line of every byte address, from the assembler's line map
+struct LineMap {
+    std::unordered_map<uint32_t, uint32_t> lines;
+    std::vector<std::string> source;
+};
+
+static LineMap readLineMap(const std::string& fileName) {
+    std::ifstream file(fileName);
+    if (!file) {
+        throw std::runtime_error("Failed to open line map: " + fileName);
+    }
+    LineMap map;
+    std::string text;
+    while (std::getline(file, text)) {
+        if (text.empty() || text[0] == ';') {
+            continue;
+        }
+        if (text.compare(0, 7, "source ") == 0) {
+            std::ifstream source(text.substr(7));
+            for (std::string line; std::getline(source, line);) {
+                map.source.push_back(line);
+            }
+            continue;
+        }
+        std::istringstream entry(text);
+        std::string address;
+        uint32_t line = 0;
+        if (!(entry >> address >> line)) {
+            throw std::runtime_error("Malformed line map entry: " + text);
+        }
+        map.lines[static_cast<uint32_t>(std::stoul(address, nullptr, 16))] = line;
+    }
+    return map;
+}
+
+static std::string hex(uint32_t value, int digits) {
+    std::ostringstream text;
+    text << "0x" << std::hex << std::uppercase << std::setw(digits) << std::setfill('0') << value;
+    return text.str();
+}
+
+static void printProfile(const Simulator& simulator, const LineMap& lineMap) {
+    const std::vector<Simulator::Counter>& counters = simulator.getCounters();
+    std::vector<uint32_t> hot;
+    for (uint32_t pc = 0; pc < counters.size(); ++pc) {
+        if (counters[pc].executions != 0) {
+            hot.push_back(pc);
+        }
+    }
+    std::sort(hot.begin(), hot.end(), [&](uint32_t a, uint32_t b) {
+        return counters[a].cycles != counters[b].cycles ? counters[a].cycles > counters[b].cycles : a < b;
+    });
+    if (hot.size() > 20) {
+        hot.resize(20);
+    }
+
+    uint64_t total = std::max<uint64_t>(simulator.getCycles(), 1);
+    std::cout << "  address  executions      cycles      %  instruction\n";
+    for (uint32_t pc : hot) {
+        std::ostringstream instruction;
+        simulator.disassemble(pc, instruction);
+        std::cout << "  " << hex(pc * 2, 4) << std::setw(12) << counters[pc].executions
+                  << std::setw(12) << counters[pc].cycles << std::setw(7) << std::fixed << std::setprecision(2)
+                  << 100.0 * static_cast<double>(counters[pc].cycles) / static_cast<double>(total)
+                  << "  " << std::left << std::setw(18) << instruction.str() << std::right;
+        auto line = lineMap.lines.find(pc * 2);
+        if (line != lineMap.lines.end()) {
+            std::cout << "  line " << line->second;
+            if (line->second != 0 && line->second <= lineMap.source.size()) {
+                std::cout << ": " << lineMap.source[line->second - 1];
+            }
+        }
+        std::cout << "\n";
+    }
+}
+
+// Compares the final state with every expectation; returns the number that failed
+static size_t checkExpectations(const Simulator& simulator, const std::vector<Expectation>& expectations) {
+    size_t failed = 0;
+    for (const Expectation& expectation : expectations) {
+        uint32_t actual = expectation.address == SP_EXPECTATION ? simulator.getStackPointer()
+                                                                 : simulator.getData(expectation.address);
+        if (actual != expectation.value) {
+            std::cerr << "  Expected " << expectation.name << " = " << hex(expectation.value, 2)
+                      << ", got " << hex(actual, 2) << "\n";
+            ++failed;
+        }
+    }
+    return failed;
+}
+
+// Built-in test programs, assembled while the simulator is compiled
+static constexpr std::string_view PORT_SOURCE = R"(
+    LDI R16, 0x20       ; PB5
+    OUT 0x04, R16       ; DDRB
+    OUT 0x05, R16       ; PORTB
+halt:
+    RJMP halt
+)";
+
+static constexpr std::string_view LOOP_SOURCE = R"(
+    LDI R16, 10
+    LDI R18, 3
+    CLR R17
+again:
+    ADD R17, R18
+    DEC R16
+    BRNE again
+    OUT 0x05, R17       ; PORTB = 30
+halt:
+    RJMP halt
+)";
+
+static constexpr std::string_view CALL_SOURCE = R"(
+    LDI R16, 0x42
+    PUSH R16
+    CALL twice
+    POP R20
+    OUT 0x0B, R20       ; PORTD = 0x42
+    RCALL twice
+    OUT 0x05, R16       ; PORTB = 0x08
+halt:
+    JMP halt
+twice:
+    ADD R16, R16
+    RET
+)";
+
+static constexpr auto PORT_PROGRAM = AVR_PROGRAM(PORT_SOURCE);
+static constexpr auto LOOP_PROGRAM = AVR_PROGRAM(LOOP_SOURCE);
+static constexpr auto CALL_PROGRAM = AVR_PROGRAM(CALL_SOURCE);
+
+struct SelfTest {
+    const char* name;
+    std::string_view source;
+    const uint8_t* code;
+    size_t size;
+    uint16_t address;   // data address checked at the end
+    uint8_t value;
+};
+
+static const SelfTest SELF_TESTS[] = {
+    {"ports", PORT_SOURCE, PORT_PROGRAM.data(), PORT_PROGRAM.size(), Simulator::IO_BASE + 0x05, 0x20},
+    {"loop", LOOP_SOURCE, LOOP_PROGRAM.data(), LOOP_PROGRAM.size(), Simulator::IO_BASE + 0x05, 30},
+    {"call", CALL_SOURCE, CALL_PROGRAM.data(), CALL_PROGRAM.size(), Simulator::IO_BASE + 0x0B, 0x42}
+};
+
+// Runs every built-in program after checking that the assembler produces the
+// same bytes at run time; returns the number that failed
+static size_t runSelfTests(Simulator& simulator) {
+    size_t failed = 0;
+    for (const SelfTest& test : SELF_TESTS) {
+        Assembler assembler;
+        std::vector<uint8_t> expected(test.size);
+        bool assembled = assembler.assemble(test.source);
+        if (assembled) {
+            assembler.getImage().read(0, expected.data(), expected.size());
+        }
+        if (!assembled || assembler.getImage().usedBytes() != test.size
+            || !std::equal(expected.begin(), expected.end(), test.code)) {
+            std::cout << test.name << ": compile-time code differs from the assembler\n";
+            ++failed;
+            continue;
+        }
+
+        simulator.clearFlash();
+        simulator.loadFlash(0, test.code, test.size);
+        Simulator::Options options;
+        options.maxCycles = 10000;
+        Simulator::StopReason reason = simulator.run(options, nullptr);
+        bool passed = reason == Simulator::StopReason::Halted && simulator.getData(test.address) == test.value
+                      && simulator.getStackPointer() == Simulator::RAMEND;
+        std::cout << test.name << ": " << (passed ? "passed" : "failed") << " after " << simulator.getCycles()
+                  << " cycles\n";
+        failed += passed ? 0 : 1;
+    }
+    return failed;
+}
+
+static const char* stopText(Simulator::StopReason reason) {
+    switch (reason) {
+        case Simulator::StopReason::CycleLimit: return "cycle limit reached";
+        case Simulator::StopReason::InstructionLimit: return "instruction limit reached";
+        case Simulator::StopReason::Halted: return "halted";
+        case Simulator::StopReason::IllegalOpcode: return "illegal opcode";
+    }
+    return "";
+}
+
+int main(int argc, char* argv[]) {
+    Simulator::Options options;
+    bool trace = false;
+    bool dump = false;
+    bool requireHalt = false;
+    bool selfTest = false;
+    std::string lineMapFile;
+    std::vector<Expectation> expectations;
+    std::vector<std::string> images;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--cycles" && i + 1 < argc) {
+                options.maxCycles = std::stoull(argv[++i]);
+            } else if (arg == "--instructions" && i + 1 < argc) {
+                options.maxInstructions = std::stoull(argv[++i]);
+            } else if (arg == "--trace") {
+                trace = true;
+            } else if (arg == "--trace-ports") {
+                options.tracePorts = true;
+            } else if (arg == "--dump") {
+                dump = true;
+            } else if (arg == "--profile") {
+                options.profile = true;
+            } else if (arg == "--line-map" && i + 1 < argc) {
+                lineMapFile = argv[++i];
+            } else if (arg == "--require-halt") {
+                requireHalt = true;
+            } else if (arg == "--self-test") {
+                selfTest = true;
+            } else if (arg == "--expect" && i + 1 < argc) {
+                Expectation expectation;
+                if (!parseExpectation(argv[++i], expectation)) {
+                    std::cerr << "Error: Expected <register>=<value> for --expect, got '" << argv[i] << "'\n";
+                    return 1;
+                }
+                expectations.push_back(expectation);
+            } else {
+                images.push_back(arg);
+            }
+        }
+    } catch (const std::exception&) {
+        std::cerr << "Error: Invalid number in the options\n";
+        return 1;
+    }
+    if (images.empty() && !selfTest) {
+        printUsage(argv[0]);
+        return 0;
+    }
+
+    // One simulator serves every image, so the decode table is allocated once
+    Simulator simulator;
+    LineMap lineMap;
+    size_t failed = selfTest ? runSelfTests(simulator) : 0;
+    for (const std::string& image : images) {
+        try {
+            if (!lineMapFile.empty() && lineMap.lines.empty()) {
+                lineMap = readLineMap(lineMapFile);
+            }
+            loadImage(simulator, image);
+            auto start = std::chrono::steady_clock::now();
+            Simulator::StopReason reason = simulator.run(options, trace ? &std::cout : nullptr);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::cout << image << ": " << stopText(reason) << " at " << hex(simulator.getPc() * 2, 4) << " after "
+                      << simulator.getInstructions() << " instructions, " << simulator.getCycles() << " cycles";
+            if (seconds > 0.0) {
+                std::cout << " (" << std::fixed << std::setprecision(1)
+                          << static_cast<double>(simulator.getInstructions()) / seconds / 1e6 << " MIPS)";
+            }
+            std::cout << "\n";
+
+            for (const Simulator::PortWrite& write : simulator.getPortWrites()) {
+                const char* name = Simulator::nameOf(write.address);
+                std::cout << "  cycle " << write.cycle << ": " << (name != nullptr ? name : "IO") << " ("
+                          << hex(write.address, 2) << ") = " << hex(write.value, 2) << "\n";
+            }
+            if (dump) {
+                simulator.dump(std::cout);
+            }
+            if (options.profile) {
+                printProfile(simulator, lineMap);
+            }
+
+            size_t mismatches = checkExpectations(simulator, expectations);
+            if (mismatches != 0 || reason == Simulator::StopReason::IllegalOpcode
+                || (requireHalt && reason != Simulator::StopReason::Halted)) {
+                ++failed;
+            }
+        } catch (const std::exception& ex) {
+            std::cerr << "Error: " << image << ": " << ex.what() << "\n";
+            ++failed;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
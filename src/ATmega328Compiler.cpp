@@ -2,429 +2,558 @@
 // Author: Swen "El Dockerr" Kalski <swen.kalski@camaleao-studio.com>
 
 #include "ATmega328Compiler.hpp"
-#include "OpcodeMap.hpp"
+#include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <algorithm>
 #include <stdexcept>
 #include <iomanip>
+#include <iterator>
+#include <chrono>
+
+namespace {
+    bool isHexFileName(const std::string& fileName) {
+        return fileName.size() >= 4 && (fileName.compare(fileName.size() - 4, 4, ".hex") == 0
+                                        || fileName.compare(fileName.size() - 4, 4, ".HEX") == 0);
+    }
+
+    // HEX files hold their segments. Binary images are full flash dumps, in
+    // which erased words are gaps.
+    void parseImage(const std::string& fileName, const std::string& data, MemoryImage& image) {
+        image.clear();
+        if (isHexFileName(fileName)) {
+            for (const IntelHex::Block& block : IntelHex::parse(data).blocks) {
+                image.write(block.address, block.data.data(), block.data.size());
+            }
+            return;
+        }
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+        for (size_t i = 0; i + 1 < data.size(); i += 2) {
+            if (bytes[i] != 0xFF || bytes[i + 1] != 0xFF) {
+                image.write(static_cast<uint32_t>(i), bytes + i, 2);
+            }
+        }
+    }
+}
 
 ATmega328Compiler::ATmega328Compiler(const std::string& cType,  const std::string& inputFileName, const std::string& outputFileName)
     : compileType(cType)
     ,inputFileName(inputFileName)
-    , outputFileName(outputFileName)
-    , opcodeMap(Opcodes::MAP) {
+    , outputFileName(outputFileName) {
+    assembler.setRelocatable(compileType == "obj");
+    assembler.setIncludeResolver([this](std::string_view name, const std::string& includer, Assembler::IncludeFile& file) {
+        return resolveInclude(name, includer, file, false);
+    });
+    assembler.setBinaryResolver([this](std::string_view name, const std::string& includer, Assembler::IncludeFile& file) {
+        return resolveInclude(name, includer, file, true);
+    });
 }
 
-void ATmega328Compiler::compile() {
-    readFile();
-    tokenize();
-    firstPass();
-    secondPass();
-    writeOutput();
+void ATmega328Compiler::setVerbose(bool enabled) {
+    verbose = enabled;
+    assembler.setLog(enabled ? &std::cout : nullptr);
 }
 
-void ATmega328Compiler::readFile() {
-    std::ifstream file(inputFileName);
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open input file: " + inputFileName);
-    }
-    std::string line;
-    while (std::getline(file, line)) {
-        lines.push_back(line);
-    }
-    file.close();
+void ATmega328Compiler::setSinglePass(bool enabled) {
+    singlePass = enabled;
+    assembler.setSinglePass(enabled);
 }
 
-std::string ATmega328Compiler::trim(const std::string& str) {
-    size_t first = str.find_first_not_of(" \t");
-    if (first == std::string::npos) return "";
-    size_t last = str.find_last_not_of(" \t");
-    return str.substr(first, (last - first + 1));
+void ATmega328Compiler::setHexOptions(const IntelHex::Options& options) {
+    hexOptions = options;
 }
 
-void ATmega328Compiler::tokenize() {
-    for (auto& line : lines) {
-        line = trim(line);
-    }
+void ATmega328Compiler::setVerifyOutput(bool enabled) {
+    verifyOutput = enabled;
 }
 
-void ATmega328Compiler::firstPass() {
-    uint16_t programCounter = 0;
+void ATmega328Compiler::setRoundTrip(bool enabled) {
+    roundTrip = enabled;
+}
 
-    // First pass: collect all label addresses
-    for (const auto& line : lines) {
-        if (line.empty() || line[0] == ';') {
-            continue;
-        }
+void ATmega328Compiler::setRelaxBranches(bool enabled) {
+    relaxBranches = enabled;
+    assembler.setRelaxBranches(enabled);
+}
 
-        // Store label position
-        if (line.back() == ':') {
-            std::string label = line.substr(0, line.size() - 1);
-            if (labelMap.find(label) != labelMap.end()) {
-                throw std::runtime_error("Duplicate label: " + label);
-            }
-            labelMap[label] = programCounter;
-            std::cout << "Label " << label << " at address: " << programCounter << std::endl;
-            continue;
-        }
+void ATmega328Compiler::setPeepholeOptions(const Peephole::Options& options) {
+    peepholeOptions = options;
+    assembler.setPeepholeOptions(options);
+}
 
-        // Parse instruction and update program counter
-        std::istringstream iss(line);
-        std::string mnemonic;
-        iss >> mnemonic;
+void ATmega328Compiler::setCycleAnalysis(bool enabled, const std::unordered_map<std::string, uint32_t>& loopBounds) {
+    cycleAnalysis = enabled;
+    assembler.setCycleAnalysis(enabled, loopBounds);
+}
 
-        if (mnemonic.empty()) {
-            continue;
+void ATmega328Compiler::setMemoryMap(bool enabled) {
+    mapMemory = enabled;
+}
+
+void ATmega328Compiler::setLineMapFile(const std::string& fileName) {
+    lineMapFileName = fileName;
+}
+
+void ATmega328Compiler::setIncludePaths(const std::vector<std::string>& paths) {
+    includePaths = paths;
+}
+
+void ATmega328Compiler::setHeaderCache(const std::string& directory) {
+    headerCache = directory.empty() ? nullptr : std::make_unique<HeaderCache>(directory);
+    assembler.setPrecompileHeaders(headerCache != nullptr);
+}
+
+void ATmega328Compiler::setBuildCache(const std::string& directory, uint64_t maxBytes) {
+    buildCache = directory.empty() ? nullptr : std::make_unique<BuildCache>(directory, maxBytes);
+}
+
+void ATmega328Compiler::setDelta(const std::string& previousFileName, const std::string& deltaFileName) {
+    this->previousFileName = previousFileName;
+    this->deltaFileName = deltaFileName;
+}
+
+void ATmega328Compiler::compile() {
+    phaseTimes.clear();
+    includeTexts.clear();
+    cacheMisses.clear();
+    dependencies.clear();
+    cached = false;
+    mapped = false;
+    runPhase("readFile", &ATmega328Compiler::readFile);
+    if (usesBuildCache()) {
+        runPhase("buildCache", &ATmega328Compiler::findBuild);
+        if (cached) {
+            return;
         }
+    }
+    bool success = assembler.assemble(source);
+    phaseTimes.insert(phaseTimes.end(), assembler.getPhaseTimes().begin(), assembler.getPhaseTimes().end());
+    if (!success) {
+        // A program too large for the flash still gets its map, to show what to cut
+        if (mapMemory && !assembler.getOverflowLayout().empty()) {
+            runPhase("memoryMap", &ATmega328Compiler::buildOverflowMap);
+        }
+        const Assembler::Diagnostic& diagnostic = assembler.getDiagnostics().front();
+        throw std::runtime_error((diagnostic.file.empty() ? "" : diagnostic.file + ": ") + diagnostic.message);
+    }
+    storeHeaders();
+    if (mapMemory) {
+        runPhase("memoryMap", &ATmega328Compiler::buildMemoryMap);
+    }
+    runPhase("writeOutput", &ATmega328Compiler::writeOutput);
+    if (roundTrip && compileType != "obj") {
+        runPhase("roundTrip", &ATmega328Compiler::checkRoundTrip);
+    }
+    if (!deltaFileName.empty() && compileType != "obj") {
+        runPhase("delta", &ATmega328Compiler::writeDelta);
+    }
+    if (usesBuildCache()) {
+        runPhase("storeBuild", &ATmega328Compiler::storeBuild);
+    }
+}
 
-        // Determine instruction size
-        if (mnemonic == "JMP" || mnemonic == "CALL") {
-            programCounter += 4;  // 32-bit instructions
+void ATmega328Compiler::compileStream(std::istream& in, std::ostream& out) {
+    constexpr size_t PIECE_SIZE = 64 * 1024;
+    phaseTimes.clear();
+    includeTexts.clear();
+    mode = Mode::Stream;
+    if (compileType != "hex" && compileType != "bin") {
+        throw std::runtime_error("Unknown output format for streaming: " + compileType);
+    }
+    auto check = [this](bool success) {
+        if (!success) {
+            const Assembler::Diagnostic& diagnostic = assembler.getDiagnostics().front();
+            throw std::runtime_error((diagnostic.file.empty() ? "" : diagnostic.file + ": ") + diagnostic.message);
         }
-        else if (opcodeMap.find(mnemonic) != opcodeMap.end()) {
-            programCounter += 2;  // 16-bit instructions
+    };
+
+    // HEX records are cut where a whole-file build cuts them: only full
+    // records of a run leave before the run ends
+    IntelHex::Writer writer(hexOptions);
+    std::vector<uint8_t> run;
+    uint32_t runAddress = 0;
+    uint32_t position = 0;  // bytes of binary output written so far
+    auto writeRun = [&](size_t size) {
+        writer.addData(runAddress, run.data(), size);
+        writer.flush(out);
+        run.erase(run.begin(), run.begin() + static_cast<std::ptrdiff_t>(size));
+        runAddress += static_cast<uint32_t>(size);
+    };
+    assembler.beginStream([&](uint32_t address, const uint8_t* data, size_t size) {
+        if (compileType == "bin") {
+            for (; position < address; ++position) {
+                out.put(static_cast<char>(0xFF));
+            }
+            out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+            position += static_cast<uint32_t>(size);
+            return;
+        }
+        if (!run.empty() && runAddress + run.size() != address) {
+            writeRun(run.size());
+        }
+        if (run.empty()) {
+            runAddress = address;
+        }
+        run.insert(run.end(), data, data + size);
+        writeRun(run.size() / hexOptions.recordLength * hexOptions.recordLength);
+    });
+
+    // Take what the stream has buffered without blocking. A piece is
+    // assembled when it is full or the writer stalls, up to its last complete
+    // line; the rest starts the next piece.
+    auto start = std::chrono::steady_clock::now();
+    std::streambuf& buffer = *in.rdbuf();
+    std::string piece;
+    auto feedLines = [&]() {
+        size_t end = piece.rfind('\n');
+        if (end != std::string::npos) {
+            check(assembler.feed(std::string_view(piece).substr(0, end + 1)));
+            piece.erase(0, end + 1);
+            out.flush();
+        }
+    };
+    for (;;) {
+        // Files report all their remaining bytes as available
+        std::streamsize available = std::min<std::streamsize>(buffer.in_avail(), PIECE_SIZE);
+        if (available > 0) {
+            size_t kept = piece.size();
+            piece.resize(kept + static_cast<size_t>(available));
+            piece.resize(kept + static_cast<size_t>(buffer.sgetn(&piece[kept], available)));
+            if (piece.size() >= PIECE_SIZE) {
+                feedLines();
+            }
+            continue;
         }
-        else {
-            throw std::runtime_error("Unknown instruction: " + mnemonic);
+        feedLines();
+        // Blocks until the writer sends more or closes the stream
+        if (available < 0 || buffer.sgetc() == std::char_traits<char>::eof()) {
+            break;
         }
+    }
+    check(assembler.endStream(piece));
 
-        // Debug output
-        std::cout << "Instruction " << mnemonic << " at address: " << (programCounter - ((mnemonic == "JMP" || mnemonic == "CALL") ? 4 : 2)) << std::endl;
+    if (compileType == "bin") {
+        for (; position < FLASH_SIZE; ++position) {
+            out.put(static_cast<char>(0xFF));
+        }
+    } else {
+        writeRun(run.size());
+        out << writer.finish();
     }
+    out.flush();
+    if (!out) {
+        throw std::runtime_error("Error occurred while writing the output stream");
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    phaseTimes = assembler.getPhaseTimes();
+    double assembling = 0.0;
+    for (const PhaseTime& phase : phaseTimes) {
+        assembling += phase.milliseconds;
+    }
+    phaseTimes.push_back({"readAndWrite", elapsed.count() - assembling});
+}
 
-    // Validate addresses
-    if (programCounter > 0x8000) {
-        throw std::runtime_error("Program too large");
+void ATmega328Compiler::link(const std::vector<std::string>& fileNames) {
+    phaseTimes.clear();
+    objectFileNames = fileNames;
+    mode = Mode::Link;
+    runPhase("readObjects", &ATmega328Compiler::readObjects);
+    runPhase("link", &ATmega328Compiler::linkObjects);
+    runPhase("writeOutput", &ATmega328Compiler::writeOutput);
+    if (roundTrip) {
+        runPhase("roundTrip", &ATmega328Compiler::checkRoundTrip);
+    }
+    if (!deltaFileName.empty()) {
+        runPhase("delta", &ATmega328Compiler::writeDelta);
     }
 }
 
-void ATmega328Compiler::secondPass() {
-    uint16_t address = 0;
-    for (const auto& line : lines) {
-        if (line.empty() || line[0] == ';' || line.back() == ':') {
-            continue;
-        }
+void ATmega328Compiler::disassemble() {
+    phaseTimes.clear();
+    mode = Mode::Disassemble;
+    runPhase("readImage", &ATmega328Compiler::readImage);
+    runPhase("disassemble", &ATmega328Compiler::writeDisassembly);
+    if (roundTrip) {
+        runPhase("roundTrip", &ATmega328Compiler::checkRoundTrip);
+    }
+}
 
-        std::istringstream iss(line);
-        std::string mnemonic;
-        iss >> mnemonic;
+void ATmega328Compiler::readImage() {
+    readFile();
+    parseImage(inputFileName, source, inputImage);
+}
 
-        uint16_t opcode = 0;
-        if (mnemonic == "LDI") {
-            // Format: LDI Rd,K (1110 KKKK dddd KKKK)
-            std::string reg, value;
-            iss >> reg >> value;
+void ATmega328Compiler::writeDelta() {
+    std::ifstream file(previousFileName, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open previous image: " + previousFileName);
+    }
+    std::string data(static_cast<size_t>(file.tellg()), '\0');
+    file.seekg(0);
+    if (!data.empty() && !file.read(&data[0], static_cast<std::streamsize>(data.size()))) {
+        throw std::runtime_error("Failed to read previous image: " + previousFileName);
+    }
+    MemoryImage previous;
+    parseImage(previousFileName, data, previous);
+    deltaPages = FlashDelta::changedPages(previous, image());
 
-            reg = trimOperand(reg);
-            value = trimOperand(value);
+    if (isHexFileName(deltaFileName)) {
+        writeHex(FlashDelta::extract(image(), deltaPages), deltaFileName);
+        return;
+    }
+    std::string pages;
+    FlashDelta::writePageList(image(), deltaPages, pages);
+    std::ofstream out(deltaFileName, std::ios::binary);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed to open delta file: " + deltaFileName);
+    }
+    out.write(pages.data(), static_cast<std::streamsize>(pages.size()));
+    if (!out) {
+        throw std::runtime_error("Error occurred while writing to delta file: " + deltaFileName);
+    }
+}
 
-            int regNum = parseRegister(reg);  // Use parseRegister
-            if (regNum < 16 || regNum > 31) {
-                throw std::runtime_error("LDI can only be used with R16 to R31. Found: " + reg);
-            }
-            int immValue = std::stoi(value, nullptr, 0);  // Auto-detect base
-            if (immValue < 0 || immValue > 0xFF) {
-                throw std::runtime_error("Immediate value out of range for LDI: " + value);
-            }
-            opcode = 0xE000 | ((immValue & 0xF0)) | ((regNum - 16) << 4) | (immValue & 0x0F);
-            machineCode.push_back(opcode & 0xFF);
-            machineCode.push_back((opcode >> 8) & 0xFF);
-            address += 2;
-            std::cout << "LDI " << reg << ", " << value << " encoded at address: " << (address - 2) << " as 0x" 
-                      << std::hex << opcode << std::dec << std::endl;
-            continue;
-        } else if (mnemonic == "OUT") {
-            // Format: OUT A,Rr (1011 1AAr rrrr AAAA)
-            std::string port, reg;
-            iss >> port >> reg;
-
-            port = trimOperand(port);
-            reg = trimOperand(reg);
-
-            int portAddr = std::stoi(port, nullptr, 0);
-            int regNum = parseRegister(reg);  // Use parseRegister
-            if (regNum < 0 || regNum > 31) {
-                throw std::runtime_error("Invalid register number for OUT: " + reg);
-            }
-            opcode = 0xB800 | ((portAddr & 0x30) << 5) | ((regNum & 0x1F) << 4) | (portAddr & 0x0F);
-            machineCode.push_back(opcode & 0xFF);
-            machineCode.push_back((opcode >> 8) & 0xFF);
-            address += 2;
-            std::cout << "OUT " << port << ", " << reg << " encoded at address: " << (address - 2) 
-                      << " as 0x" << std::hex << opcode << std::dec << std::endl;
-            continue;
-        }
-        else if (mnemonic == "CLR") {
-            // Format: CLR Rd (EOR Rd, Rd) -> 0x9400 | (Rd << 4) | Rd
-            std::string rd;
-            iss >> rd;
-            
-            // Trim trailing commas (if any)
-            rd = trimOperand(rd);
-            
-            int rdNum = parseRegister(rd);  // Use parseRegister
-            opcode = 0x9400 | (rdNum << 4) | rdNum;
-            machineCode.push_back(opcode & 0xFF);
-            machineCode.push_back((opcode >> 8) & 0xFF);
-            address += 2;
-            std::cout << "CLR " << rd << " encoded as 0x" 
-                      << std::hex << opcode << std::dec 
-                      << " at address: " << (address - 2) << std::endl;
-            continue;
-        } else if (mnemonic == "RET") {
-            // Format: RET (1001 0101 0000 1000)
-            opcode = 0x9508;
-            machineCode.push_back(opcode & 0xFF);
-            machineCode.push_back((opcode >> 8) & 0xFF);
-            address += 2;
-            std::cout << "RET encoded at address: " << (address - 2) 
-                      << " as 0x" << std::hex << opcode << std::dec << std::endl;
-            continue;
-        } else if (mnemonic == "JMP") {
-            // Format: JMP k (1001 010k kkkk 110k kkkk kkkk kkkk kkkk)
-            std::string label;
-            iss >> label;
-            auto it = labelMap.find(label);
-            if (it == labelMap.end()) {
-                throw std::runtime_error("Unknown label: " + label);
-            }
-            uint32_t dest = it->second;
-            // JMP is 32-bit instruction
-            opcode = 0x940C | ((dest & 0x1FFFF) << 3);
-            machineCode.push_back(opcode & 0xFF);
-            machineCode.push_back((opcode >> 8) & 0xFF);
-            machineCode.push_back((dest >> 16) & 0xFF);
-            machineCode.push_back((dest >> 24) & 0xFF);
-            continue;  // Skip normal opcode output
-        } else if (mnemonic == "RJMP") {
-            // Format: RJMP k (1100 kkkk kkkk kkkk)
-            std::string label;
-            iss >> label;
-            auto it = labelMap.find(label);
-            if (it == labelMap.end()) {
-                throw std::runtime_error("Unknown label: " + label);
-            }
+void ATmega328Compiler::writeDisassembly() {
+    disassembler.run(inputImage);
+    const std::string& listing = disassembler.getListing();
+    if (outputFileName.empty()) {
+        std::cout << listing;
+        return;
+    }
+    std::ofstream file(outputFileName, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open listing file: " + outputFileName);
+    }
+    file.write(listing.data(), static_cast<std::streamsize>(listing.size()));
+    if (!file) {
+        throw std::runtime_error("Error occurred while writing to listing file: " + outputFileName);
+    }
+}
 
-            // Calculate relative offset in words
-            int16_t offset = ((it->second - (address + 2)) / 2); // RJMP offset is relative word distance
-            if (offset < -2048 || offset > 2047) {
-                throw std::runtime_error("RJMP offset out of range for label: " + label);
-            }
+void ATmega328Compiler::checkRoundTrip() {
+    std::string difference = disassembler.roundTrip(image());
+    if (!difference.empty()) {
+        throw std::runtime_error(difference);
+    }
+}
 
-            opcode = 0xC000 | (offset & 0x0FFF);
-            continue;
+void ATmega328Compiler::readObjects() {
+    for (const std::string& fileName : objectFileNames) {
+        std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open object file: " + fileName);
         }
-        else if (mnemonic == "RCALL") {
-            // Format: RCALL k (1101 kkkk kkkk kkkk)
-            std::string label;
-            iss >> label;
-            auto it = labelMap.find(label);
-            if (it == labelMap.end()) {
-                throw std::runtime_error("Unknown label: " + label);
-            }
+        std::string data(static_cast<size_t>(file.tellg()), '\0');
+        file.seekg(0);
+        if (!data.empty() && !file.read(&data[0], static_cast<std::streamsize>(data.size()))) {
+            throw std::runtime_error("Failed to read object file: " + fileName);
+        }
+        ObjectFile::Module module;
+        if (!ObjectFile::read(data, module)) {
+            throw std::runtime_error("Not an object file of this assembler version: " + fileName);
+        }
+        linker.add(std::move(module), fileName);
+    }
+}
 
-            // Calculate relative offset in words
-            int16_t offset = ((it->second - (address + 2)) / 2); // RCALL offset is relative word distance
-            if (offset < -2048 || offset > 2047) {
-                throw std::runtime_error("RCALL offset out of range for label: " + label);
-            }
+void ATmega328Compiler::linkObjects() {
+    linker.link();
+}
+
+const MemoryImage& ATmega328Compiler::image() const {
+    switch (mode) {
+        case Mode::Link: return linker.getImage();
+        case Mode::Disassemble: return inputImage;
+        default: return assembler.getImage();
+    }
+}
 
-            opcode = 0xD000 | (offset & 0x0FFF);
+bool ATmega328Compiler::resolveInclude(std::string_view name, const std::string& includer,
+                                       Assembler::IncludeFile& file, bool binary) {
+    namespace fs = std::filesystem;
+    std::vector<fs::path> candidates{fs::path(includer.empty() ? inputFileName : includer).parent_path() / name};
+    for (const std::string& directory : includePaths) {
+        candidates.push_back(fs::path(directory) / name);
+    }
+
+    for (const fs::path& candidate : candidates) {
+        std::ifstream in(candidate, std::ios::binary | std::ios::ate);
+        if (!in.is_open()) {
             continue;
         }
-        else if (mnemonic == "CALL") {
-            // Format: CALL k (1001 010k kkkk 111k kkkk kkkk kkkk kkkk)
-            std::string label;
-            iss >> label;
-            auto it = labelMap.find(label);
-            if (it == labelMap.end()) {
-                throw std::runtime_error("Unknown label: " + label);
-            }
-            uint32_t dest = it->second;
-            // CALL is 32-bit instruction
-            opcode = 0x940E | ((dest & 0x1FFFF) << 3);
-            machineCode.push_back(opcode & 0xFF);
-            machineCode.push_back((opcode >> 8) & 0xFF);
-            machineCode.push_back((dest >> 16) & 0xFF);
-            machineCode.push_back((dest >> 24) & 0xFF);
-            continue;  // Skip normal opcode output
-        } else if (mnemonic == "ADD") {
-            // Format: ADD Rd,Rr (0000 11rd dddd rrrr)
-            std::string rd, rr;
-            iss >> rd >> rr;
-
-            rr = trimOperand(rr);
-            rd = trimOperand(rd);
-
-            int rdNum = parseRegister(rd);  // Use parseRegister
-            int rrNum = parseRegister(rr);  // Use parseRegister
-            opcode = 0x0C00 | (rdNum << 4) | rrNum;
-            machineCode.push_back(opcode & 0xFF);
-            machineCode.push_back((opcode >> 8) & 0xFF);
-            address += 2;
-            std::cout << "ADD " << rd << ", " << rr << " encoded at address: " << (address - 2) 
-                    << " as 0x" << std::hex << opcode << std::dec << std::endl;
-            continue;
-        } else if (mnemonic == "SUB") {
-            // Format: SUB Rd,Rr (0001 10rd dddd rrrr)
-            std::string rd, rr;
-            iss >> rd >> rr;
-            int rdNum = std::stoi(rd.substr(1));
-            int rrNum = std::stoi(rr.substr(1));
-            opcode = 0x1800 | (rdNum << 4) | (rrNum & 0x0F);
+        std::string& text = includeTexts.emplace_back(static_cast<size_t>(in.tellg()), '\0');
+        in.seekg(0);
+        if (!text.empty() && !in.read(&text[0], static_cast<std::streamsize>(text.size()))) {
+            throw std::runtime_error("Failed to read include file: " + candidate.string());
         }
-        else if (mnemonic == "IN") {
-            // Format: IN Rd,A (1011 0AAd dddd AAAA)
-            std::string rd, port;
-            iss >> rd >> port;
-            int rdNum = std::stoi(rd.substr(1));
-            int portAddr = std::stoi(port, nullptr, 0);
-            opcode = 0xB000 | ((portAddr & 0x30) << 5) | (rdNum << 4) | (portAddr & 0x0F);
-        } 
-        else if (mnemonic == "RET") {
-            // Format: RET (1001 0101 0000 1000)
-            opcode = 0x9508;
-            machineCode.push_back(opcode & 0xFF);
-            machineCode.push_back((opcode >> 8) & 0xFF);
-            address += 2;
-            std::cout << "RET encoded at address: " << (address - 2) 
-                      << " as 0x" << std::hex << opcode << std::dec << std::endl;
-        } else if (mnemonic == "CP") {
-            // Format: CP Rd,Rr (0001 01rd dddd rrrr)
-            std::string rd, rr;
-            iss >> rd >> rr;
-            int rdNum = std::stoi(rd.substr(1));
-            int rrNum = std::stoi(rr.substr(1));
-            opcode = 0x1400 | (rdNum << 4) | (rrNum & 0x0F);
-            continue;
+        file.path = candidate.lexically_normal().string();
+        file.text = includeTexts.back();
+        if (buildCache != nullptr) {
+            dependencies.push_back({fs::absolute(candidate).lexically_normal().string(), BuildCache::hash(file.text)});
         }
-        else if (mnemonic == "BRNE") {
-            // Format: BRNE k (1111 01kk kkkk k001)
-            std::string label;
-            iss >> label;
-            auto it = labelMap.find(label);
-            if (it == labelMap.end()) {
-                throw std::runtime_error("Unknown label: " + label);
+        if (headerCache != nullptr && !binary) {
+            // A header from an older assembler version counts as a miss
+            uint64_t key = HeaderCache::key(file.text);
+            Precompiled::View view;
+            file.precompiled = headerCache->find(key);
+            if (!view.open(file.precompiled)) {
+                file.precompiled = std::string_view();
+                cacheMisses[file.path] = key;
             }
-            int8_t offset = (it->second - address - 1) & 0x7F;
-            opcode = 0xF401 | (offset << 3);
-            continue;
         }
-        else if (mnemonic == "BRGE") {
-            // Format: BRGE k (1111 01kk kkkk k100)
-            std::string label;
-            iss >> label;
-            auto it = labelMap.find(label);
-            if (it == labelMap.end()) {
-                throw std::runtime_error("Unknown label: " + label);
-            }
-            int8_t offset = (it->second - address - 1) & 0x7F;
-            opcode = 0xF404 | (offset << 3);
-            continue;
+        return true;
+    }
+    return false;
+}
+
+void ATmega328Compiler::storeHeaders() {
+    if (headerCache == nullptr) {
+        return;
+    }
+    for (const Assembler::Include& include : assembler.getIncludes()) {
+        auto miss = cacheMisses.find(include.path);
+        if (!include.definitions.empty() && miss != cacheMisses.end()) {
+            headerCache->store(miss->second, include.definitions);
         }
-        else if (mnemonic == "BRLT") {
-            // Format: BRLT k (1111 00kk kkkk k100)
-            std::string label;
-            iss >> label;
-            auto it = labelMap.find(label);
-            if (it == labelMap.end()) {
-                throw std::runtime_error("Unknown label: " + label);
-            }
-            int8_t offset = (it->second - address - 1) & 0x7F;
-            opcode = 0xF400 | (offset << 3);
-            continue;
-        } else if (mnemonic == "DEC") {
-            // Format: DEC Rd (1001 010d dddd 1010)
-            std::string reg;
-            iss >> reg;
-            int regNum = std::stoi(reg.substr(1));
-            opcode = 0x940A | (regNum << 4);
-            continue;
-        } else {
-            auto it = opcodeMap.find(mnemonic);
-            if (it == opcodeMap.end()) {
-                throw std::runtime_error("Unknown instruction: " + mnemonic);
-            }
-            opcode = it->second;
+    }
+}
+
+bool ATmega328Compiler::usesBuildCache() const {
+    return buildCache != nullptr && mode == Mode::Assemble && lineMapFileName.empty() && deltaFileName.empty()
+           && !mapMemory && !cycleAnalysis && !verbose;
+}
+
+std::string ATmega328Compiler::buildOptions() const {
+    // Relative include paths depend on the directories they are relative to
+    namespace fs = std::filesystem;
+    std::string options = compileType;
+    options += singlePass ? " single-pass" : "";
+    options += relaxBranches ? " relax" : "";
+    for (size_t i = 0; i < Peephole::RULE_COUNT; ++i) {
+        if (peepholeOptions.enabled[i]) {
+            options += " peephole=" + std::string(Peephole::ruleName(static_cast<Peephole::Rule>(i)));
         }
+    }
+    options += " record-length=" + std::to_string(hexOptions.recordLength);
+    options += hexOptions.segmentAddressing ? " segment-addressing" : "";
+    options += hexOptions.writeStartAddress ? " start=" + std::to_string(hexOptions.startAddress) : "";
+    options += verifyOutput ? " verify" : "";
+    options += roundTrip ? " round-trip" : "";
+    options += "\n" + fs::absolute(inputFileName).lexically_normal().parent_path().string();
+    for (const std::string& directory : includePaths) {
+        options += "\n" + fs::absolute(directory).lexically_normal().string();
+    }
+    return options;
+}
 
-        machineCode.push_back(opcode & 0xFF);
-        machineCode.push_back((opcode >> 8) & 0xFF);
-        address += 2;
+void ATmega328Compiler::findBuild() {
+    buildKey = BuildCache::key(buildOptions(), source);
+    std::string output;
+    if (!buildCache->find(buildKey, output)) {
+        return;
     }
+    std::ofstream file(outputFileName, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open output file: " + outputFileName);
+    }
+    file.write(output.data(), static_cast<std::streamsize>(output.size()));
+    if (!file) {
+        throw std::runtime_error("Error occurred while writing to output file: " + outputFileName);
+    }
+    cached = true;
 }
 
-std::string ATmega328Compiler::trimOperand(const std::string& operand) {
-    size_t end = operand.find_last_not_of(", \t\n\r");
-    if (end == std::string::npos) {
-        return "";
+void ATmega328Compiler::storeBuild() {
+    // Stored as written, so a hit reproduces the file byte for byte
+    std::ifstream file(outputFileName, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        return;
+    }
+    std::string output(static_cast<size_t>(file.tellg()), '\0');
+    file.seekg(0);
+    if (!output.empty() && !file.read(&output[0], static_cast<std::streamsize>(output.size()))) {
+        return;
     }
-    return operand.substr(0, end + 1);
+    buildCache->store(buildKey, dependencies, output);
+}
+
+void ATmega328Compiler::buildMemoryMap() {
+    memoryMap.run(assembler.getImage(), assembler.getSymbols(), assembler.getLineTable());
+    mapped = true;
+}
+
+void ATmega328Compiler::buildOverflowMap() {
+    memoryMap.run(assembler.getOverflowLayout(), assembler.getSymbols());
+    mapped = true;
+}
+
+void ATmega328Compiler::runPhase(const char* name, void (ATmega328Compiler::*phase)()) {
+    auto start = std::chrono::steady_clock::now();
+    (this->*phase)();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    phaseTimes.push_back({name, elapsed.count()});
+}
+
+const Assembler& ATmega328Compiler::getAssembler() const {
+    return assembler;
+}
+
+const std::vector<PhaseTime>& ATmega328Compiler::getPhaseTimes() const {
+    return phaseTimes;
+}
+
+size_t ATmega328Compiler::getSourceSize() const {
+    return mode == Mode::Stream ? assembler.getSourceSize() : source.size();
 }
 
-int ATmega328Compiler::parseRegister(const std::string& reg) {
-    if (reg.empty() || (reg[0] != 'R' && reg[0] != 'r')) {
-        throw std::runtime_error("Invalid register format: " + reg);
+size_t ATmega328Compiler::getLineCount() const {
+    return assembler.getLineCount();
+}
+
+const ATmega328Compiler::RelaxationReport& ATmega328Compiler::getRelaxationReport() const {
+    return assembler.getRelaxationReport();
+}
+
+const Peephole::Report& ATmega328Compiler::getPeepholeReport() const {
+    return assembler.getPeepholeReport();
+}
+
+const std::vector<ATmega328Compiler::SourceLine>& ATmega328Compiler::getLineTable() const {
+    return assembler.getLineTable();
+}
+
+const CycleAnalyzer& ATmega328Compiler::getCycleAnalysis() const {
+    return assembler.getCycleAnalysis();
+}
+
+const MemoryMap& ATmega328Compiler::getMemoryMap() const {
+    return memoryMap;
+}
+
+bool ATmega328Compiler::hasMemoryMap() const {
+    return mapped;
+}
+
+bool ATmega328Compiler::isCached() const {
+    return cached;
+}
+
+const std::vector<uint32_t>& ATmega328Compiler::getDeltaPages() const {
+    return deltaPages;
+}
+
+void ATmega328Compiler::readFile() {
+    // Read the whole file with one bulk read, the lexer works on this buffer
+    std::ifstream file(inputFileName, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open input file: " + inputFileName);
     }
-    
-    // Extract the register number substring (supports R0-R31)
-    std::string regNumStr = reg.substr(1);
-    
-    // Ensure that the remaining characters are digits
-    for (char c : regNumStr) {
-        if (!isdigit(c)) {
-            throw std::runtime_error("Non-digit character in register: " + reg);
-        }
+    std::streamsize size = file.tellg();
+    file.seekg(0);
+    source.resize(static_cast<size_t>(size));
+    if (size > 0 && !file.read(&source[0], size)) {
+        throw std::runtime_error("Failed to read input file: " + inputFileName);
     }
-    
-    int regNum = std::stoi(regNumStr);
-    
-    if (regNum < 0 || regNum > 31) {
-        throw std::runtime_error("Register number out of range (R0-R31): " + reg);
-    }
-    
-    return regNum;
-}
-
-std::string ATmega328Compiler::toHex(uint8_t byte) {
-    std::stringstream ss;
-    ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
-    return ss.str();
-}
-
-std::string ATmega328Compiler::generateHexRecord(uint16_t address, uint8_t recordType, const std::vector<uint8_t>& data) {
-    std::stringstream ss;
-    uint8_t checksum = 0;
-    
-    // Start code
-    ss << ':';
-    
-    // Byte count
-    ss << toHex(data.size());
-    checksum += data.size();
-    
-    // Address
-    ss << toHex((address >> 8) & 0xFF) << toHex(address & 0xFF);
-    checksum += (address >> 8) & 0xFF;
-    checksum += address & 0xFF;
-    
-    // Record type
-    ss << toHex(recordType);
-    checksum += recordType;
-    
-    // Data
-    for (uint8_t byte : data) {
-        ss << toHex(byte);
-        checksum += byte;
-    }
-    
-    // Checksum
-    checksum = (~checksum + 1) & 0xFF;
-    ss << toHex(checksum);
-    
-    return ss.str();
 }
 
 void ATmega328Compiler::writeOutput() {
@@ -432,47 +561,90 @@ void ATmega328Compiler::writeOutput() {
         writeHexOutput();
     } else if (compileType == "bin") {
         writeBinOutput();
+    } else if (compileType == "obj" && mode == Mode::Assemble) {
+        writeObjectOutput();
     } else {
         throw std::runtime_error("Unknown output format: " + compileType);
     }
+    if (!lineMapFileName.empty() && mode == Mode::Assemble) {
+        writeLineMap();
+    }
+}
+
+void ATmega328Compiler::writeLineMap() {
+    std::vector<SourceLine> sorted(assembler.getLineTable());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const SourceLine& a, const SourceLine& b) { return a.address < b.address; });
+
+    std::ofstream file(lineMapFileName);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open line map file: " + lineMapFileName);
+    }
+    file << "; ATmega328Compiler line map\nsource " << inputFileName << "\n" << std::hex << std::uppercase;
+    for (const SourceLine& entry : sorted) {
+        file << "0x" << std::setw(4) << std::setfill('0') << entry.address << " " << std::dec << entry.line
+             << std::hex << "\n";
+    }
+    if (!file) {
+        throw std::runtime_error("Error occurred while writing line map: " + lineMapFileName);
+    }
+}
+
+void ATmega328Compiler::writeObjectOutput() {
+    std::string data;
+    ObjectFile::write(assembler.getObject(), data);
+    std::ofstream file(outputFileName, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open object file: " + outputFileName);
+    }
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!file) {
+        throw std::runtime_error("Error occurred while writing to object file: " + outputFileName);
+    }
 }
 
 void ATmega328Compiler::writeHexOutput() {
-    std::ofstream file(outputFileName);
+    writeHex(image(), outputFileName);
+    if (verifyOutput) {
+        verifyHexOutput();
+    }
+}
+
+void ATmega328Compiler::writeHex(const MemoryImage& hexImage, const std::string& fileName) const {
+    // Format the whole file into one buffer and write it with a single call.
+    // Only occupied ranges produce records.
+    IntelHex::Writer writer(hexOptions);
+    writer.reserve(hexImage.usedBytes());
+    for (const MemoryImage::Segment& segment : hexImage.getSegments()) {
+        writer.addData(segment.address, segment.data.data(), segment.data.size());
+    }
+    const std::string& text = writer.finish();
+
+    std::ofstream file(fileName, std::ios::binary);
     if (!file.is_open()) {
-        throw std::runtime_error("Failed to open output file: " + outputFileName);
+        throw std::runtime_error("Failed to open output file: " + fileName);
+    }
+    file.write(text.data(), static_cast<std::streamsize>(text.size()));
+    if (!file) {
+        throw std::runtime_error("Error occurred while writing to hex file: " + fileName);
     }
+}
 
-    // Write program data in Intel HEX format
-    for (size_t i = 0; i < machineCode.size(); i += 16) {
-        // Calculate remaining bytes in this record
-        size_t count = std::min(size_t(16), machineCode.size() - i);
-        
-        // Calculate record checksum
-        uint8_t checksum = count;  // Start with byte count
-        checksum += (i >> 8) & 0xFF;  // Add address high byte
-        checksum += i & 0xFF;         // Add address low byte
-        
-        // Write record start, length, address and type
-        file << ":" << std::hex << std::setfill('0') << std::setw(2) << count;
-        file << std::hex << std::setfill('0') << std::setw(4) << i;
-        file << "00";  // Record type 00 = data
-        
-        // Write data bytes
-        for (size_t j = 0; j < count; j++) {
-            uint8_t byte = machineCode[i + j];
-            file << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(byte);
-            checksum += byte;
-        }
-        
-        // Write checksum (two's complement of sum)
-        checksum = (~checksum + 1) & 0xFF;
-        file << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(checksum) << "\n";
+void ATmega328Compiler::verifyHexOutput() {
+    std::ifstream file(outputFileName, std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    IntelHex::ParseResult hex = IntelHex::parse(text);
+
+    const std::vector<MemoryImage::Segment>& segments = image().getSegments();
+    bool matches = hex.blocks.size() == segments.size();
+    for (size_t i = 0; matches && i < segments.size(); ++i) {
+        matches = hex.blocks[i].address == segments[i].address && hex.blocks[i].data == segments[i].data;
+    }
+    matches = matches && hex.hasStartAddress == hexOptions.writeStartAddress
+              && (!hex.hasStartAddress || hex.startAddress == hexOptions.startAddress);
+    if (!matches) {
+        throw std::runtime_error("HEX verification failed: " + outputFileName + " does not match the assembled code");
     }
-    
-    // Write end-of-file record
-    file << ":00000001FF\n";
-    file.close();
 }
 
 void ATmega328Compiler::writeBinOutput() {
@@ -482,14 +654,8 @@ void ATmega328Compiler::writeBinOutput() {
         throw std::runtime_error("Failed to open bin output file: " + outputFileName);
     }
 
-    // Optional: Pad the machineCode to match the flash size (e.g., 32KB for ATmega328)
-    const size_t flashSize = 32768; // 32KB
-    if (machineCode.size() < flashSize) {
-        machineCode.resize(flashSize, 0xFF); // Typically, erased flash is set to 0xFF
-    }
-
-    // Write the machineCode data directly
-    binFile.write(reinterpret_cast<const char*>(machineCode.data()), machineCode.size());
+    // Pad to the flash size; gaps and padding are streamed as erased flash (0xFF)
+    image().writeBinary(binFile, FLASH_SIZE, 0xFF);
 
     // Check for write errors
     if (!binFile) {
@@ -497,4 +663,4 @@ void ATmega328Compiler::writeBinOutput() {
     }
 
     binFile.close();
-}
\ No newline at end of file
+}
@@ -1,34 +1,161 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <deque>
+#include <istream>
+#include <memory>
 #include <unordered_map>
 #include <cstdint>
+#include "Assembler.hpp"
+#include "IntelHex.hpp"
+#include "HeaderCache.hpp"
+#include "BuildCache.hpp"
+#include "Linker.hpp"
+#include "Disassembler.hpp"
+#include "FlashDelta.hpp"
+#include "MemoryMap.hpp"
 
+// Command line front end: reads one source file, assembles it with an
+// Assembler and writes the image as HEX or binary, or as an object module
+// ("obj"). link() builds the image from object modules instead, and
+// disassemble() turns an image back into source.
 class ATmega328Compiler {
 public:
+    static constexpr uint32_t FLASH_SIZE = Assembler::FLASH_SIZE;
+    using RelaxationReport = Assembler::RelaxationReport;
+    using SourceLine = Assembler::SourceLine;
+
     ATmega328Compiler(const std::string& cType, const std::string& inputFileName, const std::string& outputFileName);
+    ATmega328Compiler(const ATmega328Compiler&) = delete;
+    ATmega328Compiler& operator=(const ATmega328Compiler&) = delete;
+    // Throws std::runtime_error with the first diagnostic if the source has errors
     void compile();
+    // Links object modules, in this order, and writes the image. The input
+    // file name is not used.
+    void link(const std::vector<std::string>& objectFileNames);
+    // Assembles source read from in piece by piece and writes HEX or binary
+    // output to out as soon as it is final. The file names are not used.
+    void compileStream(std::istream& in, std::ostream& out);
+    // Reads the input file as a HEX or binary image and writes its
+    // disassembly to the output file, or to stdout if that name is empty
+    void disassemble();
+    void setVerbose(bool enabled);
+    void setSinglePass(bool enabled);
+    void setHexOptions(const IntelHex::Options& options);
+    // Reads HEX output back after writing it and checks it against the code
+    void setVerifyOutput(bool enabled);
+    // Disassembles the image, assembles it again and fails unless the result
+    // is identical
+    void setRoundTrip(bool enabled);
+    // See Assembler::setRelaxBranches()
+    void setRelaxBranches(bool enabled);
+    // See Assembler::setPeepholeOptions()
+    void setPeepholeOptions(const Peephole::Options& options);
+    // See Assembler::setCycleAnalysis()
+    void setCycleAnalysis(bool enabled, const std::unordered_map<std::string, uint32_t>& loopBounds = {});
+
+    // Builds the MemoryMap of the image after assembling
+    void setMemoryMap(bool enabled);
+
+    // Also writes the source line of every instruction to fileName, one
+    // "<address> <line>" pair per line, for the simulator's profiler
+    void setLineMapFile(const std::string& fileName);
+    // .include looks next to the including file first, then in these directories
+    void setIncludePaths(const std::vector<std::string>& paths);
+    // Keeps precompiled definition headers in directory, keyed by their
+    // content hash, and memory maps them on later builds
+    void setHeaderCache(const std::string& directory);
+    // Keeps finished outputs in directory. compile() copies the stored output
+    // when the source, its includes and the options are unchanged. Builds
+    // with a line map, a delta, a memory map, cycle analysis or verbose
+    // output always assemble.
+    void setBuildCache(const std::string& directory, uint64_t maxBytes = BuildCache::DEFAULT_MAX_BYTES);
+    // After compile() or link(), also compares the image with the HEX or
+    // binary image in previousFileName and writes the changed flash pages to
+    // deltaFileName: as HEX records if its name ends in .hex, otherwise as a
+    // FlashDelta page list.
+    void setDelta(const std::string& previousFileName, const std::string& deltaFileName);
+
+    const Assembler& getAssembler() const;
+    const std::vector<SourceLine>& getLineTable() const;
+
+    // Statistics of the last compile() call
+    const std::vector<PhaseTime>& getPhaseTimes() const;
+    size_t getSourceSize() const;
+    size_t getLineCount() const;
+    const RelaxationReport& getRelaxationReport() const;
+    const Peephole::Report& getPeepholeReport() const;
+    const CycleAnalyzer& getCycleAnalysis() const;
+    const MemoryMap& getMemoryMap() const;
+    // True if the last compile() built the memory map. It also does when the
+    // program didn't fit the flash and compile() threw.
+    bool hasMemoryMap() const;
+    // True if the last compile() took its output from the build cache; the
+    // reports above are empty then
+    bool isCached() const;
+    // Start addresses of the pages written to the delta file
+    const std::vector<uint32_t>& getDeltaPages() const;
 
 private:
     std::string compileType;
     std::string inputFileName;
     std::string outputFileName;
-    std::vector<std::string> lines;
-    std::vector<uint8_t> machineCode;
-    std::unordered_map<std::string, uint16_t> opcodeMap;
-    std::unordered_map<std::string, size_t> labelMap;
-    std::string toHex(uint8_t byte);
-    std::string generateHexRecord(uint16_t address, uint8_t recordType, const std::vector<uint8_t>& data);
-    
+    bool verifyOutput = false;
+    IntelHex::Options hexOptions;
+    std::string lineMapFileName;
+    std::string source;
+    std::vector<std::string> includePaths;
+    std::unique_ptr<HeaderCache> headerCache;
+    std::deque<std::string> includeTexts;                 // alive until the build is done
+    std::unordered_map<std::string, uint64_t> cacheMisses; // include path -> cache key
+    std::unique_ptr<BuildCache> buildCache;
+    std::vector<BuildCache::Dependency> dependencies;     // every file the build read
+    uint64_t buildKey = 0;
+    bool cached = false;
+    // Settings that go into the build cache key
+    bool verbose = false;
+    bool singlePass = false;
+    bool relaxBranches = false;
+    bool cycleAnalysis = false;
+    bool mapMemory = false;
+    MemoryMap memoryMap;
+    bool mapped = false;
+    Peephole::Options peepholeOptions;
+    Assembler assembler;
+    Linker linker;
+    Disassembler disassembler;
+    enum class Mode { Assemble, Link, Disassemble, Stream } mode = Mode::Assemble;
+    bool roundTrip = false;
+    MemoryImage inputImage;  // image read by disassemble()
+    std::string previousFileName;
+    std::string deltaFileName;
+    std::vector<uint32_t> deltaPages;
+    std::vector<std::string> objectFileNames;
+    std::vector<PhaseTime> phaseTimes;
+    const MemoryImage& image() const;
+    void readObjects();
+    void linkObjects();
+    void readImage();
+    void writeDisassembly();
+    void checkRoundTrip();
+    void writeObjectOutput();
     void writeHexOutput();
+    void writeHex(const MemoryImage& hexImage, const std::string& fileName) const;
+    void writeDelta();
+    void verifyHexOutput();
     void writeBinOutput();
+    void writeLineMap();
+    void runPhase(const char* name, void (ATmega328Compiler::*phase)());
     void readFile();
-    void tokenize();
-    void firstPass();
-    void secondPass();
-    std::string trimOperand(const std::string &operand);
-    int parseRegister(const std::string &reg);
-    uint16_t parseOperand(const std::string &operand);
+    // Binary files (.incbin) skip the header cache
+    bool resolveInclude(std::string_view name, const std::string& includer, Assembler::IncludeFile& file,
+                        bool binary);
+    void storeHeaders();
+    bool usesBuildCache() const;
+    std::string buildOptions() const;
+    void findBuild();
+    void storeBuild();
+    void buildMemoryMap();
+    void buildOverflowMap();
     void writeOutput();
-    static std::string trim(const std::string& str);
-};
\ No newline at end of file
+};
@@ -0,0 +1,1140 @@
+// Assembler.cpp
+// In-memory assembly of one source buffer
+
+#include "Assembler.hpp"
+#include "OpcodeMap.hpp"
+#include "Lexer.hpp"
+#include "Encoder.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    // Code or data past the end of the flash. Caught after the passes to keep
+    // the layout for the memory map.
+    class FlashOverflow : public SourceError {
+    public:
+        using SourceError::SourceError;
+    };
+
+    // Names the statement that leaves the flash; --map shows what fills it
+    FlashOverflow programTooLarge(const Token& at, uint32_t end) {
+        return FlashOverflow(Encoder::programTooLarge(at.text, end - Assembler::FLASH_SIZE) + Encoder::location(at), at);
+    }
+
+    using Encoder::isDirective;
+    using Encoder::lookupInstruction;
+
+    bool isDataDirective(const Token& token) {
+        return isDirective(token, ".db") || isDirective(token, ".dw") || isDirective(token, ".ascii")
+               || isDirective(token, ".incbin");
+    }
+
+    inline bool isNameChar(char c) {
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '.';
+    }
+
+    SymbolTable::Kind symbolKind(Precompiled::Kind kind) {
+        switch (kind) {
+            case Precompiled::Kind::Constant: return SymbolTable::Kind::Constant;
+            case Precompiled::Kind::Variable: return SymbolTable::Kind::Variable;
+            case Precompiled::Kind::Register: return SymbolTable::Kind::Register;
+        }
+        return SymbolTable::Kind::Undefined;
+    }
+}
+
+void Assembler::setLog(std::ostream* stream) {
+    log = stream;
+}
+
+void Assembler::setSinglePass(bool enabled) {
+    singlePassMode = enabled;
+}
+
+void Assembler::setRelaxBranches(bool enabled) {
+    relaxMode = enabled;
+}
+
+void Assembler::setPeepholeOptions(const Peephole::Options& options) {
+    peepholeOptions = options;
+}
+
+void Assembler::setCycleAnalysis(bool enabled, const std::unordered_map<std::string, uint32_t>& loopBounds) {
+    analysisMode = enabled;
+    cycleAnalyzer.setLoopBounds(loopBounds);
+}
+
+void Assembler::setIncludeResolver(IncludeResolver resolver) {
+    includeResolver = std::move(resolver);
+}
+
+void Assembler::setBinaryResolver(IncludeResolver resolver) {
+    binaryResolver = std::move(resolver);
+}
+
+void Assembler::setPrecompileHeaders(bool enabled) {
+    precompileHeaders = enabled;
+}
+
+void Assembler::setRelocatable(bool enabled) {
+    relocatable = enabled;
+}
+
+bool Assembler::assemble(std::string_view text) {
+    // Containers are cleared, not replaced, so their storage is reused
+    source = text;
+    sourceSize = text.size();
+    streaming = false;
+    phaseTimes.clear();
+    lineTable.clear();
+    lineAddresses.clear();
+    overflowLayout.clear();
+    diagnostics.clear();
+    relocations.clear();
+    usesOrg = false;
+    machineCode.clear();
+    std::fill(std::begin(peepholeReport), std::end(peepholeReport), Peephole::RuleReport());
+    return runGuarded(&Assembler::assembleSource);
+}
+
+void Assembler::assembleSource() {
+    if (relocatable && (relaxMode || peepholeOptions.any())) {
+        throw std::runtime_error("Object output can't be combined with branch relaxation or peephole rules");
+    }
+    runPhase("tokenize", &Assembler::tokenize);
+    runPhase("symbols", &Assembler::defineSymbols);
+    try {
+        if (singlePassMode && !relaxMode && !peepholeOptions.any() && !analysisMode && !relocatable) {
+            runPhase("singlePass", &Assembler::singlePass);
+        } else {
+            runPhase("firstPass", &Assembler::firstPass);
+            runPhase("secondPass", &Assembler::secondPass);
+            if (peepholeOptions.any()) {
+                runPhase("peephole", &Assembler::optimize);
+            }
+            if (analysisMode) {
+                runPhase("analyze", &Assembler::analyze);
+            }
+            if (relocatable) {
+                runPhase("object", &Assembler::buildObject);
+            }
+        }
+    } catch (const FlashOverflow&) {
+        recordOverflow();
+        throw;
+    }
+}
+
+void Assembler::recordOverflow() {
+    // Lays the statements out again up to the one that doesn't fit, keeping
+    // where each went. The layout stops with the same error.
+    placements = &overflowLayout;
+    try {
+        layout(false);
+    } catch (const SourceError&) {
+    }
+    placements = nullptr;
+}
+
+void Assembler::beginStream(StreamOutput output) {
+    source = std::string_view();
+    sourceSize = 0;
+    streaming = true;
+    streamOutput = std::move(output);
+    streamed = 0;
+    nextLine = 1;
+    phaseTimes.clear();
+    lineTable.clear();
+    lineAddresses.clear();
+    overflowLayout.clear();
+    diagnostics.clear();
+    usesOrg = false;
+    machineCode.clear();
+    tokens.clear();
+    symbols.clear();
+    labels.clear();
+    includes.clear();
+    includeStates.clear();
+    localLabels.clear();
+    globals.clear();
+    startSinglePass();
+    if (relaxMode || peepholeOptions.any() || analysisMode || relocatable) {
+        diagnostics.push_back({std::string(), 0, "Streaming can't be combined with branch relaxation, peephole rules, "
+                                                 "cycle analysis or object output"});
+    }
+}
+
+bool Assembler::feed(std::string_view text) {
+    if (!diagnostics.empty()) {
+        return false;  // The stream failed already
+    }
+    source = text;
+    sourceSize += text.size();
+    return runGuarded(&Assembler::assemblePiece);
+}
+
+bool Assembler::endStream(std::string_view text) {
+    if (!text.empty() && !feed(text)) {
+        return false;
+    }
+    return diagnostics.empty() && runGuarded(&Assembler::finishStream);
+}
+
+void Assembler::assemblePiece() {
+    dataBytes.clear();
+    dataBlocks.clear();
+    runPhase("tokenize", &Assembler::tokenizePiece);
+    runPhase("symbols", &Assembler::defineStatements);
+    size_t pieceFixups = fixups.size();
+    runPhase("singlePass", &Assembler::encodeStatements);
+
+    // The piece's text goes away; keep the names of references still waiting
+    // in the symbol arena
+    for (size_t i = pieceFixups; i < fixups.size(); ++i) {
+        if (fixups[i].desc != nullptr) {
+            Token& operand = fixups[i].operand;
+            operand.text = symbols[symbols.intern(operand.text)].name;
+        }
+    }
+
+    // Code is final below the current address and the oldest open reference
+    while (firstPending < fixups.size() && fixups[firstPending].desc == nullptr) {
+        ++firstPending;
+    }
+    if (firstPending == fixups.size()) {
+        fixups.clear();  // Nothing waits, so no chain refers to them
+        firstPending = 0;
+    }
+    uint32_t limit = passAddress;
+    for (size_t i = firstPending; i < fixups.size(); ++i) {
+        if (fixups[i].desc != nullptr) {
+            limit = std::min(limit, fixups[i].address);
+        }
+    }
+    flushStream(limit);
+}
+
+void Assembler::finishStream() {
+    reportUnresolved();
+    writePrecompiled();
+    flushStream(UINT32_MAX);
+}
+
+void Assembler::flushStream(uint32_t limit) {
+    const std::vector<MemoryImage::Segment>& segments = machineCode.getSegments();
+    auto segment = std::upper_bound(segments.begin(), segments.end(), streamed,
+                                    [](uint32_t address, const MemoryImage::Segment& s) { return address < s.end(); });
+    for (; segment != segments.end() && segment->address < limit; ++segment) {
+        uint32_t start = std::max(segment->address, streamed);
+        uint32_t end = std::min(segment->end(), limit);
+        streamOutput(start, segment->data.data() + (start - segment->address), end - start);
+    }
+    streamed = std::max(streamed, limit);
+}
+
+bool Assembler::runGuarded(void (Assembler::*body)()) {
+    try {
+        (this->*body)();
+    } catch (const SourceError& ex) {
+        diagnostics.push_back({ex.file() == 0 ? std::string() : includes[ex.file() - 1].path, ex.line(), ex.what()});
+    } catch (const std::runtime_error& ex) {
+        diagnostics.push_back({std::string(), 0, ex.what()});
+    }
+    return diagnostics.empty();
+}
+
+void Assembler::runPhase(const char* name, void (Assembler::*phase)()) {
+    auto start = std::chrono::steady_clock::now();
+    (this->*phase)();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (streaming) {
+        // Every piece runs the same phases; report their sums
+        for (PhaseTime& time : phaseTimes) {
+            if (std::strcmp(time.name, name) == 0) {
+                time.milliseconds += elapsed.count();
+                return;
+            }
+        }
+    }
+    phaseTimes.push_back({name, elapsed.count()});
+}
+
+const MemoryImage& Assembler::getImage() const {
+    return machineCode;
+}
+
+const SymbolTable& Assembler::getSymbols() const {
+    return symbols;
+}
+
+const std::vector<Assembler::Diagnostic>& Assembler::getDiagnostics() const {
+    return diagnostics;
+}
+
+const std::vector<Assembler::Include>& Assembler::getIncludes() const {
+    return includes;
+}
+
+const std::vector<Assembler::SourceLine>& Assembler::getLineTable() const {
+    return lineTable;
+}
+
+const std::vector<uint32_t>& Assembler::getLineAddresses() const {
+    return lineAddresses;
+}
+
+const std::vector<Assembler::Placement>& Assembler::getOverflowLayout() const {
+    return overflowLayout;
+}
+
+const std::vector<PhaseTime>& Assembler::getPhaseTimes() const {
+    return phaseTimes;
+}
+
+size_t Assembler::getSourceSize() const {
+    return sourceSize;
+}
+
+size_t Assembler::getLineCount() const {
+    if (streaming) {
+        return nextLine - 1;
+    }
+    return tokens.empty() ? 0 : tokens.back().line;
+}
+
+const Assembler::RelaxationReport& Assembler::getRelaxationReport() const {
+    return relaxationReport;
+}
+
+const Peephole::Report& Assembler::getPeepholeReport() const {
+    return peepholeReport;
+}
+
+const CycleAnalyzer& Assembler::getCycleAnalysis() const {
+    return cycleAnalyzer;
+}
+
+const ObjectFile::Module& Assembler::getObject() const {
+    return object;
+}
+
+void Assembler::tokenize() {
+    tokens.clear();
+    tokens.reserve(source.size() / 4 + 1);
+    symbols.clear();
+    labels.clear();
+    Lexer::tokenize(source, tokens, 1, 0, &symbols);
+    includes.clear();
+    includeStates.clear();
+    scanIncludes();
+}
+
+void Assembler::tokenizePiece() {
+    // Symbols and includes carry over from the earlier pieces
+    tokens.clear();
+    Lexer::tokenize(source, tokens, nextLine, 0, &symbols);
+    nextLine += static_cast<uint32_t>(std::count(source.begin(), source.end(), '\n'));
+    if (!source.empty() && source.back() != '\n') {
+        ++nextLine;
+    }
+    scanIncludes();
+}
+
+void Assembler::scanIncludes() {
+    // Included tokens are spliced in after the .include line, so the scan
+    // continues into them and handles nested includes in source order
+    Statement stmt;
+    for (size_t pos = 0; pos < tokens.size();) {
+        pos = Lexer::readStatement(tokens, pos, stmt);
+        if (stmt.mnemonic != nullptr && isDirective(*stmt.mnemonic, ".include")) {
+            include(stmt, pos);
+        }
+    }
+}
+
+void Assembler::include(const Statement& stmt, size_t next) {
+    const Token& name = *stmt.mnemonic;
+    if (stmt.operandCount != 1 || stmt.operands[0]->kind != TokenKind::String) {
+        throw SourceError(".include expects a file name in quotes" + Encoder::location(name), name);
+    }
+    const Token& fileName = *stmt.operands[0];
+    IncludeFile file;
+    const std::string& includer = name.file == 0 ? std::string() : includes[name.file - 1].path;
+    if (!includeResolver || !includeResolver(fileName.text, includer, file)) {
+        throw SourceError("Include file not found: " + std::string(fileName.text) + Encoder::location(name), name);
+    }
+    for (const Include& included : includes) {
+        if (included.path == file.path) {
+            return;  // Every file is included once, which also stops include cycles
+        }
+    }
+    if (includes.size() == UINT16_MAX) {
+        throw SourceError("Too many include files" + Encoder::location(name), name);
+    }
+
+    includes.push_back({file.path, !file.precompiled.empty(), std::string()});
+    includeStates.push_back({Precompiled::View(), precompileHeaders, {}});
+    uint16_t index = static_cast<uint16_t>(includes.size());
+    if (!file.precompiled.empty()) {
+        if (!includeStates.back().view.open(file.precompiled)) {
+            throw SourceError("Damaged precompiled header for " + file.path + Encoder::location(name), name);
+        }
+        // The symbol pass installs the symbols when it reaches this line
+        tokens[static_cast<size_t>(&fileName - tokens.data())].value = index;
+        return;
+    }
+    scratch.clear();
+    Lexer::tokenize(file.text, scratch, 1, index, &symbols);
+    tokens.insert(tokens.begin() + static_cast<std::ptrdiff_t>(next), scratch.begin(), scratch.end());
+}
+
+void Assembler::defineSymbols() {
+    localLabels.clear();
+    globals.clear();
+    dataBytes.clear();
+    dataBlocks.clear();
+    defineStatements();
+    writePrecompiled();
+}
+
+void Assembler::defineStatements() {
+    Statement stmt;
+    for (size_t pos = 0; pos < tokens.size();) {
+        pos = Lexer::readStatement(tokens, pos, stmt);
+        uint16_t file = stmt.end->file;
+        if (stmt.label != nullptr && file != 0) {
+            includeStates[file - 1].cacheable = false;
+        }
+        if (stmt.label != nullptr && stmt.label->kind == TokenKind::LocalLabel) {
+            resolveLocal(*stmt.label);
+        }
+        if (stmt.mnemonic == nullptr) {
+            continue;
+        }
+
+        bool definitionsOnly = true;
+        if (isDirective(*stmt.mnemonic, ".equ")) {
+            define(stmt, Precompiled::Kind::Constant);
+        } else if (isDirective(*stmt.mnemonic, ".set")) {
+            define(stmt, Precompiled::Kind::Variable);
+        } else if (isDirective(*stmt.mnemonic, ".def")) {
+            define(stmt, Precompiled::Kind::Register);
+        } else if (isDirective(*stmt.mnemonic, ".include")) {
+            definitionsOnly = false;
+            uint16_t included = static_cast<uint16_t>(stmt.operands[0]->value);
+            if (included != 0) {
+                const Precompiled::View& view = includeStates[included - 1].view;
+                for (size_t i = 0; i < view.size(); ++i) {
+                    Precompiled::Symbol symbol = view[i];
+                    defineSymbol(symbols.intern(symbol.name), symbol.kind, symbol.value, included, *stmt.mnemonic);
+                }
+            }
+        } else if (isDirective(*stmt.mnemonic, ".global") || isDirective(*stmt.mnemonic, ".extern")) {
+            // Format: .global label, .extern label (undefined labels are external anyway)
+            definitionsOnly = false;
+            if (stmt.operandCount != 1 || stmt.operands[0]->kind != TokenKind::Identifier) {
+                throw SourceError(std::string(stmt.mnemonic->text) + " expects a label name"
+                                  + Encoder::location(*stmt.mnemonic), *stmt.mnemonic);
+            }
+            if (isDirective(*stmt.mnemonic, ".global")) {
+                globals.push_back(stmt.operands[0]);
+            }
+        } else if (isDataDirective(*stmt.mnemonic)) {
+            definitionsOnly = false;
+            defineData(stmt);
+        } else if (!isDirective(*stmt.mnemonic, ".device")) {
+            definitionsOnly = false;
+            for (uint8_t i = 0; i < stmt.operandCount; ++i) {
+                if (stmt.operands[i]->kind == TokenKind::LocalReference) {
+                    resolveLocal(*stmt.operands[i]);
+                } else {
+                    substitute(*stmt.operands[i]);
+                }
+            }
+        }
+        if (!definitionsOnly && file != 0) {
+            includeStates[file - 1].cacheable = false;
+        }
+    }
+}
+
+void Assembler::writePrecompiled() {
+    for (size_t i = 0; i < includes.size(); ++i) {
+        if (precompileHeaders && includeStates[i].cacheable && !includes[i].precompiled) {
+            Precompiled::write(includeStates[i].symbols, includes[i].definitions);
+        }
+    }
+}
+
+void Assembler::define(const Statement& stmt, Precompiled::Kind kind) {
+    // Format: .equ name = value, .set name = value, .def name = register
+    const Token& directive = *stmt.mnemonic;
+    if (stmt.operandCount != 2 || stmt.operands[0]->kind != TokenKind::Identifier
+        || (stmt.operands[0] + 1)->kind != TokenKind::Equals) {
+        throw SourceError(std::string(directive.text) + " expects <name> = <value>" + Encoder::location(directive),
+                          directive);
+    }
+    const Token& value = *stmt.operands[1];
+    const SymbolTable::Symbol* alias = substitute(value);
+    TokenKind expected = kind == Precompiled::Kind::Register ? TokenKind::Register : TokenKind::Integer;
+    if (value.kind != expected) {
+        throw SourceError(std::string(directive.text) + (expected == TokenKind::Register ? " expects a register: "
+                          : " expects a number: ") + std::string(value.text) + Encoder::location(directive), directive);
+    }
+
+    // A header is only reusable on its own if it doesn't refer to other files
+    uint16_t file = directive.file;
+    if (file != 0) {
+        IncludeState& state = includeStates[file - 1];
+        state.cacheable = state.cacheable && (alias == nullptr || alias->file == file);
+        if (state.cacheable) {
+            state.symbols.push_back({stmt.operands[0]->text, kind, value.value});
+        }
+    }
+    defineSymbol(static_cast<uint32_t>(stmt.operands[0]->value), kind, value.value, file, directive);
+}
+
+void Assembler::defineData(const Statement& stmt) {
+    // Format: .db/.dw value {, value}, .ascii "text", .incbin "file". Values
+    // are numbers, strings (.db only) or .equ/.set constants.
+    const Token& name = *stmt.mnemonic;
+    bool list = isDirective(name, ".db") || isDirective(name, ".dw");
+    TokenKind expected = list ? TokenKind::Data : TokenKind::String;
+    if (stmt.operandCount != 1 || stmt.operands[0]->kind != expected) {
+        throw SourceError(std::string(name.text) + (list ? " expects a list of values" : " expects a string in quotes")
+                          + Encoder::location(name), name);
+    }
+    const Token& operand = *stmt.operands[0];
+    DataBlock block{nullptr, dataBytes.size(), 0};
+    if (list) {
+        parseDataList(operand, isDirective(name, ".dw") ? 2 : 1);
+    } else if (isDirective(name, ".ascii")) {
+        if (!Lexer::unescape(operand.text, dataBytes)) {
+            throw SourceError("Unknown escape sequence in string" + Encoder::location(name), name);
+        }
+    } else {
+        // The file is copied into the image as it is, never parsed
+        IncludeFile file;
+        const std::string& includer = name.file == 0 ? std::string() : includes[name.file - 1].path;
+        if (!binaryResolver || !binaryResolver(operand.text, includer, file)) {
+            throw SourceError("Binary file not found: " + std::string(operand.text) + Encoder::location(name), name);
+        }
+        if (file.text.size() > FLASH_SIZE) {
+            throw SourceError("Binary file is larger than the flash: " + file.path + Encoder::location(name), name);
+        }
+        block.external = reinterpret_cast<const uint8_t*>(file.text.data());
+        block.size = static_cast<uint32_t>(file.text.size());
+    }
+    if (block.external == nullptr) {
+        if (dataBytes.size() - block.offset > FLASH_SIZE) {
+            // Not placed yet; even at address 0 it doesn't fit
+            throw programTooLarge(name, static_cast<uint32_t>(std::min<size_t>(dataBytes.size() - block.offset,
+                                                                               UINT32_MAX)));
+        }
+        block.size = static_cast<uint32_t>(dataBytes.size() - block.offset);
+    }
+    tokens[static_cast<size_t>(&operand - tokens.data())].value = static_cast<int32_t>(dataBlocks.size());
+    dataBlocks.push_back(block);
+}
+
+void Assembler::parseDataList(const Token& list, uint8_t width) {
+    // Values are decoded straight from the source text into dataBytes,
+    // without a token per value
+    std::string_view text = list.text;
+    int32_t min = width == 1 ? INT8_MIN : INT16_MIN;
+    int32_t max = width == 1 ? UINT8_MAX : UINT16_MAX;
+    auto fail = [&](const std::string& message) {
+        return SourceError(message + Encoder::location(list), list);
+    };
+    size_t pos = 0;
+    for (;;) {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t')) {
+            ++pos;
+        }
+        if (pos == text.size()) {
+            throw fail("Expected a value after ','");
+        }
+
+        if (text[pos] == '"') {
+            if (width != 1) {
+                throw fail(".dw takes no strings");
+            }
+            size_t start = ++pos;
+            while (text[pos] != '"') {
+                pos += text[pos] == '\\' ? 2 : 1;  // The lexer checked the closing quote
+            }
+            if (!Lexer::unescape(text.substr(start, pos - start), dataBytes)) {
+                throw fail("Unknown escape sequence in string");
+            }
+            ++pos;
+        } else {
+            int32_t value = 0;
+            size_t length = Lexer::scanInteger(text.substr(pos), value);
+            if (length == 0) {
+                size_t start = pos;
+                while (pos < text.size() && isNameChar(text[pos])) {
+                    ++pos;
+                }
+                uint32_t id = symbols.find(text.substr(start, pos - start));
+                SymbolTable::Kind kind = id == SymbolTable::NONE ? SymbolTable::Kind::Undefined : symbols[id].kind;
+                if (kind != SymbolTable::Kind::Constant && kind != SymbolTable::Kind::Variable) {
+                    throw fail("Expected a number or constant: "
+                               + std::string(text.substr(start, std::max<size_t>(pos - start, 1))));
+                }
+                value = symbols[id].value;
+            }
+            pos += length;
+            if (value < min || value > max) {
+                throw fail("Value out of range: " + std::to_string(value));
+            }
+            dataBytes.push_back(static_cast<uint8_t>(value & 0xFF));
+            if (width == 2) {
+                dataBytes.push_back(static_cast<uint8_t>((value >> 8) & 0xFF));
+            }
+        }
+
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t')) {
+            ++pos;
+        }
+        if (pos == text.size()) {
+            return;
+        }
+        if (text[pos] != ',') {
+            throw fail("Expected ',' between values");
+        }
+        ++pos;
+    }
+}
+
+void Assembler::defineSymbol(uint32_t id, Precompiled::Kind kind, int32_t value, uint16_t file, const Token& where) {
+    SymbolTable::Symbol& symbol = symbols[id];
+    // .set and .def may be redefined, .equ may not
+    if (symbol.kind != SymbolTable::Kind::Undefined
+        && (symbol.kind != symbolKind(kind) || kind == Precompiled::Kind::Constant)) {
+        throw SourceError("Symbol already defined: " + std::string(symbol.name) + Encoder::location(where), where);
+    }
+    symbol.kind = symbolKind(kind);
+    symbol.value = value;
+    symbol.file = file;
+}
+
+const SymbolTable::Symbol* Assembler::substitute(const Token& operand) {
+    // Turn the identifier into the number or register it stands for
+    if (operand.kind != TokenKind::Identifier) {
+        return nullptr;
+    }
+    const SymbolTable::Symbol& symbol = symbols[static_cast<uint32_t>(operand.value)];
+    if (symbol.kind == SymbolTable::Kind::Undefined || symbol.kind == SymbolTable::Kind::Label) {
+        return nullptr;
+    }
+    Token& token = tokens[static_cast<size_t>(&operand - tokens.data())];
+    token.kind = symbol.kind == SymbolTable::Kind::Register ? TokenKind::Register : TokenKind::Integer;
+    token.value = symbol.value;
+    return &symbol;
+}
+
+void Assembler::resolveLocal(const Token& token) {
+    // "1:" becomes a label named after its definition count, "1b" and "1f"
+    // refer to the latest and to the next definition
+    uint32_t number = static_cast<uint32_t>(token.value);
+    if (number >= localLabels.size()) {
+        localLabels.resize(number + 1, 0);
+    }
+    uint32_t instance = localLabels[number];
+    if (token.kind == TokenKind::LocalLabel) {
+        instance = ++localLabels[number];
+    } else if (token.text.back() == 'f') {
+        ++instance;
+    }
+    Token& resolved = tokens[static_cast<size_t>(&token - tokens.data())];
+    resolved.kind = TokenKind::Identifier;
+    resolved.value = static_cast<int32_t>(symbols.internLocal(number, instance));
+}
+
+const SymbolTable::Symbol* Assembler::findLabel(const Token& operand) const {
+    if (operand.kind != TokenKind::Identifier) {
+        return nullptr;
+    }
+    const SymbolTable::Symbol& symbol = symbols[static_cast<uint32_t>(operand.value)];
+    return symbol.kind == SymbolTable::Kind::Label ? &symbol : nullptr;
+}
+
+void Assembler::defineLabel(const Token& label, uint32_t address) {
+    uint32_t id = static_cast<uint32_t>(label.value);
+    SymbolTable::Symbol& symbol = symbols[id];
+    if (symbol.kind == SymbolTable::Kind::Label) {
+        throw SourceError(Encoder::duplicateLabel(label.text) + Encoder::location(label), label);
+    }
+    if (symbol.kind != SymbolTable::Kind::Undefined) {
+        throw SourceError("Label is already defined as a symbol: " + std::string(label.text) + Encoder::location(label),
+                          label);
+    }
+    symbol.kind = SymbolTable::Kind::Label;
+    symbol.value = static_cast<int32_t>(address);
+    symbol.file = label.file;
+    labels.push_back(id);
+}
+
+void Assembler::clearLabels() {
+    for (uint32_t id : labels) {
+        symbols[id].kind = SymbolTable::Kind::Undefined;
+    }
+    labels.clear();
+}
+
+void Assembler::firstPass() {
+    branches.clear();
+    relaxationReport = RelaxationReport();
+    layout(log != nullptr && !relaxMode);
+    if (!relaxMode) {
+        return;
+    }
+
+    // Every jump starts in its shortest form and only ever grows, so the
+    // layout reaches a fixed point after a few iterations
+    while (growBranches()) {
+        layout(false);
+    }
+    reportRelaxation();
+    if (log != nullptr) {
+        layout(true);
+    }
+}
+
+void Assembler::layout(bool printLayout) {
+    uint32_t programCounter = 0;
+    size_t branchIndex = 0;
+    Statement stmt;
+    clearLabels();
+
+    // Collect all label addresses
+    for (size_t pos = 0; pos < tokens.size();) {
+        pos = Lexer::readStatement(tokens, pos, stmt);
+
+        // Store label position
+        if (stmt.label != nullptr) {
+            defineLabel(*stmt.label, programCounter);
+            if (printLayout) {
+                *log << "Label " << stmt.label->text << " at address: " << programCounter << "\n";
+            }
+        }
+        if (stmt.mnemonic == nullptr || applyDirective(stmt, programCounter, false)) {
+            continue;
+        }
+
+        // Determine instruction size from its descriptor, or from the encoding
+        // relaxation picked for it
+        const Opcodes::Descriptor& desc = lookupInstruction(stmt);
+        uint8_t size = desc.size;
+        if (isRelaxable(desc)) {
+            if (branchIndex == branches.size()) {
+                const Opcodes::Descriptor* jump = &desc;
+                if (desc.operands[0] != Opcodes::OperandKind::Relative7) {
+                    bool call = desc.mnemonic == "CALL" || desc.mnemonic == "RCALL";
+                    jump = Opcodes::MAP.find(call ? "RCALL" : "RJMP");
+                }
+                branches.push_back({&desc, jump, false, stmt.operands[0], 0});
+            }
+            Branch& branch = branches[branchIndex++];
+            branch.address = programCounter;
+            size = branch.size();
+        }
+        if (printLayout) {
+            *log << "Instruction " << desc.mnemonic << " at address: " << programCounter << "\n";
+        }
+        if (placements != nullptr) {
+            placements->push_back({programCounter, size, &desc});
+        }
+        programCounter += size;
+
+        // Validate addresses
+        if (programCounter > FLASH_SIZE) {
+            throw programTooLarge(*stmt.mnemonic, programCounter);
+        }
+    }
+}
+
+bool Assembler::isRelaxable(const Opcodes::Descriptor& desc) const {
+    return relaxMode && desc.operandCount == 1 && Opcodes::isLabelOperand(desc.operands[0]);
+}
+
+bool Assembler::growBranches() {
+    bool grown = false;
+    for (Branch& branch : branches) {
+        Opcodes::OperandKind kind = branch.jump->operands[0];
+        const SymbolTable::Symbol* target = findLabel(*branch.target);
+        if (kind == Opcodes::OperandKind::Absolute22 || target == nullptr) {
+            continue;  // Reaches everything, or fails later as an unknown label
+        }
+        uint32_t address = branch.address + (branch.inverted ? 2 : 0);
+        int32_t value = Encoder::labelValue(kind, static_cast<uint32_t>(target->value), address);
+        if (value >= Opcodes::operandMin(kind) && value <= Opcodes::operandMax(kind)) {
+            continue;
+        }
+
+        // BRxx -> inverted BRxx over RJMP -> inverted BRxx over JMP, RJMP -> JMP
+        if (kind == Opcodes::OperandKind::Relative7) {
+            if (Opcodes::invertedBranch(*branch.jump) == nullptr) {
+                continue;  // No inverse to expand with, reported as out of range
+            }
+            branch.jump = Opcodes::MAP.find("RJMP");
+            branch.inverted = true;
+        } else {
+            branch.jump = Opcodes::MAP.find(branch.jump->mnemonic == "RCALL" ? "CALL" : "JMP");
+        }
+        grown = true;
+    }
+    return grown;
+}
+
+void Assembler::reportRelaxation() {
+    for (const Branch& branch : branches) {
+        uint8_t cycles = branch.jump->cyclesTaken;
+        if (branch.inverted) {
+            cycles += Opcodes::invertedBranch(*branch.written)->cycles;
+            ++relaxationReport.expanded;
+        } else if (branch.jump->size < branch.written->size) {
+            ++relaxationReport.shortened;
+        } else if (branch.jump->size > branch.written->size) {
+            ++relaxationReport.lengthened;
+        }
+        relaxationReport.bytesSaved += branch.written->size - branch.size();
+        relaxationReport.cyclesSaved += branch.written->cyclesTaken - cycles;
+        if (log != nullptr && branch.jump != branch.written) {
+            *log << "Relaxed " << branch.written->mnemonic << " at address: " << branch.address << " to "
+                 << (branch.inverted ? "inverted branch over " : "") << branch.jump->mnemonic << "\n";
+        }
+    }
+}
+
+void Assembler::secondPass() {
+    uint32_t address = 0;
+    size_t branchIndex = 0;
+    Statement stmt;
+    program.clear();
+    dataStarts.clear();
+    lineAddresses.clear();
+    collectProgram = peepholeOptions.any() || analysisMode;
+    for (size_t pos = 0; pos < tokens.size();) {
+        pos = Lexer::readStatement(tokens, pos, stmt);
+        if (stmt.end->file == 0) {
+            lineAddresses.push_back(address);
+        }
+        if (stmt.mnemonic == nullptr || applyDirective(stmt, address, true)) {
+            continue;
+        }
+
+        const Opcodes::Descriptor& desc = lookupInstruction(stmt);
+        if (isRelaxable(desc)) {
+            const Branch& branch = branches[branchIndex++];
+            emitBranch(branch, address);
+            address += branch.size();
+            continue;
+        }
+
+        int32_t values[2] = {0, 0};
+        for (uint8_t i = 0; i < stmt.operandCount; ++i) {
+            if (!relocatable || !addRelocation(desc, i, *stmt.operands[i], address)) {
+                values[i] = resolveOperand(desc, desc.operands[i], *stmt.operands[i], address);
+            }
+        }
+
+        encodeInstruction(desc, values, address, stmt.mnemonic->line);
+        address += desc.size;
+    }
+    lineAddresses.push_back(address);
+    if (collectProgram && !peepholeOptions.any()) {
+        flushProgram();
+    }
+}
+
+void Assembler::emitBranch(const Branch& branch, uint32_t address) {
+    if (branch.inverted) {
+        // Skip the jump when the original condition is false
+        const Opcodes::Descriptor& skip = *Opcodes::invertedBranch(*branch.written);
+        int32_t over[2] = {branch.jump->size / 2, 0};
+        encodeInstruction(skip, over, address, branch.target->line);
+        address += skip.size;
+    }
+    const Opcodes::Descriptor& jump = *branch.jump;
+    int32_t values[2] = {resolveOperand(jump, jump.operands[0], *branch.target, address), 0};
+    encodeInstruction(jump, values, address, branch.target->line);
+}
+
+void Assembler::encodeInstruction(const Opcodes::Descriptor& desc, const int32_t* values, uint32_t address,
+                                          uint32_t line) {
+    if (collectProgram) {
+        // Encoded once the optimizer is done with it
+        uint32_t target = 0;
+        if (desc.operandCount == 1 && Opcodes::isLabelOperand(desc.operands[0])) {
+            target = Encoder::labelTarget(desc.operands[0], values[0], address);
+        }
+        program.push_back({&desc, {values[0], values[1]}, address, target, line, false});
+        return;
+    }
+    uint32_t opcode = Opcodes::encode(desc, values);
+    emit(address, opcode, desc.size);
+    lineTable.push_back({address, line});
+    if (log != nullptr) {
+        *log << desc.mnemonic << " encoded at address: " << address
+             << " as 0x" << std::hex << opcode << std::dec << "\n";
+    }
+}
+
+void Assembler::optimize() {
+    std::vector<uint32_t> addresses;
+    addresses.reserve(labels.size());
+    for (uint32_t id : labels) {
+        addresses.push_back(static_cast<uint32_t>(symbols[id].value));
+    }
+
+    Peephole::Optimizer optimizer(peepholeOptions);
+    optimizer.run(program, addresses);
+    // Data stays where it is, like code placed by .org, so its labels do too
+    std::sort(dataStarts.begin(), dataStarts.end());
+    for (uint32_t id : labels) {
+        uint32_t address = static_cast<uint32_t>(symbols[id].value);
+        if (!std::binary_search(dataStarts.begin(), dataStarts.end(), address)) {
+            symbols[id].value = static_cast<int32_t>(optimizer.relocate(address));
+        }
+    }
+    std::copy(std::begin(optimizer.getReport()), std::end(optimizer.getReport()), std::begin(peepholeReport));
+
+    flushProgram();
+}
+
+void Assembler::flushProgram() {
+    collectProgram = false;
+    for (const Peephole::Instruction& ins : program) {
+        encodeInstruction(*ins.desc, ins.values, ins.address, ins.line);
+    }
+}
+
+void Assembler::analyze() {
+    cycleAnalyzer.run(program, symbols);
+}
+
+void Assembler::singlePass() {
+    startSinglePass();
+    encodeStatements();
+    reportUnresolved();
+}
+
+void Assembler::startSinglePass() {
+    passAddress = 0;
+    fixups.clear();
+    firstPending = 0;
+    pendingFixups.clear();
+}
+
+void Assembler::encodeStatements() {
+    uint32_t& address = passAddress;
+    Statement stmt;
+    pendingFixups.resize(symbols.size(), SymbolTable::NONE);
+
+    // Encode every instruction as soon as it is read. References to labels that
+    // are not defined yet are emitted as zero and patched when the label appears.
+    for (size_t pos = 0; pos < tokens.size();) {
+        pos = Lexer::readStatement(tokens, pos, stmt);
+
+        if (stmt.label != nullptr) {
+            defineLabel(*stmt.label, address);
+            resolveFixups(static_cast<uint32_t>(stmt.label->value));
+        }
+        if (stmt.mnemonic == nullptr || applyDirective(stmt, address, true)) {
+            continue;
+        }
+
+        const Opcodes::Descriptor& desc = lookupInstruction(stmt);
+        Fixup fixup{&desc, Token(), address, 0, {0, 0}, SymbolTable::NONE};
+        bool pending = false;
+        for (uint8_t i = 0; i < stmt.operandCount; ++i) {
+            const Token& operand = *stmt.operands[i];
+            if (Opcodes::isLabelOperand(desc.operands[i]) && operand.kind == TokenKind::Identifier
+                && findLabel(operand) == nullptr) {
+                fixup.operand = operand;
+                fixup.operandIndex = i;
+                pending = true;
+                continue;
+            }
+            fixup.values[i] = resolveOperand(desc, desc.operands[i], operand, fixup.address);
+        }
+
+        if (pending) {
+            uint32_t label = static_cast<uint32_t>(fixup.operand.value);
+            fixup.next = pendingFixups[label];
+            pendingFixups[label] = static_cast<uint32_t>(fixups.size());
+            fixups.push_back(fixup);
+        }
+        emit(address, Opcodes::encode(desc, fixup.values), desc.size);
+        lineTable.push_back({address, stmt.mnemonic->line});
+        address += desc.size;
+        if (address > FLASH_SIZE) {
+            throw programTooLarge(*stmt.mnemonic, address);
+        }
+    }
+}
+
+void Assembler::reportUnresolved() {
+    // Report the first reference to a label that never got defined
+    const Token* unresolved = nullptr;
+    for (uint32_t head : pendingFixups) {
+        for (uint32_t i = head; i != SymbolTable::NONE; i = fixups[i].next) {
+            if (unresolved == nullptr || fixups[i].operand.line < unresolved->line) {
+                unresolved = &fixups[i].operand;
+            }
+        }
+    }
+    if (unresolved != nullptr) {
+        throw SourceError(Encoder::unknownLabel(unresolved->text) + Encoder::location(*unresolved), *unresolved);
+    }
+}
+
+void Assembler::resolveFixups(uint32_t label) {
+    // Range checks for relative branches happen here, now that the distance is known
+    for (uint32_t i = pendingFixups[label]; i != SymbolTable::NONE; i = fixups[i].next) {
+        Fixup& fixup = fixups[i];
+        const Opcodes::Descriptor& desc = *fixup.desc;
+        fixup.values[fixup.operandIndex] =
+            resolveOperand(desc, desc.operands[fixup.operandIndex], fixup.operand, fixup.address);
+        patch(fixup.address, Opcodes::encode(desc, fixup.values), desc.size);
+        fixup.desc = nullptr;
+    }
+    pendingFixups[label] = SymbolTable::NONE;
+}
+
+bool Assembler::addRelocation(const Opcodes::Descriptor& desc, uint8_t operandIndex, const Token& operand,
+                              uint32_t address) {
+    // The linker fills in labels of other modules, and absolute addresses of
+    // labels in a module it is free to move. Relative distances within the
+    // module don't change when it moves.
+    Opcodes::OperandKind kind = desc.operands[operandIndex];
+    if (!Opcodes::isLabelOperand(kind) || operand.kind != TokenKind::Identifier) {
+        return false;
+    }
+    uint32_t id = static_cast<uint32_t>(operand.value);
+    SymbolTable::Kind symbolKind = symbols[id].kind;
+    if (symbolKind != SymbolTable::Kind::Undefined
+        && (symbolKind != SymbolTable::Kind::Label || kind != Opcodes::OperandKind::Absolute22 || usesOrg)) {
+        return false;
+    }
+    relocations.push_back({address, static_cast<uint16_t>(&desc - Opcodes::TABLE), operandIndex, id});
+    return true;
+}
+
+void Assembler::buildObject() {
+    object.absolute = usesOrg;
+    object.sections = machineCode.getSegments();
+    object.symbols.clear();
+    object.relocations.clear();
+    objectSymbols.assign(symbols.size(), SymbolTable::NONE);
+
+    for (const Token* name : globals) {
+        uint32_t id = static_cast<uint32_t>(name->value);
+        const SymbolTable::Symbol& symbol = symbols[id];
+        if (symbol.kind != SymbolTable::Kind::Label) {
+            throw SourceError(".global names no label: " + std::string(name->text) + Encoder::location(*name), *name);
+        }
+        if (objectSymbols[id] == SymbolTable::NONE) {
+            objectSymbols[id] = static_cast<uint32_t>(object.symbols.size());
+            object.symbols.push_back({std::string(symbol.name), ObjectFile::Binding::Global,
+                                      static_cast<uint32_t>(symbol.value)});
+        }
+    }
+    for (const ObjectFile::Relocation& relocation : relocations) {
+        uint32_t id = relocation.symbol;
+        const SymbolTable::Symbol& symbol = symbols[id];
+        if (objectSymbols[id] == SymbolTable::NONE) {
+            bool defined = symbol.kind == SymbolTable::Kind::Label;
+            objectSymbols[id] = static_cast<uint32_t>(object.symbols.size());
+            object.symbols.push_back({std::string(symbol.name),
+                                      defined ? ObjectFile::Binding::Local : ObjectFile::Binding::External,
+                                      defined ? static_cast<uint32_t>(symbol.value) : 0});
+        }
+        object.relocations.push_back({relocation.address, relocation.opcode, relocation.operand, objectSymbols[id]});
+    }
+}
+
+int32_t Assembler::resolveOperand(const Opcodes::Descriptor& desc, Opcodes::OperandKind kind,
+                                          const Token& operand, uint32_t address) {
+    int32_t value = 0;
+    if (Opcodes::isLabelOperand(kind)) {
+        const SymbolTable::Symbol* label = findLabel(operand);
+        if (label == nullptr) {
+            throw SourceError(Encoder::unknownLabel(operand.text) + Encoder::location(operand), operand);
+        }
+        value = Encoder::labelValue(kind, static_cast<uint32_t>(label->value), address);
+    } else {
+        value = Encoder::operandValue(desc, kind, operand);
+    }
+
+    Encoder::checkRange(desc, kind, value, operand);
+    return value;
+}
+
+bool Assembler::applyDirective(const Statement& stmt, uint32_t& address, bool encode) {
+    const Token& name = *stmt.mnemonic;
+    if (name.text[0] != '.') {
+        return false;
+    }
+
+    if (isDataDirective(name)) {
+        // Odd-sized data is padded with a zero byte, so code stays word aligned
+        const DataBlock& block = dataBlocks[static_cast<size_t>(stmt.operands[0]->value)];
+        uint32_t size = (block.size + 1) & ~1u;
+        if (!encode && placements != nullptr) {
+            placements->push_back({address, size, nullptr});
+        }
+        if (address + size > FLASH_SIZE) {
+            throw programTooLarge(*stmt.mnemonic, address + size);
+        }
+        if (encode && block.size != 0) {
+            const uint8_t* bytes = block.external != nullptr ? block.external : &dataBytes[block.offset];
+            machineCode.write(address, bytes, block.size);
+            if (size != block.size) {
+                uint8_t padding = 0;
+                machineCode.write(address + block.size, &padding, 1);
+            }
+            dataStarts.push_back(address);
+        }
+        address += size;
+        return true;
+    }
+
+    if (isDirective(name, ".org")) {
+        // Format: .org k (k is a word address, as in avrasm)
+        if (stmt.operandCount != 1 || stmt.operands[0]->kind != TokenKind::Integer) {
+            throw SourceError(".org expects a word address" + Encoder::location(name), name);
+        }
+        int32_t wordAddress = stmt.operands[0]->value;
+        if (wordAddress < 0 || static_cast<int64_t>(wordAddress) * 2 > FLASH_SIZE) {
+            throw SourceError(".org address out of range: " + std::string(stmt.operands[0]->text) + Encoder::location(name), name);
+        }
+        if (streaming && static_cast<uint32_t>(wordAddress) * 2 < streamed) {
+            throw SourceError(".org can't go back to code that was streamed already" + Encoder::location(name), name);
+        }
+        address = static_cast<uint32_t>(wordAddress) * 2;
+        usesOrg = true;
+        return true;
+    }
+    if (isDirective(name, ".equ") || isDirective(name, ".set") || isDirective(name, ".def")
+        || isDirective(name, ".include") || isDirective(name, ".device") || isDirective(name, ".global")
+        || isDirective(name, ".extern")) {
+        return true;  // Handled before the passes
+    }
+    throw SourceError("Unknown directive: " + std::string(name.text) + Encoder::location(name), name);
+}
+
+void Assembler::emit(uint32_t address, uint32_t opcode, uint8_t size) {
+    uint8_t bytes[4];
+    Encoder::toBytes(opcode, size, bytes);
+    machineCode.write(address, bytes, size);
+}
+
+void Assembler::patch(uint32_t address, uint32_t opcode, uint8_t size) {
+    uint8_t bytes[4];
+    Encoder::toBytes(opcode, size, bytes);
+    machineCode.patch(address, bytes, size);
+}
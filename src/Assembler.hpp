@@ -0,0 +1,267 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "OpcodeMap.hpp"
+#include "Lexer.hpp"
+#include "TimeReport.hpp"
+#include "MemoryImage.hpp"
+#include "Peephole.hpp"
+#include "CycleAnalyzer.hpp"
+#include "Precompiled.hpp"
+#include "SymbolTable.hpp"
+#include "ObjectFile.hpp"
+
+// In-memory assembler: source text in, flash image, symbol table and
+// diagnostics out, without touching the file system. The opcode tables are
+// shared constexpr data. A context keeps its token, label and code buffers
+// between calls, so assembling many sources with one context does not
+// reallocate them.
+class Assembler {
+public:
+    static constexpr uint32_t FLASH_SIZE = 0x8000;  // 32 KB program flash
+
+    // Error found by the last assemble() call
+    struct Diagnostic {
+        std::string file;  // include path, empty for the main source
+        size_t line;       // 1-based, 0 if the error is not tied to a line
+        std::string message;
+    };
+
+    // Contents of one .include file, supplied by the front end
+    struct IncludeFile {
+        std::string path;              // names the file in diagnostics; each path is included once
+        std::string_view text;         // must stay valid until assemble() returns
+        std::string_view precompiled;  // Precompiled::write() output, used instead of text if not empty
+    };
+    // Finds the file an .include names. includer is the path of the including
+    // file, empty for the main source. Returns false if there is no such file.
+    using IncludeResolver = std::function<bool(std::string_view name, const std::string& includer, IncludeFile& file)>;
+
+    // File included by the last assemble() call
+    struct Include {
+        std::string path;
+        bool precompiled;         // symbols came from IncludeFile::precompiled
+        std::string definitions;  // precompiled form, if the file can be precompiled
+    };
+
+    // Effect of branch relaxation compared to the instructions as written
+    struct RelaxationReport {
+        size_t shortened = 0;    // JMP/CALL encoded as RJMP/RCALL
+        size_t lengthened = 0;   // RJMP/RCALL out of reach, encoded as JMP/CALL
+        size_t expanded = 0;     // BRxx out of reach, encoded as an inverted BRxx over a jump
+        int32_t bytesSaved = 0;
+        int32_t cyclesSaved = 0; // when every relaxed instruction branches once
+    };
+
+    // Address and source line of one encoded instruction
+    struct SourceLine {
+        uint32_t address;
+        uint32_t line;
+    };
+
+    // Where the layout put one instruction or data block
+    struct Placement {
+        uint32_t address;
+        uint32_t size;
+        const Opcodes::Descriptor* desc;  // nullptr for data
+    };
+
+    // Prints every label and encoded instruction to log, nullptr to disable
+    void setLog(std::ostream* log);
+    void setSinglePass(bool enabled);
+    // Picks the shortest jump, call and branch encoding that reaches each target.
+    // Relaxation needs the label layout, so it implies two-pass assembly.
+    void setRelaxBranches(bool enabled);
+    // Enables peephole rules, run on the resolved code before it is encoded.
+    // Like relaxation this implies two-pass assembly.
+    void setPeepholeOptions(const Peephole::Options& options);
+    // Runs the cycle and stack analysis on the final code. loopBounds gives the
+    // iteration count of loops, keyed by the label of the loop header.
+    void setCycleAnalysis(bool enabled, const std::unordered_map<std::string, uint32_t>& loopBounds = {});
+    // Without a resolver .include is an error
+    void setIncludeResolver(IncludeResolver resolver);
+    // Finds the file an .incbin names; only IncludeFile::path and text are
+    // used. Without a resolver .incbin is an error.
+    void setBinaryResolver(IncludeResolver resolver);
+    // Fills Include::definitions of headers that hold only .equ, .set and .def
+    // lines whose values don't depend on other files
+    void setPrecompileHeaders(bool enabled);
+    // Produces an object module for the Linker instead of a finished image.
+    // Labels named by .global are exported; labels this source does not define
+    // become relocations. Can't be combined with relaxation or peephole rules.
+    void setRelocatable(bool enabled);
+
+    // Assembles source, which only has to stay valid during the call. Returns
+    // false if there were errors; the image is incomplete then.
+    bool assemble(std::string_view source);
+
+    // Receives code no later line can change, in ascending address order
+    using StreamOutput = std::function<void(uint32_t address, const uint8_t* data, size_t size)>;
+    // Starts a source that arrives in pieces, e.g. from a pipe. Each piece is
+    // assembled in a single pass and dropped; only the symbols and the
+    // unresolved forward references are kept. Code is passed to output once
+    // it is final, i.e. it lies below the current address and below every
+    // unresolved reference. .org may not go back to code passed on already.
+    // Can't be combined with relaxation, peephole rules, cycle analysis or
+    // object output.
+    void beginStream(StreamOutput output);
+    // Assembles the next piece, which has to end with a complete line
+    bool feed(std::string_view text);
+    // Assembles the last piece, reports labels that were never defined and
+    // passes on the remaining code. Returns false if the stream had errors.
+    bool endStream(std::string_view text = std::string_view());
+
+    // Results of the last assemble() call
+    const MemoryImage& getImage() const;
+    const SymbolTable& getSymbols() const;  // labels, .equ/.set constants and .def aliases
+    const std::vector<Diagnostic>& getDiagnostics() const;
+    const std::vector<Include>& getIncludes() const;
+    const std::vector<SourceLine>& getLineTable() const;
+    // Address before each line of the main source, then the address after
+    // the last one. Filled by the second pass, before peephole rules move code.
+    const std::vector<uint32_t>& getLineAddresses() const;
+    // After a "Program too large" error: every statement laid out up to and
+    // including the one that runs past the flash. Labels keep their addresses.
+    const std::vector<Placement>& getOverflowLayout() const;
+    const std::vector<PhaseTime>& getPhaseTimes() const;
+    size_t getSourceSize() const;
+    size_t getLineCount() const;
+    const RelaxationReport& getRelaxationReport() const;
+    const Peephole::Report& getPeepholeReport() const;
+    const CycleAnalyzer& getCycleAnalysis() const;
+    const ObjectFile::Module& getObject() const;  // filled in relocatable mode
+
+private:
+    std::ostream* log = nullptr;
+    bool singlePassMode = false;
+    bool relaxMode = false;
+    bool analysisMode = false;
+    bool collectProgram = false;
+    Peephole::Options peepholeOptions;
+    IncludeResolver includeResolver;
+    IncludeResolver binaryResolver;
+    bool precompileHeaders = false;
+    bool relocatable = false;
+    bool usesOrg = false;
+    bool streaming = false;
+    StreamOutput streamOutput;
+    uint32_t streamed = 0;   // code below this address was passed to streamOutput
+    uint32_t nextLine = 1;   // first line number of the next piece
+    size_t sourceSize = 0;
+
+    // Instruction whose label operand is patched once the label is defined
+    struct Fixup {
+        const Opcodes::Descriptor* desc;  // nullptr once resolved
+        Token operand;                    // a copy, since a stream drops its tokens
+        uint32_t address;
+        uint8_t operandIndex;
+        int32_t values[2];
+        uint32_t next;  // earlier fixup waiting for the same label, or SymbolTable::NONE
+    };
+    // Encoding that relaxation chose for one jump, call or conditional branch
+    struct Branch {
+        const Opcodes::Descriptor* written;  // instruction as written in the source
+        const Opcodes::Descriptor* jump;     // instruction that reaches the target
+        bool inverted;                       // jump is skipped by the inverted branch
+        const Token* target;
+        uint32_t address;
+        uint8_t size() const { return static_cast<uint8_t>(jump->size + (inverted ? 2 : 0)); }
+    };
+    // Per include: the precompiled symbols, or what is needed to precompile it
+    struct IncludeState {
+        Precompiled::View view;
+        bool cacheable;
+        std::vector<Precompiled::Symbol> symbols;
+    };
+    // Bytes of one .db, .dw or .ascii line or .incbin file, padded to a whole
+    // word when it is placed
+    struct DataBlock {
+        const uint8_t* external;  // .incbin contents, nullptr if the bytes are in dataBytes
+        size_t offset;            // into dataBytes
+        uint32_t size;
+    };
+    std::string_view source;
+    std::vector<Token> tokens;
+    std::vector<Token> scratch;
+    std::vector<Include> includes;
+    std::vector<IncludeState> includeStates;
+    SymbolTable symbols;
+    std::vector<uint8_t> dataBytes;      // parsed .db/.dw/.ascii values
+    std::vector<DataBlock> dataBlocks;   // indexed by the value of the directive's operand token
+    std::vector<uint32_t> dataStarts;    // addresses of the placed blocks, for the optimizer
+    std::vector<uint32_t> labels;        // ids of the labels defined so far
+    std::vector<uint32_t> localLabels;   // definitions so far of each local label number
+    MemoryImage machineCode;
+    std::vector<Fixup> fixups;
+    std::vector<uint32_t> pendingFixups;  // per symbol id: last fixup waiting for it
+    size_t firstPending = 0;              // no fixup before this index is unresolved
+    uint32_t passAddress = 0;             // address of the next instruction in the single pass
+    std::vector<const Token*> globals;    // names in .global directives
+    std::vector<ObjectFile::Relocation> relocations;  // symbol is a SymbolTable id until buildObject()
+    std::vector<uint32_t> objectSymbols;  // per symbol id: index in object.symbols
+    ObjectFile::Module object;
+    std::vector<Branch> branches;
+    RelaxationReport relaxationReport;
+    std::vector<Peephole::Instruction> program;  // second pass output for the optimizer
+    Peephole::Report peepholeReport;
+    CycleAnalyzer cycleAnalyzer;
+    std::vector<SourceLine> lineTable;
+    std::vector<uint32_t> lineAddresses;
+    std::vector<Placement> overflowLayout;
+    std::vector<Placement>* placements = nullptr;  // filled by layout() while recordOverflow() runs
+    std::vector<PhaseTime> phaseTimes;
+    std::vector<Diagnostic> diagnostics;
+    void runPhase(const char* name, void (Assembler::*phase)());
+    bool runGuarded(void (Assembler::*body)());
+    void assembleSource();
+    void recordOverflow();
+    void assemblePiece();
+    void finishStream();
+    void flushStream(uint32_t limit);
+    void tokenize();
+    void tokenizePiece();
+    void scanIncludes();
+    void include(const Statement& stmt, size_t next);
+    void defineSymbols();
+    void defineStatements();
+    void writePrecompiled();
+    void define(const Statement& stmt, Precompiled::Kind kind);
+    void defineData(const Statement& stmt);
+    void parseDataList(const Token& list, uint8_t width);
+    void defineSymbol(uint32_t id, Precompiled::Kind kind, int32_t value, uint16_t file, const Token& where);
+    const SymbolTable::Symbol* substitute(const Token& operand);
+    void resolveLocal(const Token& token);
+    const SymbolTable::Symbol* findLabel(const Token& operand) const;
+    void defineLabel(const Token& label, uint32_t address);
+    void clearLabels();
+    void firstPass();
+    void layout(bool printLayout);
+    bool isRelaxable(const Opcodes::Descriptor& desc) const;
+    bool growBranches();
+    void reportRelaxation();
+    void emitBranch(const Branch& branch, uint32_t address);
+    void encodeInstruction(const Opcodes::Descriptor& desc, const int32_t* values, uint32_t address, uint32_t line);
+    void optimize();
+    void flushProgram();
+    void analyze();
+    void secondPass();
+    void singlePass();
+    void startSinglePass();
+    void encodeStatements();
+    void reportUnresolved();
+    void resolveFixups(uint32_t label);
+    bool addRelocation(const Opcodes::Descriptor& desc, uint8_t operandIndex, const Token& operand, uint32_t address);
+    void buildObject();
+    int32_t resolveOperand(const Opcodes::Descriptor& desc, Opcodes::OperandKind kind,
+                           const Token& operand, uint32_t address);
+    // Handles a directive and moves address past what it places. Data is
+    // only written to the image if encode is set.
+    bool applyDirective(const Statement& stmt, uint32_t& address, bool encode);
+    void emit(uint32_t address, uint32_t opcode, uint8_t size);
+    void patch(uint32_t address, uint32_t opcode, uint8_t size);
+};
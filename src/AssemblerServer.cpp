@@ -0,0 +1,209 @@
+// AssemblerServer.cpp
+// Line protocol front end for IncrementalAssembler
+
+#include "AssemblerServer.hpp"
+#include "IntelHex.hpp"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    const char DIGITS[] = "0123456789ABCDEF";
+
+    std::string hexAddress(uint32_t address) {
+        std::string text = "0x0000";
+        for (int i = 5; i >= 2; --i) {
+            text[i] = DIGITS[address & 0x0F];
+            address >>= 4;
+        }
+        return text;
+    }
+
+    std::vector<std::string> readLines(std::istream& in, size_t count) {
+        std::vector<std::string> lines(count);
+        for (std::string& line : lines) {
+            if (!std::getline(in, line)) {
+                throw std::runtime_error("Unexpected end of input");
+            }
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+        }
+        return lines;
+    }
+}
+
+AssemblerServer::AssemblerServer(std::vector<std::string> includePaths)
+    : includePaths(std::move(includePaths)) {
+}
+
+void AssemblerServer::run(std::istream& in, std::ostream& out) {
+    std::string command;
+    while (std::getline(in, command)) {
+        if (!command.empty() && command.back() == '\r') {
+            command.pop_back();
+        }
+        if (command.empty()) {
+            continue;
+        }
+        bool keepRunning = true;
+        try {
+            keepRunning = handle(command, in, out);
+        } catch (const std::exception& ex) {
+            out << "ERROR " << ex.what() << "\n";
+        }
+        out << "END\n";
+        out.flush();
+        if (!keepRunning) {
+            break;
+        }
+    }
+}
+
+AssemblerServer::File& AssemblerServer::create(const std::string& name) {
+    auto [it, created] = files.try_emplace(name);
+    File& file = it->second;
+    if (created) {
+        // Map nodes don't move, so the resolvers can keep the address
+        auto resolver = [this, &file](std::string_view include, const std::string& includer,
+                                      Assembler::IncludeFile& result) {
+            return resolveInclude(file, include, includer, result);
+        };
+        file.assembler.setIncludeResolver(resolver);
+        file.assembler.setBinaryResolver(resolver);
+    }
+    file.includeTexts.clear();
+    return file;
+}
+
+IncrementalAssembler& AssemblerServer::file(const std::string& name) {
+    auto it = files.find(name);
+    if (it == files.end()) {
+        throw std::runtime_error("No such file: " + name);
+    }
+    it->second.includeTexts.clear();
+    return it->second.assembler;
+}
+
+bool AssemblerServer::resolveInclude(File& file, std::string_view name, const std::string& includer,
+                                     Assembler::IncludeFile& result) {
+    namespace fs = std::filesystem;
+    std::vector<fs::path> candidates{fs::path(includer.empty() ? file.path : includer).parent_path() / name};
+    for (const std::string& directory : includePaths) {
+        candidates.push_back(fs::path(directory) / name);
+    }
+
+    for (const fs::path& candidate : candidates) {
+        std::ifstream in(candidate, std::ios::binary);
+        if (!in.is_open()) {
+            continue;
+        }
+        std::string& text = file.includeTexts.emplace_back((std::istreambuf_iterator<char>(in)),
+                                                           std::istreambuf_iterator<char>());
+        result.path = candidate.lexically_normal().string();
+        result.text = text;
+        return true;
+    }
+    return false;
+}
+
+void AssemblerServer::replyChanges(const IncrementalAssembler& assembler, std::ostream& out) {
+    std::vector<IncrementalAssembler::Diagnostic> diagnostics = assembler.getDiagnostics();
+    const std::vector<IncrementalAssembler::Change>& changes = assembler.getChanges();
+    out << "OK " << assembler.getLineCount() << " lines, " << assembler.getEncodedCount() << " encoded, "
+        << changes.size() << " changes, " << diagnostics.size() << " errors\n";
+    for (const IncrementalAssembler::Change& change : changes) {
+        if (change.erased) {
+            out << "ERASE " << hexAddress(change.address) << " " << change.size << "\n";
+            continue;
+        }
+        out << "WRITE " << hexAddress(change.address) << " ";
+        for (uint32_t i = 0; i < change.size; ++i) {
+            out << DIGITS[change.bytes[i] >> 4] << DIGITS[change.bytes[i] & 0x0F];
+        }
+        out << "\n";
+    }
+    for (const IncrementalAssembler::Diagnostic& diagnostic : diagnostics) {
+        out << "DIAG " << diagnostic.line << " " << diagnostic.message << "\n";
+    }
+}
+
+bool AssemblerServer::handle(const std::string& command, std::istream& in, std::ostream& out) {
+    std::istringstream iss(command);
+    std::string verb, name;
+    iss >> verb >> name;
+
+    if (verb == "QUIT") {
+        out << "OK bye\n";
+        return false;
+    }
+    if (name.empty()) {
+        throw std::runtime_error("Missing file name in: " + command);
+    }
+
+    if (verb == "OPEN") {
+        std::string path;
+        iss >> path;
+        std::ifstream source(path, std::ios::binary);
+        if (!source.is_open()) {
+            throw std::runtime_error("Failed to open input file: " + path);
+        }
+        std::string text((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+        File& file = create(name);
+        file.path = path;
+        file.assembler.load(text);
+        replyChanges(file.assembler, out);
+    } else if (verb == "LOAD") {
+        size_t count = 0;
+        if (!(iss >> count)) {
+            throw std::runtime_error("Usage: LOAD <name> <n>");
+        }
+        std::string text;
+        for (const std::string& line : readLines(in, count)) {
+            text += line;
+            text += '\n';
+        }
+        File& file = create(name);
+        file.path.clear();
+        file.assembler.load(text);
+        replyChanges(file.assembler, out);
+    } else if (verb == "EDIT") {
+        size_t first = 0, count = 0, lineCount = 0;
+        if (!(iss >> first >> count >> lineCount) || first == 0) {
+            throw std::runtime_error("Usage: EDIT <name> <first> <count> <n>");
+        }
+        // Read the replacement before validating, so the stream stays in sync
+        std::vector<std::string> replacement = readLines(in, lineCount);
+        IncrementalAssembler& assembler = file(name);
+        assembler.edit(first - 1, count, replacement);
+        replyChanges(assembler, out);
+    } else if (verb == "IMAGE") {
+        IncrementalAssembler& assembler = file(name);
+        if (!assembler.getDiagnostics().empty()) {
+            throw std::runtime_error(name + " has errors, see DIAG");
+        }
+        MemoryImage image = assembler.buildImage();
+        IntelHex::Writer writer;
+        writer.reserve(image.usedBytes());
+        for (const MemoryImage::Segment& segment : image.getSegments()) {
+            writer.addData(segment.address, segment.data.data(), segment.data.size());
+        }
+        out << "OK " << image.usedBytes() << " bytes\n" << writer.finish();
+    } else if (verb == "DIAG") {
+        std::vector<IncrementalAssembler::Diagnostic> diagnostics = file(name).getDiagnostics();
+        out << "OK " << diagnostics.size() << " errors\n";
+        for (const IncrementalAssembler::Diagnostic& diagnostic : diagnostics) {
+            out << "DIAG " << diagnostic.line << " " << diagnostic.message << "\n";
+        }
+    } else if (verb == "CLOSE") {
+        if (files.erase(name) == 0) {
+            throw std::runtime_error("No such file: " + name);
+        }
+        out << "OK closed\n";
+    } else {
+        throw std::runtime_error("Unknown command: " + verb);
+    }
+    return true;
+}
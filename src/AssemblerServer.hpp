@@ -0,0 +1,54 @@
+#pragma once
+#include "IncrementalAssembler.hpp"
+#include <deque>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Long-running assembler that keeps every opened file assembled in memory and
+// answers edits with the bytes that changed. It speaks a line protocol over
+// a pair of streams (stdin/stdout in the CLI):
+//
+//   OPEN <name> <path>                       load a file from disk
+//   LOAD <name> <n>                          load the next n lines
+//   EDIT <name> <first> <count> <n>          replace count lines starting at the
+//                                            1-based line first with the next n lines
+//   IMAGE <name>                             Intel HEX of the current image
+//   DIAG <name>                              all diagnostics of the file
+//   CLOSE <name>
+//   QUIT
+//
+// Every reply starts with "OK ..." or "ERROR <message>" and ends with "END".
+// OPEN, LOAD and EDIT list "ERASE <address> <size>" and "WRITE <address>
+// <bytes>" lines for the changed flash, followed by "DIAG <line> <message>".
+// Line 0 marks errors in include files or not tied to a line.
+//
+// .include and .incbin files are looked up next to the including file (the
+// OPEN path for the main source, the working directory after LOAD), then in
+// the include paths. They are read again whenever the file is assembled.
+class AssemblerServer {
+public:
+    explicit AssemblerServer(std::vector<std::string> includePaths = {});
+
+    void run(std::istream& in, std::ostream& out);
+
+private:
+    struct File {
+        IncrementalAssembler assembler;
+        std::string path;                      // of the main source, empty after LOAD
+        std::deque<std::string> includeTexts;  // read by the last command
+    };
+
+    std::vector<std::string> includePaths;
+    std::unordered_map<std::string, File> files;
+
+    bool handle(const std::string& command, std::istream& in, std::ostream& out);
+    File& create(const std::string& name);
+    IncrementalAssembler& file(const std::string& name);
+    bool resolveInclude(File& file, std::string_view name, const std::string& includer,
+                        Assembler::IncludeFile& result);
+    static void replyChanges(const IncrementalAssembler& assembler, std::ostream& out);
+};
@@ -0,0 +1,117 @@
+// BatchBuilder.cpp
+// Parallel assembly of many input/output pairs
+
+#include "BatchBuilder.hpp"
+#include "ATmega328Compiler.hpp"
+#include "ThreadPool.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+BatchBuilder::BatchBuilder(size_t threadCount)
+    : threadCount(threadCount) {
+}
+
+void BatchBuilder::setSinglePass(bool enabled) {
+    singlePass = enabled;
+}
+
+void BatchBuilder::setRelaxBranches(bool enabled) {
+    relaxBranches = enabled;
+}
+
+void BatchBuilder::setPeepholeOptions(const Peephole::Options& options) {
+    peepholeOptions = options;
+}
+
+void BatchBuilder::setHexOptions(const IntelHex::Options& options) {
+    hexOptions = options;
+}
+
+void BatchBuilder::setRoundTrip(bool enabled) {
+    roundTrip = enabled;
+}
+
+void BatchBuilder::setIncludePaths(const std::vector<std::string>& paths) {
+    includePaths = paths;
+}
+
+void BatchBuilder::setHeaderCache(const std::string& directory) {
+    headerCache = directory;
+}
+
+void BatchBuilder::setBuildCache(const std::string& directory, uint64_t maxBytes) {
+    buildCache = directory;
+    buildCacheSize = maxBytes;
+}
+
+void BatchBuilder::addJob(const std::string& compileType, const std::string& inputFileName,
+                          const std::string& outputFileName) {
+    BatchJob job;
+    job.compileType = compileType;
+    job.inputFileName = inputFileName;
+    job.outputFileName = outputFileName;
+    jobs.push_back(job);
+}
+
+void BatchBuilder::loadManifest(const std::string& manifestFileName) {
+    std::ifstream file(manifestFileName);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open manifest file: " + manifestFileName);
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        std::istringstream iss(line);
+        std::string compileType, input, output, extra;
+        if (!(iss >> compileType) || compileType[0] == ';' || compileType[0] == '#') {
+            continue;
+        }
+        if (!(iss >> input >> output) || (iss >> extra)) {
+            throw std::runtime_error("Invalid manifest entry at line " + std::to_string(lineNumber)
+                                     + " of " + manifestFileName);
+        }
+        addJob(compileType, input, output);
+    }
+}
+
+size_t BatchBuilder::run() {
+    {
+        ThreadPool pool(threadCount);
+        for (BatchJob& job : jobs) {
+            pool.submit([this, &job] {
+                try {
+                    ATmega328Compiler compiler(job.compileType, job.inputFileName, job.outputFileName);
+                    compiler.setSinglePass(singlePass);
+                    compiler.setRelaxBranches(relaxBranches);
+                    compiler.setPeepholeOptions(peepholeOptions);
+                    compiler.setHexOptions(hexOptions);
+                    compiler.setRoundTrip(roundTrip);
+                    compiler.setIncludePaths(includePaths);
+                    compiler.setHeaderCache(headerCache);
+                    compiler.setBuildCache(buildCache, buildCacheSize);
+                    compiler.compile();
+                    job.success = true;
+                    job.cached = compiler.isCached();
+                } catch (const std::exception& ex) {
+                    job.error = ex.what();
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    size_t failed = 0;
+    for (const BatchJob& job : jobs) {
+        if (!job.success) {
+            ++failed;
+        }
+    }
+    return failed;
+}
+
+const std::vector<BatchJob>& BatchBuilder::getJobs() const {
+    return jobs;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "BuildCache.hpp"
+#include "IntelHex.hpp"
+#include "Peephole.hpp"
+#include <string>
+#include <vector>
+
+struct BatchJob {
+    std::string compileType;
+    std::string inputFileName;
+    std::string outputFileName;
+    bool success = false;
+    bool cached = false;  // output taken from the build cache
+    std::string error;
+};
+
+// Assembles many sources in one process. Every job gets its own
+// ATmega328Compiler, so jobs share no mutable state and one failing job
+// never stops the others.
+class BatchBuilder {
+public:
+    explicit BatchBuilder(size_t threadCount = 0);
+
+    void setSinglePass(bool enabled);
+    void setRelaxBranches(bool enabled);
+    void setPeepholeOptions(const Peephole::Options& options);
+    void setHexOptions(const IntelHex::Options& options);
+    void setRoundTrip(bool enabled);
+    void setIncludePaths(const std::vector<std::string>& paths);
+    void setHeaderCache(const std::string& directory);
+    void setBuildCache(const std::string& directory, uint64_t maxBytes = BuildCache::DEFAULT_MAX_BYTES);
+    void addJob(const std::string& compileType, const std::string& inputFileName, const std::string& outputFileName);
+    // Manifest lines have the form "<hex/bin/obj> <input.asm> <output>". Empty
+    // lines and lines starting with ';' or '#' are ignored.
+    void loadManifest(const std::string& manifestFileName);
+
+    // Runs all jobs and returns the number that failed
+    size_t run();
+    const std::vector<BatchJob>& getJobs() const;
+
+private:
+    size_t threadCount;
+    bool singlePass = false;
+    bool relaxBranches = false;
+    bool roundTrip = false;
+    IntelHex::Options hexOptions;
+    Peephole::Options peepholeOptions;
+    std::vector<std::string> includePaths;
+    std::string headerCache;
+    std::string buildCache;
+    uint64_t buildCacheSize = BuildCache::DEFAULT_MAX_BYTES;
+    std::vector<BatchJob> jobs;
+};
@@ -0,0 +1,308 @@
+// BuildCache.cpp
+// On-disk cache of finished build outputs
+
+#include "BuildCache.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    namespace fs = std::filesystem;
+
+    // Bump the version whenever the layout or the meaning of a value changes
+    constexpr char MAGIC[8] = {'A', 'V', 'R', 'B', 'L', 'D', '0', '1'};
+    constexpr const char* EXTENSION = ".build";
+
+    // Entry: magic, dependency count, output size, then per dependency the
+    // content hash, the path length and the path, then the output. Counters:
+    // hits, misses, bytes of all entries. Little-endian.
+    constexpr size_t ENTRY_HEADER_SIZE = sizeof(MAGIC) + 8;
+    constexpr size_t COUNTER_COUNT = 3;
+
+    void put(std::string& out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+        }
+    }
+
+    uint64_t get(const char* data, int bytes) {
+        uint64_t value = 0;
+        for (int i = bytes - 1; i >= 0; --i) {
+            value = value << 8 | static_cast<unsigned char>(data[i]);
+        }
+        return value;
+    }
+
+    // Spelled out so compilers fold it into one load
+    uint64_t load64(const char* data) {
+        const unsigned char* b = reinterpret_cast<const unsigned char*>(data);
+        return static_cast<uint64_t>(b[0]) | static_cast<uint64_t>(b[1]) << 8 | static_cast<uint64_t>(b[2]) << 16
+               | static_cast<uint64_t>(b[3]) << 24 | static_cast<uint64_t>(b[4]) << 32
+               | static_cast<uint64_t>(b[5]) << 40 | static_cast<uint64_t>(b[6]) << 48
+               | static_cast<uint64_t>(b[7]) << 56;
+    }
+
+    bool readFile(const std::string& path, std::string& text) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            return false;
+        }
+        text.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        return text.empty() || file.read(&text[0], static_cast<std::streamsize>(text.size()));
+    }
+
+    // Exclusive lock on the cache directory while it lives. Without flock()
+    // the counters are only best effort.
+    class DirectoryLock {
+    public:
+        explicit DirectoryLock(const std::string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+            file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (file >= 0) {
+                flock(file, LOCK_EX);
+            }
+#else
+            (void)path;
+#endif
+        }
+        ~DirectoryLock() {
+#if defined(__unix__) || defined(__APPLE__)
+            if (file >= 0) {
+                close(file);  // Releases the lock
+            }
+#endif
+        }
+        DirectoryLock(const DirectoryLock&) = delete;
+        DirectoryLock& operator=(const DirectoryLock&) = delete;
+
+    private:
+        int file = -1;
+    };
+
+    struct Counters {
+        uint64_t values[COUNTER_COUNT] = {};
+        uint64_t& hits() { return values[0]; }
+        uint64_t& misses() { return values[1]; }
+        uint64_t& bytes() { return values[2]; }
+    };
+
+    Counters readCounters(const std::string& path) {
+        Counters counters;
+        std::string data;
+        if (readFile(path, data) && data.size() == COUNTER_COUNT * 8) {
+            for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+                counters.values[i] = get(data.data() + 8 * i, 8);
+            }
+        }
+        return counters;
+    }
+
+    void writeCounters(const std::string& path, const Counters& counters) {
+        std::string data;
+        for (uint64_t value : counters.values) {
+            put(data, value, 8);
+        }
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+}
+
+BuildCache::BuildCache(const std::string& directory, uint64_t maxBytes)
+    : directory(directory)
+    , maxBytes(maxBytes) {
+}
+
+uint64_t BuildCache::hash(std::string_view data, uint64_t seed) {
+    constexpr uint64_t M = 0xC6A4A7935BD1E995ULL;
+    constexpr int R = 47;
+    uint64_t h = seed ^ (data.size() * M);
+    const char* p = data.data();
+    const char* end = p + data.size() / 8 * 8;
+    for (; p != end; p += 8) {
+        uint64_t k = load64(p);
+        k *= M;
+        k ^= k >> R;
+        k *= M;
+        h ^= k;
+        h *= M;
+    }
+    size_t tail = data.size() % 8;
+    if (tail != 0) {
+        h ^= get(p, static_cast<int>(tail));
+        h *= M;
+    }
+    h ^= h >> R;
+    h *= M;
+    h ^= h >> R;
+    return h;
+}
+
+uint64_t BuildCache::key(std::string_view options, std::string_view source) {
+    // Outputs of another assembler version or entry layout never match.
+    // The length goes into every hash, so the parts can't shift.
+    uint64_t key = hash(std::string_view(MAGIC, sizeof(MAGIC)));
+    key = hash(ASSEMBLER_VERSION, key);
+    key = hash(options, key);
+    return hash(source, key);
+}
+
+std::string BuildCache::pathOf(uint64_t key) const {
+    const char digits[] = "0123456789abcdef";
+    std::string name(16, '0');
+    for (int i = 15; i >= 0; --i) {
+        name[i] = digits[key & 0x0F];
+        key >>= 4;
+    }
+    return (fs::path(directory) / (name + EXTENSION)).string();
+}
+
+std::string BuildCache::pathOf(const char* name) const {
+    return (fs::path(directory) / name).string();
+}
+
+bool BuildCache::find(uint64_t key, std::string& output) {
+    std::string path = pathOf(key);
+    std::string data;
+    if (!readFile(path, data) || data.size() < ENTRY_HEADER_SIZE
+        || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        count(false);
+        return false;
+    }
+    uint64_t dependencies = get(data.data() + sizeof(MAGIC), 4);
+    uint64_t outputSize = get(data.data() + sizeof(MAGIC) + 4, 4);
+    size_t position = ENTRY_HEADER_SIZE;
+    std::string text;
+    for (uint64_t i = 0; i < dependencies; ++i) {
+        if (position + 12 > data.size()) {
+            count(false);
+            return false;
+        }
+        uint64_t expected = get(data.data() + position, 8);
+        uint64_t length = get(data.data() + position + 8, 4);
+        position += 12;
+        if (position + length > data.size()
+            || !readFile(data.substr(position, length), text) || hash(text) != expected) {
+            count(false);
+            return false;
+        }
+        position += length;
+    }
+    if (position + outputSize != data.size()) {
+        count(false);
+        return false;
+    }
+    output.assign(data, position, outputSize);
+
+    // The modification time orders entries for eviction
+    std::error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    count(true);
+    return true;
+}
+
+void BuildCache::store(uint64_t key, const std::vector<Dependency>& dependencies, std::string_view output) {
+    std::string data(MAGIC, sizeof(MAGIC));
+    put(data, dependencies.size(), 4);
+    put(data, output.size(), 4);
+    for (const Dependency& dependency : dependencies) {
+        put(data, dependency.hash, 8);
+        put(data, dependency.path.size(), 4);
+        data += dependency.path;
+    }
+    data.append(output.data(), output.size());
+
+    std::error_code error;
+    fs::create_directories(directory, error);
+    std::string path = pathOf(key);
+    std::string temporary = path + "." + std::to_string(std::random_device()()) + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!file) {
+            fs::remove(temporary, error);
+            return;  // A cache that cannot be written only costs speed
+        }
+    }
+
+    DirectoryLock lock(pathOf("lock"));
+    uint64_t replaced = fs::file_size(path, error);
+    if (error) {
+        replaced = 0;
+    }
+    fs::rename(temporary, path, error);
+    if (error) {
+        fs::remove(temporary, error);
+        return;
+    }
+    Counters counters = readCounters(pathOf("stats"));
+    uint64_t bytes = counters.bytes() + data.size();
+    counters.bytes() = bytes > replaced ? bytes - replaced : 0;
+    if (counters.bytes() > maxBytes) {
+        counters.bytes() = evict();
+    }
+    writeCounters(pathOf("stats"), counters);
+}
+
+void BuildCache::count(bool hit) {
+    std::error_code error;
+    fs::create_directories(directory, error);
+    DirectoryLock lock(pathOf("lock"));
+    Counters counters = readCounters(pathOf("stats"));
+    ++(hit ? counters.hits() : counters.misses());
+    writeCounters(pathOf("stats"), counters);
+}
+
+uint64_t BuildCache::evict() const {
+    struct Entry {
+        fs::path path;
+        fs::file_time_type used;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t bytes = 0;
+    std::error_code error;
+    for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+        if (it->path().extension() == EXTENSION) {
+            Entry entry{it->path(), it->last_write_time(error), it->file_size(error)};
+            if (!error) {
+                entries.push_back(entry);
+                bytes += entry.size;
+            }
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const Entry& entry : entries) {
+        if (bytes <= maxBytes / 10 * 9) {
+            break;
+        }
+        if (fs::remove(entry.path, error)) {
+            bytes -= entry.size;
+        }
+    }
+    return bytes;
+}
+
+BuildCache::Statistics BuildCache::getStatistics() const {
+    Statistics statistics;
+    DirectoryLock lock(pathOf("lock"));
+    Counters counters = readCounters(pathOf("stats"));
+    statistics.hits = counters.hits();
+    statistics.misses = counters.misses();
+    std::error_code error;
+    for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+        if (it->path().extension() == EXTENSION) {
+            ++statistics.entries;
+            statistics.bytes += it->file_size(error);
+        }
+    }
+    return statistics;
+}
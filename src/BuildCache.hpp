@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Finished build outputs on disk, in the spirit of ccache. An entry is keyed
+// by a hash of the main source and the options that shape the output. It
+// lists every file the build included with the hash of its content, so a hit
+// only needs those files read and hashed, and holds the output bytes.
+// Entries are written through a temporary file that is renamed into place;
+// statistics and eviction are serialized by a lock file, so parallel builds
+// can share a directory.
+class BuildCache {
+public:
+    static constexpr uint64_t DEFAULT_MAX_BYTES = 256ull * 1024 * 1024;
+
+    struct Dependency {
+        std::string path;  // absolute
+        uint64_t hash;     // hash() of the content
+    };
+
+    struct Statistics {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    explicit BuildCache(const std::string& directory, uint64_t maxBytes = DEFAULT_MAX_BYTES);
+
+    // 64-bit MurmurHash64A, eight bytes per step. Sources and their includes
+    // are hashed on every build, so this is several times faster than the
+    // byte-wise FNV-1a of the header cache.
+    static uint64_t hash(std::string_view data, uint64_t seed = 0);
+    // Key of a build of source with options, which must name everything
+    // besides the included files that changes the output
+    static uint64_t key(std::string_view options, std::string_view source);
+    // Fills output and returns true if the entry for key exists and none of
+    // its dependencies changed. Counts a hit or a miss.
+    bool find(uint64_t key, std::string& output);
+    // Stores output under key and evicts the least recently used entries
+    // while the cache is larger than its limit
+    void store(uint64_t key, const std::vector<Dependency>& dependencies, std::string_view output);
+    // Counters of every build that used the directory, and its current size
+    Statistics getStatistics() const;
+
+private:
+    std::string directory;
+    uint64_t maxBytes;
+
+    std::string pathOf(uint64_t key) const;
+    std::string pathOf(const char* name) const;
+    void count(bool hit);
+    // Removes the oldest entries until at most 90% of the limit is used and
+    // returns the size left. Called with the lock held.
+    uint64_t evict() const;
+};
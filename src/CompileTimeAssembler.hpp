@@ -0,0 +1,251 @@
+#pragma once
+#include "Encoder.hpp"
+#include "Lexer.hpp"
+#include "OpcodeMap.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Assembles small programs while the C++ compiler runs, so tests and
+// simulators can embed AVR code without the command line tool:
+//
+//     constexpr auto blink = AVR_PROGRAM(R"(
+//         LDI R16, 0x20
+//         OUT 0x04, R16
+//     loop:
+//         RJMP loop
+//     )");
+//
+// blink is a std::array<uint8_t, 6> placed at address 0. Instructions, labels
+// and ';' comments are understood, with the operands, encodings and range
+// checks of the assembler; directives, includes and local labels are not, and
+// branches are never relaxed. Numbers and registers are read by the Lexer's
+// constexpr scanners, and errors have the assembler's messages. An error in
+// the source stops the compilation at the fail() call that names it, e.g.
+// fail(Encoder::outOfRange(...)). Called at run time, the same functions
+// throw SourceError.
+namespace CompileTime {
+    inline constexpr size_t MAX_LABELS = 256;
+
+    // One source line split into its parts, all views into the source
+    struct Line {
+        std::string_view label;
+        std::string_view mnemonic;
+        std::string_view operands[2];
+        uint8_t operandCount;
+        uint32_t number;
+    };
+
+    struct Label {
+        std::string_view name;
+        uint32_t address;  // bytes
+    };
+
+    struct Labels {
+        Label entries[MAX_LABELS];
+        size_t count;
+    };
+
+    // Not constexpr on purpose: reaching it during constant evaluation is the
+    // compile error. Line 0 names no line.
+    [[noreturn]] inline void fail(const std::string& message, uint32_t line) {
+        throw SourceError(message + (line != 0 ? " at line " + std::to_string(line) : ""), line);
+    }
+
+    // For errors the assembler has no message for
+    [[noreturn]] inline void fail(const char* message, std::string_view text, uint32_t line) {
+        fail(message + std::string(text), line);
+    }
+
+    constexpr bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    constexpr std::string_view trim(std::string_view text) {
+        while (!text.empty() && isSpace(text.front())) {
+            text.remove_prefix(1);
+        }
+        while (!text.empty() && isSpace(text.back())) {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
+
+    constexpr size_t identifierLength(std::string_view text) {
+        if (text.empty() || !Lexer::isIdentifierStart(text[0])) {
+            return 0;
+        }
+        size_t length = 1;
+        while (length < text.size() && Lexer::isIdentifierChar(text[length])) {
+            ++length;
+        }
+        return length;
+    }
+
+    // Splits the line starting at pos into line and returns the start of the next one
+    constexpr size_t readLine(std::string_view source, size_t pos, uint32_t number, Line& line) {
+        size_t end = source.find('\n', pos);
+        end = end == std::string_view::npos ? source.size() : end;
+        std::string_view text = source.substr(pos, end - pos);
+        text = trim(text.substr(0, text.find(';')));
+        line = Line{{}, {}, {}, 0, number};
+
+        size_t length = identifierLength(text);
+        std::string_view rest = trim(text.substr(length));
+        if (length != 0 && !rest.empty() && rest[0] == ':') {
+            line.label = text.substr(0, length);
+            text = trim(rest.substr(1));
+            length = identifierLength(text);
+        }
+        if (text.empty()) {
+            return end + 1;
+        }
+        if (length == 0) {
+            fail("Unexpected text: ", text, number);
+        }
+        line.mnemonic = text.substr(0, length);
+
+        // Operands are separated by commas
+        text = trim(text.substr(length));
+        while (!text.empty()) {
+            size_t comma = text.find(',');
+            std::string_view operand = trim(text.substr(0, comma));
+            if (operand.empty()) {
+                fail("Missing operand: ", text, number);
+            }
+            if (line.operandCount == 2) {
+                fail("Too many operands: ", operand, number);
+            }
+            line.operands[line.operandCount++] = operand;
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            text = trim(text.substr(comma + 1));
+            if (text.empty()) {
+                fail("Missing operand after ',' for ", line.mnemonic, number);
+            }
+        }
+        return end + 1;
+    }
+
+    constexpr const Opcodes::Descriptor& lookupInstruction(const Line& line) {
+        const Opcodes::Descriptor* desc = Opcodes::MAP.find(line.mnemonic);
+        if (desc == nullptr) {
+            fail(Encoder::unknownInstruction(line.mnemonic), line.number);
+        }
+        if (line.operandCount != desc->operandCount) {
+            fail(Encoder::wrongOperandCount(*desc), line.number);
+        }
+        return *desc;
+    }
+
+    constexpr const Label* findLabel(const Labels& labels, std::string_view name) {
+        for (size_t i = 0; i < labels.count; ++i) {
+            if (labels.entries[i].name == name) {
+                return &labels.entries[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // First pass: places every label and returns the size of the program
+    constexpr uint32_t layout(std::string_view source, Labels& labels) {
+        uint32_t address = 0;
+        Line line{};
+        uint32_t number = 1;
+        for (size_t pos = 0; pos < source.size(); ++number) {
+            pos = readLine(source, pos, number, line);
+            if (!line.label.empty()) {
+                if (findLabel(labels, line.label) != nullptr) {
+                    fail(Encoder::duplicateLabel(line.label), number);
+                }
+                if (labels.count == MAX_LABELS) {
+                    fail("Too many labels for a compile-time program: ", line.label, number);
+                }
+                labels.entries[labels.count++] = {line.label, address};
+            }
+            if (!line.mnemonic.empty()) {
+                address += lookupInstruction(line).size;
+            }
+        }
+        return address;
+    }
+
+    // Value of one operand, range checked as in Assembler::resolveOperand()
+    constexpr int32_t operandValue(const Opcodes::Descriptor& desc, Opcodes::OperandKind kind, std::string_view text,
+                                   const Labels& labels, uint32_t address, uint32_t number) {
+        int32_t value = 0;
+        switch (kind) {
+            case Opcodes::OperandKind::Register:
+            case Opcodes::OperandKind::UpperRegister:
+                if (!Lexer::parseRegister(text, value)) {
+                    fail(Encoder::invalidRegister(text), number);
+                }
+                break;
+            case Opcodes::OperandKind::Immediate8:
+            case Opcodes::OperandKind::IoAddress:
+                if (!Lexer::parseInteger(text, value)) {
+                    fail(Encoder::expectedNumber(desc, text), number);
+                }
+                break;
+            case Opcodes::OperandKind::PointerX:
+                if (text != "X" && text != "x") {
+                    fail(Encoder::expectedPointerX(desc, text), number);
+                }
+                break;
+            default: {
+                const Label* label = findLabel(labels, text);
+                if (label == nullptr) {
+                    fail(Encoder::unknownLabel(text), number);
+                }
+                value = Encoder::labelValue(kind, label->address, address);
+            }
+        }
+        if (value < Opcodes::operandMin(kind) || value > Opcodes::operandMax(kind)) {
+            fail(Encoder::outOfRange(desc, text), number);
+        }
+        return value;
+    }
+
+    // Size in bytes of the program in source, the N of assemble<N>()
+    constexpr size_t programSize(std::string_view source) {
+        Labels labels{};
+        return layout(source, labels);
+    }
+
+    template <size_t N>
+    constexpr std::array<uint8_t, N> assemble(std::string_view source) {
+        Labels labels{};
+        if (layout(source, labels) != N) {
+            fail("The array size differs from the program size: ", "use programSize()", 0);
+        }
+
+        std::array<uint8_t, N> program{};
+        uint32_t address = 0;
+        Line line{};
+        uint32_t number = 1;
+        for (size_t pos = 0; pos < source.size(); ++number) {
+            pos = readLine(source, pos, number, line);
+            if (line.mnemonic.empty()) {
+                continue;
+            }
+            const Opcodes::Descriptor& desc = lookupInstruction(line);
+            int32_t values[2] = {0, 0};
+            for (uint8_t i = 0; i < desc.operandCount; ++i) {
+                values[i] = operandValue(desc, desc.operands[i], line.operands[i], labels, address, number);
+            }
+            uint8_t bytes[4] = {};
+            Encoder::toBytes(Opcodes::encode(desc, values), desc.size, bytes);
+            for (uint8_t i = 0; i < desc.size; ++i) {
+                program[address + i] = bytes[i];
+            }
+            address += desc.size;
+        }
+        return program;
+    }
+}
+
+// std::array with the machine code of a string literal, sized automatically
+#define AVR_PROGRAM(source) CompileTime::assemble<CompileTime::programSize(source)>(source)
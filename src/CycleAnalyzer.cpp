@@ -0,0 +1,705 @@
+// CycleAnalyzer.cpp
+// Basic blocks, loops, worst-case cycles and stack depth of the resolved code
+
+#include "CycleAnalyzer.hpp"
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+    constexpr size_t NONE = static_cast<size_t>(-1);
+    constexpr uint32_t RETURN_ADDRESS_BYTES = 2;  // 16-bit program counter on the ATmega328
+    constexpr int32_t NOT_VISITED = INT32_MIN;
+
+    bool hasLabelOperand(const Opcodes::Descriptor& desc) {
+        return desc.operandCount == 1 && Opcodes::isLabelOperand(desc.operands[0]);
+    }
+
+    bool isCall(const Opcodes::Descriptor& desc) {
+        return desc.mnemonic == "RCALL" || desc.mnemonic == "CALL";
+    }
+
+    bool isJump(const Opcodes::Descriptor& desc) {
+        return desc.mnemonic == "RJMP" || desc.mnemonic == "JMP";
+    }
+
+    bool isBranch(const Opcodes::Descriptor& desc) {
+        return desc.operands[0] == Opcodes::OperandKind::Relative7;
+    }
+
+    bool endsBlock(const Opcodes::Descriptor& desc) {
+        return isJump(desc) || isBranch(desc) || desc.mnemonic == "RET";
+    }
+
+    bool writesRegister(const Peephole::Instruction& ins, int32_t reg) {
+        static constexpr std::string_view WRITERS[] = {"LDI", "ADD", "SUB", "IN", "LD", "DEC", "CLR", "POP"};
+        const Opcodes::Descriptor& desc = *ins.desc;
+        return std::find(std::begin(WRITERS), std::end(WRITERS), desc.mnemonic) != std::end(WRITERS)
+            && ins.values[0] == reg;
+    }
+
+    uint64_t sum(uint64_t a, uint64_t b) {
+        return a == CycleAnalyzer::UNBOUNDED || b == CycleAnalyzer::UNBOUNDED ? CycleAnalyzer::UNBOUNDED : a + b;
+    }
+
+    // Saturates at UNBOUNDED like sum()
+    uint64_t product(uint64_t a, uint64_t b) {
+        if (a == 0 || b == 0) {
+            return 0;
+        }
+        return a == CycleAnalyzer::UNBOUNDED || b == CycleAnalyzer::UNBOUNDED || a > (CycleAnalyzer::UNBOUNDED - 1) / b
+                   ? CycleAnalyzer::UNBOUNDED
+                   : a * b;
+    }
+
+    std::string hexAddress(uint32_t address) {
+        const char digits[] = "0123456789ABCDEF";
+        std::string text = "0x0000";
+        for (int i = 5; i >= 2; --i) {
+            text[i] = digits[address & 0x0F];
+            address >>= 4;
+        }
+        return text;
+    }
+
+    void writeCycles(std::ostream& out, uint64_t cycles) {
+        if (cycles == CycleAnalyzer::UNBOUNDED) {
+            out << "null";
+        } else {
+            out << cycles;
+        }
+    }
+}
+
+void CycleAnalyzer::setLoopBounds(const std::unordered_map<std::string, uint32_t>& bounds) {
+    loopBounds = bounds;
+}
+
+const std::vector<CycleAnalyzer::Block>& CycleAnalyzer::getBlocks() const {
+    return blocks;
+}
+
+const std::vector<CycleAnalyzer::Loop>& CycleAnalyzer::getLoops() const {
+    return loops;
+}
+
+const std::vector<CycleAnalyzer::Subroutine>& CycleAnalyzer::getSubroutines() const {
+    return subroutines;
+}
+
+const CycleAnalyzer::Subroutine* CycleAnalyzer::findSubroutine(const std::string& name) const {
+    for (const Subroutine& subroutine : subroutines) {
+        if (subroutine.name == name) {
+            return &subroutine;
+        }
+    }
+    return nullptr;
+}
+
+void CycleAnalyzer::run(const std::vector<Peephole::Instruction>& program, const SymbolTable& symbols) {
+    code.clear();
+    indexOf.clear();
+    blocks.clear();
+    loops.clear();
+    subroutines.clear();
+
+    // Several labels on one address are reported under the first in sort
+    // order. Numeric local labels are left out, they name nothing.
+    std::unordered_map<uint32_t, std::string> names;
+    for (uint32_t id = 0; id < symbols.size(); ++id) {
+        const SymbolTable::Symbol& symbol = symbols[id];
+        if (symbol.kind != SymbolTable::Kind::Label || SymbolTable::isLocal(symbol.name)) {
+            continue;
+        }
+        std::string& name = names[static_cast<uint32_t>(symbol.value)];
+        if (name.empty() || symbol.name < name) {
+            name = std::string(symbol.name);
+        }
+    }
+
+    for (const Peephole::Instruction& ins : program) {
+        code.push_back(&ins);
+    }
+    std::sort(code.begin(), code.end(),
+              [](const Peephole::Instruction* a, const Peephole::Instruction* b) { return a->address < b->address; });
+    for (size_t i = 0; i < code.size(); ++i) {
+        indexOf.emplace(code[i]->address, i);
+    }
+    buildBlocks(names);
+
+    // Every run of code placed by .org and every call target is a subroutine
+    work.assign(blocks.size(), Work());
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        if (isEntry[b]) {
+            analyze(b);
+        }
+    }
+    std::sort(subroutines.begin(), subroutines.end(),
+              [](const Subroutine& a, const Subroutine& b) { return a.address < b.address; });
+    std::sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) { return a.address < b.address; });
+}
+
+size_t CycleAnalyzer::blockAt(uint32_t address) const {
+    auto it = indexOf.find(address);
+    if (it == indexOf.end() || firstOf[blockOf[it->second]] != it->second) {
+        return NONE;
+    }
+    return blockOf[it->second];
+}
+
+std::string CycleAnalyzer::nameOf(size_t block) const {
+    return blocks[block].label.empty() ? hexAddress(blocks[block].address) : blocks[block].label;
+}
+
+void CycleAnalyzer::buildBlocks(const std::unordered_map<uint32_t, std::string>& names) {
+    // A block starts at every label, branch target, start of an .org run and
+    // after every jump, branch and return
+    std::vector<bool> leader(code.size(), false);
+    std::vector<bool> runStart(code.size(), false);
+    for (size_t i = 0; i < code.size(); ++i) {
+        const Peephole::Instruction& ins = *code[i];
+        if (i == 0 || code[i - 1]->address + code[i - 1]->desc->size != ins.address) {
+            leader[i] = runStart[i] = true;
+        }
+        if (names.count(ins.address) != 0) {
+            leader[i] = true;
+        }
+        if (hasLabelOperand(*ins.desc)) {
+            auto it = indexOf.find(ins.target);
+            if (it != indexOf.end()) {
+                leader[it->second] = true;
+            }
+        }
+        if (endsBlock(*ins.desc) && i + 1 < code.size()) {
+            leader[i + 1] = true;
+        }
+    }
+
+    blockOf.assign(code.size(), 0);
+    firstOf.clear();
+    for (size_t i = 0; i < code.size(); ++i) {
+        const Peephole::Instruction& ins = *code[i];
+        if (leader[i]) {
+            auto name = names.find(ins.address);
+            blocks.push_back({ins.address, 0, 0, 0, name == names.end() ? std::string() : name->second, {}, {}});
+            firstOf.push_back(i);
+        }
+        Block& block = blocks.back();
+        block.size += ins.desc->size;
+        block.instructions += 1;
+        block.cycles += ins.desc->cycles;
+        blockOf[i] = blocks.size() - 1;
+    }
+
+    isEntry.assign(blocks.size(), false);
+    predecessors.assign(blocks.size(), {});
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        size_t first = firstOf[b];
+        size_t last = b + 1 < blocks.size() ? firstOf[b + 1] - 1 : code.size() - 1;
+        const Peephole::Instruction& ins = *code[last];
+        const Opcodes::Descriptor& desc = *ins.desc;
+        Block& block = blocks[b];
+        isEntry[b] = isEntry[b] || runStart[first];
+
+        bool fallsThrough = last + 1 < code.size() && !runStart[last + 1] && !isJump(desc) && desc.mnemonic != "RET";
+        if (fallsThrough) {
+            block.successors.push_back(b + 1);
+            block.edgeCycles.push_back(0);
+        }
+        if (isJump(desc) || isBranch(desc)) {
+            size_t target = blockAt(ins.target);
+            if (target != NONE) {
+                block.successors.push_back(target);
+                block.edgeCycles.push_back(desc.cyclesTaken - desc.cycles);
+            }
+        }
+        for (size_t i = first; i <= last; ++i) {
+            if (isCall(*code[i]->desc)) {
+                size_t callee = blockAt(code[i]->target);
+                if (callee != NONE) {
+                    isEntry[callee] = true;
+                }
+            }
+        }
+    }
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        for (size_t s : blocks[b].successors) {
+            predecessors[s].push_back(b);
+        }
+    }
+}
+
+size_t CycleAnalyzer::analyze(size_t entry) {
+    if (work[entry].state == State::Done) {
+        return work[entry].subroutine;
+    }
+    if (work[entry].state == State::Running) {
+        return NONE;  // Recursion
+    }
+    work[entry].state = State::Running;
+
+    // Blocks of this subroutine. Jumps into another entry are tail calls.
+    std::vector<bool> inside(blocks.size(), false);
+    std::vector<size_t> members{entry};
+    inside[entry] = true;
+    for (size_t i = 0; i < members.size(); ++i) {
+        for (size_t s : blocks[members[i]].successors) {
+            if (!inside[s] && !(isEntry[s] && s != entry)) {
+                inside[s] = true;
+                members.push_back(s);
+            }
+        }
+    }
+
+    // Callees first, their worst case is part of the cost of every call
+    Subroutine result{nameOf(entry), blocks[entry].address, 0, true, 0, {}};
+    std::vector<uint64_t> cost(blocks.size(), 0);
+    std::vector<uint64_t> tail(blocks.size(), 0);
+    auto wcetOf = [this, &result](size_t callee) {
+        size_t index = analyze(callee);
+        std::string name = nameOf(callee);
+        if (std::find(result.calls.begin(), result.calls.end(), name) == result.calls.end()) {
+            result.calls.push_back(name);
+        }
+        return index == NONE ? UNBOUNDED : subroutines[index].wcet;
+    };
+    for (size_t b : members) {
+        cost[b] = blocks[b].cycles;
+        size_t last = b + 1 < blocks.size() ? firstOf[b + 1] : code.size();
+        for (size_t i = firstOf[b]; i < last; ++i) {
+            if (isCall(*code[i]->desc)) {
+                size_t callee = blockAt(code[i]->target);
+                cost[b] = callee == NONE ? UNBOUNDED : sum(cost[b], wcetOf(callee));
+            }
+        }
+        for (size_t e = 0; e < blocks[b].successors.size(); ++e) {
+            size_t s = blocks[b].successors[e];
+            if (isEntry[s] && s != entry) {
+                tail[b] = std::max(tail[b], sum(blocks[b].edgeCycles[e], wcetOf(s)));
+            }
+        }
+    }
+
+    // Depth-first search for back edges. What is left is acyclic; the
+    // reverse postorder is its topological order.
+    std::unordered_set<uint64_t> backEdges;
+    std::vector<uint8_t> color(blocks.size(), 0);
+    std::vector<size_t> postorder;
+    std::vector<std::pair<size_t, size_t>> stack{{entry, 0}};
+    color[entry] = 1;
+    while (!stack.empty()) {
+        auto& [b, next] = stack.back();
+        if (next == blocks[b].successors.size()) {
+            color[b] = 2;
+            postorder.push_back(b);
+            stack.pop_back();
+            continue;
+        }
+        size_t s = blocks[b].successors[next++];
+        if (!inside[s] || (isEntry[s] && s != entry)) {
+            continue;
+        }
+        if (color[s] == 1) {
+            backEdges.insert(static_cast<uint64_t>(b) << 32 | s);
+        } else if (color[s] == 0) {
+            color[s] = 1;
+            stack.push_back({s, 0});
+        }
+    }
+    auto isBack = [&backEdges](size_t from, size_t to) {
+        return backEdges.count(static_cast<uint64_t>(from) << 32 | to) != 0;
+    };
+
+    // Natural loops, one per header, innermost first
+    std::unordered_map<size_t, std::vector<size_t>> latchesOf;
+    for (uint64_t edge : backEdges) {
+        latchesOf[static_cast<size_t>(edge & 0xFFFFFFFF)].push_back(static_cast<size_t>(edge >> 32));
+    }
+    std::vector<std::pair<size_t, std::vector<size_t>>> bodies;
+    for (auto& [header, latches] : latchesOf) {
+        std::sort(latches.begin(), latches.end());
+        std::vector<size_t> body{header};
+        std::vector<bool> seen(blocks.size(), false);
+        seen[header] = true;
+        for (size_t latch : latches) {
+            if (!seen[latch]) {
+                seen[latch] = true;
+                body.push_back(latch);
+            }
+        }
+        for (size_t i = 1; i < body.size(); ++i) {
+            for (size_t p : predecessors[body[i]]) {
+                if (inside[p] && !seen[p]) {
+                    seen[p] = true;
+                    body.push_back(p);
+                }
+            }
+        }
+        bodies.push_back({header, std::move(body)});
+    }
+    std::sort(bodies.begin(), bodies.end(), [](const auto& a, const auto& b) {
+        return a.second.size() != b.second.size() ? a.second.size() < b.second.size() : a.first < b.first;
+    });
+
+    // Longest path over forward edges, in topological order
+    std::vector<uint64_t> extra(blocks.size(), 0);
+    std::vector<uint64_t> dist(blocks.size(), 0);
+    std::vector<bool> reached(blocks.size(), false);
+    std::vector<bool> inBody(blocks.size(), false);
+    auto longestPath = [&](size_t start, const std::vector<bool>& allowed) {
+        for (size_t b : postorder) {
+            reached[b] = false;
+        }
+        reached[start] = true;
+        dist[start] = sum(cost[start], extra[start]);
+        for (auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+            size_t b = *it;
+            if (!reached[b]) {
+                continue;
+            }
+            for (size_t e = 0; e < blocks[b].successors.size(); ++e) {
+                size_t s = blocks[b].successors[e];
+                if (!allowed[s] || (isEntry[s] && s != entry) || isBack(b, s)) {
+                    continue;
+                }
+                uint64_t length = sum(sum(dist[b], blocks[b].edgeCycles[e]), sum(cost[s], extra[s]));
+                if (!reached[s] || length > dist[s]) {
+                    dist[s] = length;
+                    reached[s] = true;
+                }
+            }
+        }
+    };
+
+    for (const auto& [header, body] : bodies) {
+        for (size_t b : body) {
+            inBody[b] = true;
+        }
+        // One trip starts at the header without its own repetitions
+        uint64_t saved = extra[header];
+        extra[header] = 0;
+        longestPath(header, inBody);
+        const std::vector<size_t>& latches = latchesOf[header];
+        std::vector<uint64_t> trip(latches.size(), 0);  // worst case of a trip back through each latch
+        for (size_t k = 0; k < latches.size(); ++k) {
+            size_t latch = latches[k];
+            for (size_t e = 0; e < blocks[latch].successors.size(); ++e) {
+                if (blocks[latch].successors[e] == header && reached[latch]) {
+                    trip[k] = std::max(trip[k], sum(dist[latch], blocks[latch].edgeCycles[e]));
+                }
+            }
+        }
+        uint64_t iteration = trip.empty() ? 0 : *std::max_element(trip.begin(), trip.end());
+        extra[header] = saved;
+
+        auto given = loopBounds.find(blocks[header].label);
+        std::vector<uint32_t> counters;
+        if (given == loopBounds.end()) {
+            counters = inferBounds(header, inBody, latches);
+        }
+        uint64_t bound = given != loopBounds.end() ? given->second : 0;
+        if (given != loopBounds.end()) {
+            extra[header] = iteration == UNBOUNDED ? UNBOUNDED : iteration * (bound - 1);
+        } else if (!counters.empty()) {
+            // Nested counters: latch k goes back (K_k - 1) times for every run
+            // of the counters outside it, and the loop runs the product of all
+            uint64_t runs = 1;
+            extra[header] = 0;
+            for (size_t k = latches.size(); k-- > 0;) {
+                extra[header] = sum(extra[header], product(trip[k], product(counters[k] - 1, runs)));
+                runs = product(runs, counters[k]);
+            }
+            bound = runs == UNBOUNDED ? 0 : runs;
+        } else {
+            extra[header] = UNBOUNDED;
+        }
+        for (size_t b : body) {
+            inBody[b] = false;
+        }
+
+        bool reported = std::any_of(loops.begin(), loops.end(),
+                                    [this, header](const Loop& loop) { return loop.address == blocks[header].address; });
+        if (!reported) {
+            loops.push_back({nameOf(header), blocks[header].address, result.name, iteration, bound});
+        }
+    }
+
+    // Worst case of the whole subroutine: the longest path to any exit.
+    // UNBOUNDED is the largest value, so it wins every comparison.
+    longestPath(entry, inside);
+    for (size_t b : members) {
+        if (reached[b]) {
+            result.wcet = std::max(result.wcet, sum(dist[b], tail[b]));
+        }
+    }
+
+    result.stackBounded = stackDepth(entry, inside, result.stackBytes);
+    work[entry] = {State::Done, subroutines.size()};
+    subroutines.push_back(std::move(result));
+    return work[entry].subroutine;
+}
+
+std::vector<uint32_t> CycleAnalyzer::inferBounds(size_t header, const std::vector<bool>& body,
+                                                 const std::vector<size_t>& latches) const {
+    // Recognizes nested counter loops sharing one header: every latch ends
+    // with DEC Rn, then only LDI or NOP, then BRNE, and falls through to the
+    // next latch. Rn is set by LDI before the loop and reloaded by LDI on the
+    // enclosing latches, and nothing else in the loop writes it or calls.
+    // Latches are in address order, innermost first.
+    std::vector<int32_t> regs;
+    std::vector<size_t> decs;
+    for (size_t k = 0; k < latches.size(); ++k) {
+        size_t latch = latches[k];
+        size_t last = latch + 1 < blocks.size() ? firstOf[latch + 1] - 1 : code.size() - 1;
+        if (code[last]->desc->mnemonic != "BRNE" || code[last]->target != blocks[header].address) {
+            return {};
+        }
+        size_t dec = last;
+        while (dec > firstOf[latch] && (code[dec - 1]->desc->mnemonic == "LDI" || code[dec - 1]->desc->mnemonic == "NOP")) {
+            --dec;
+        }
+        if (dec == firstOf[latch] || code[--dec]->desc->mnemonic != "DEC") {
+            return {};
+        }
+        int32_t reg = code[dec]->values[0];
+        if (std::find(regs.begin(), regs.end(), reg) != regs.end()) {
+            return {};
+        }
+        if (k + 1 < latches.size()) {
+            // The next counter only counts once this one ran out
+            size_t outer = latches[k + 1];
+            if (predecessors[outer].size() != 1 || predecessors[outer][0] != latch) {
+                return {};
+            }
+        }
+        regs.push_back(reg);
+        decs.push_back(dec);
+    }
+
+    // Only the DEC and reloads on the enclosing latches may write a counter
+    auto latchIndex = [&latches](size_t block) {
+        auto it = std::find(latches.begin(), latches.end(), block);
+        return it == latches.end() ? NONE : static_cast<size_t>(it - latches.begin());
+    };
+    std::vector<uint32_t> bounds(latches.size(), 0);
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        if (!body[b]) {
+            continue;
+        }
+        size_t outer = latchIndex(b);
+        size_t end = b + 1 < blocks.size() ? firstOf[b + 1] : code.size();
+        for (size_t i = firstOf[b]; i < end; ++i) {
+            if (isCall(*code[i]->desc)) {
+                return {};
+            }
+            for (size_t k = 0; k < regs.size(); ++k) {
+                if (i == decs[k] || !writesRegister(*code[i], regs[k])) {
+                    continue;
+                }
+                if (outer == NONE || outer <= k || code[i]->desc->mnemonic != "LDI") {
+                    return {};
+                }
+                uint32_t value = code[i]->values[1] == 0 ? 256 : static_cast<uint32_t>(code[i]->values[1]);
+                bounds[k] = std::max(bounds[k], value);
+            }
+        }
+    }
+    // Without a reload on the next latch a counter starts again from 0,
+    // which DEC wraps to 255
+    for (size_t k = 0; k + 1 < latches.size(); ++k) {
+        size_t end = latches[k + 1] + 1 < blocks.size() ? firstOf[latches[k + 1] + 1] : code.size();
+        bool reloaded = false;
+        for (size_t i = firstOf[latches[k + 1]]; i < end; ++i) {
+            reloaded = reloaded || writesRegister(*code[i], regs[k]);
+        }
+        if (!reloaded) {
+            bounds[k] = 256;
+        }
+    }
+
+    size_t preheader = NONE;
+    for (size_t p : predecessors[header]) {
+        if (!body[p]) {
+            if (preheader != NONE) {
+                return {};
+            }
+            preheader = p;
+        }
+    }
+    if (preheader == NONE) {
+        return {};
+    }
+    size_t end = preheader + 1 < blocks.size() ? firstOf[preheader + 1] : code.size();
+    for (size_t k = 0; k < regs.size(); ++k) {
+        bool loaded = false;
+        for (size_t i = end; i-- > firstOf[preheader] && !loaded;) {
+            if (writesRegister(*code[i], regs[k])) {
+                if (code[i]->desc->mnemonic != "LDI") {
+                    return {};
+                }
+                uint32_t value = code[i]->values[1] == 0 ? 256 : static_cast<uint32_t>(code[i]->values[1]);
+                bounds[k] = std::max(bounds[k], value);
+                loaded = true;
+            }
+        }
+        if (!loaded) {
+            return {};
+        }
+    }
+    return bounds;
+}
+
+bool CycleAnalyzer::stackDepth(size_t entry, const std::vector<bool>& inside, uint32_t& maxDepth) {
+    // Every path into a block must arrive with the same depth, otherwise a
+    // loop pushes without popping and the depth has no bound
+    std::vector<int32_t> depthAt(blocks.size(), NOT_VISITED);
+    std::vector<std::pair<size_t, int32_t>> pending{{entry, 0}};
+    int64_t deepest = 0;
+    auto calleeStack = [this](size_t callee, int64_t& bytes) {
+        size_t index = callee == NONE || work[callee].state != State::Done ? NONE : work[callee].subroutine;
+        if (index == NONE || !subroutines[index].stackBounded) {
+            return false;
+        }
+        bytes = subroutines[index].stackBytes;
+        return true;
+    };
+
+    while (!pending.empty()) {
+        auto [b, depth] = pending.back();
+        pending.pop_back();
+        if (depthAt[b] != NOT_VISITED) {
+            if (depthAt[b] != depth) {
+                return false;
+            }
+            continue;
+        }
+        depthAt[b] = depth;
+
+        size_t end = b + 1 < blocks.size() ? firstOf[b + 1] : code.size();
+        for (size_t i = firstOf[b]; i < end; ++i) {
+            const Opcodes::Descriptor& desc = *code[i]->desc;
+            if (desc.mnemonic == "PUSH") {
+                ++depth;
+            } else if (desc.mnemonic == "POP") {
+                --depth;
+            } else if (isCall(desc)) {
+                int64_t bytes = 0;
+                if (!calleeStack(blockAt(code[i]->target), bytes)) {
+                    return false;
+                }
+                deepest = std::max(deepest, depth + RETURN_ADDRESS_BYTES + bytes);
+            }
+            deepest = std::max<int64_t>(deepest, depth);
+        }
+        for (size_t s : blocks[b].successors) {
+            if (isEntry[s] && s != entry) {
+                int64_t bytes = 0;
+                if (!calleeStack(s, bytes)) {
+                    return false;
+                }
+                deepest = std::max(deepest, depth + bytes);
+            } else if (inside[s]) {
+                pending.push_back({s, depth});
+            }
+        }
+    }
+    maxDepth = static_cast<uint32_t>(deepest);
+    return true;
+}
+
+void CycleAnalyzer::writeText(std::ostream& out) const {
+    out << "Blocks:\n";
+    for (const Block& block : blocks) {
+        out << "  " << hexAddress(block.address) << "  " << block.cycles << " cycles, "
+            << block.instructions << " instruction(s)";
+        if (!block.label.empty()) {
+            out << "  " << block.label;
+        }
+        out << "\n";
+    }
+    out << "Loops:\n";
+    for (const Loop& loop : loops) {
+        out << "  " << loop.header << " in " << loop.subroutine << ": ";
+        if (loop.iterationCycles == UNBOUNDED) {
+            out << "unbounded";
+        } else {
+            out << loop.iterationCycles;
+        }
+        out << " cycles per iteration, bound ";
+        if (loop.bound == 0) {
+            out << "unknown\n";
+        } else {
+            out << loop.bound << "\n";
+        }
+    }
+    out << "Subroutines:\n";
+    for (const Subroutine& subroutine : subroutines) {
+        out << "  " << subroutine.name << " (" << hexAddress(subroutine.address) << "): WCET ";
+        if (subroutine.wcet == UNBOUNDED) {
+            out << "unbounded";
+        } else {
+            out << subroutine.wcet << " cycles";
+        }
+        out << ", stack ";
+        if (subroutine.stackBounded) {
+            out << subroutine.stackBytes << " bytes";
+        } else {
+            out << "unbounded";
+        }
+        if (!subroutine.calls.empty()) {
+            out << ", calls";
+            for (const std::string& call : subroutine.calls) {
+                out << " " << call;
+            }
+        }
+        out << "\n";
+    }
+}
+
+void CycleAnalyzer::writeJson(std::ostream& out) const {
+    // Labels are identifiers, so nothing needs escaping
+    out << "{\n  \"blocks\": [";
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        const Block& block = blocks[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"address\": " << block.address << ", \"label\": ";
+        if (block.label.empty()) {
+            out << "null";
+        } else {
+            out << "\"" << block.label << "\"";
+        }
+        out << ", \"size\": " << block.size << ", \"instructions\": " << block.instructions
+            << ", \"cycles\": " << block.cycles << "}";
+    }
+    out << "\n  ],\n  \"loops\": [";
+    for (size_t i = 0; i < loops.size(); ++i) {
+        const Loop& loop = loops[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"header\": \"" << loop.header << "\", \"address\": " << loop.address
+            << ", \"subroutine\": \"" << loop.subroutine << "\", \"iterationCycles\": ";
+        writeCycles(out, loop.iterationCycles);
+        out << ", \"bound\": ";
+        if (loop.bound == 0) {
+            out << "null";
+        } else {
+            out << loop.bound;
+        }
+        out << "}";
+    }
+    out << "\n  ],\n  \"subroutines\": [";
+    for (size_t i = 0; i < subroutines.size(); ++i) {
+        const Subroutine& subroutine = subroutines[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << subroutine.name << "\", \"address\": "
+            << subroutine.address << ", \"wcet\": ";
+        writeCycles(out, subroutine.wcet);
+        out << ", \"stackBytes\": ";
+        if (subroutine.stackBounded) {
+            out << subroutine.stackBytes;
+        } else {
+            out << "null";
+        }
+        out << ", \"calls\": [";
+        for (size_t c = 0; c < subroutine.calls.size(); ++c) {
+            out << (c == 0 ? "\"" : ", \"") << subroutine.calls[c] << "\"";
+        }
+        out << "]}";
+    }
+    out << "\n  ]\n}\n";
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "Peephole.hpp"
+#include "SymbolTable.hpp"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Static timing analysis of the resolved code. Splits it into basic blocks,
+// finds loops and subroutines, and computes worst-case cycles and stack depth
+// from the cycle counts in Opcodes::TABLE.
+class CycleAnalyzer {
+public:
+    static constexpr uint64_t UNBOUNDED = UINT64_MAX;
+
+    struct Block {
+        uint32_t address;
+        uint32_t size;                    // bytes
+        uint32_t instructions;
+        uint32_t cycles;                  // straight through, branches not taken
+        std::string label;                // empty if no label points here
+        std::vector<size_t> successors;   // block indices
+        std::vector<uint32_t> edgeCycles; // extra cycles of each successor edge
+    };
+
+    struct Loop {
+        std::string header;               // label of the loop header
+        uint32_t address;
+        std::string subroutine;
+        uint64_t iterationCycles;         // worst case for one trip around the loop
+        uint64_t bound;                   // maximum iterations, 0 if unknown
+    };
+
+    struct Subroutine {
+        std::string name;
+        uint32_t address;
+        uint64_t wcet;                    // UNBOUNDED for unknown loop bounds or recursion
+        bool stackBounded;
+        uint32_t stackBytes;              // deepest stack use, including called code
+        std::vector<std::string> calls;
+    };
+
+    // Loop headers without a recognizable counter get their bound from
+    // loopBounds, keyed by label
+    void setLoopBounds(const std::unordered_map<std::string, uint32_t>& bounds);
+    void run(const std::vector<Peephole::Instruction>& program, const SymbolTable& symbols);
+
+    const std::vector<Block>& getBlocks() const;
+    const std::vector<Loop>& getLoops() const;
+    const std::vector<Subroutine>& getSubroutines() const;
+    // Returns nullptr if no subroutine has that name
+    const Subroutine* findSubroutine(const std::string& name) const;
+
+    void writeText(std::ostream& out) const;
+    void writeJson(std::ostream& out) const;
+
+private:
+    enum class State : uint8_t { Pending, Running, Done };
+
+    struct Work {
+        State state = State::Pending;
+        size_t subroutine = 0;
+    };
+
+    std::unordered_map<std::string, uint32_t> loopBounds;
+    std::vector<const Peephole::Instruction*> code;  // sorted by address
+    std::vector<size_t> blockOf;                      // code index -> block
+    std::vector<size_t> firstOf;                      // block -> first code index
+    std::vector<std::vector<size_t>> predecessors;
+    std::vector<bool> isEntry;
+    std::vector<Work> work;                           // per entry block
+    std::unordered_map<uint32_t, size_t> indexOf;     // address -> code index
+    std::vector<Block> blocks;
+    std::vector<Loop> loops;
+    std::vector<Subroutine> subroutines;
+
+    void buildBlocks(const std::unordered_map<uint32_t, std::string>& names);
+    size_t blockAt(uint32_t address) const;
+    std::string nameOf(size_t block) const;
+    size_t analyze(size_t entry);
+    // Start value of the counter behind each latch, empty if not a counter loop
+    std::vector<uint32_t> inferBounds(size_t header, const std::vector<bool>& body,
+                                      const std::vector<size_t>& latches) const;
+    bool stackDepth(size_t entry, const std::vector<bool>& inside, uint32_t& maxDepth);
+};
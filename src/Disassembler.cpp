@@ -0,0 +1,242 @@
+// Disassembler.cpp
+// Table-driven decoding of flash images
+
+#include "Disassembler.hpp"
+#include "Encoder.hpp"
+#include <algorithm>
+#include <array>
+
+namespace {
+    constexpr uint8_t NO_INSTRUCTION = 0xFF;
+
+    // TABLE index per first word. Every descriptor claims the words its
+    // variable bits can produce; the first descriptor wins, as in a linear
+    // search over TABLE.
+    std::array<uint8_t, 0x10000> buildDecodeTable() {
+        std::array<uint8_t, 0x10000> table;
+        table.fill(NO_INSTRUCTION);
+        for (size_t i = 0; i < Opcodes::TABLE_SIZE; ++i) {
+            const Opcodes::Descriptor& desc = Opcodes::TABLE[i];
+            uint32_t shift = desc.size == 4 ? 16 : 0;
+            uint32_t variable = 0;
+            for (uint8_t f = 0; f < desc.fieldCount; ++f) {
+                variable |= desc.fields[f].mask;
+            }
+            uint32_t fixed = (desc.opcode >> shift) & 0xFFFF;
+            uint32_t mask = (variable >> shift) & 0xFFFF;
+            // Walk every subset of the variable bits of the first word
+            for (uint32_t bits = 0;; bits = (bits - mask) & mask) {
+                uint32_t word = fixed | bits;
+                int32_t values[2];
+                if (table[word] == NO_INSTRUCTION && Opcodes::decode(desc, word << shift, values)) {
+                    table[word] = static_cast<uint8_t>(i);
+                }
+                if (bits == mask) {
+                    break;
+                }
+            }
+        }
+        return table;
+    }
+
+    void appendDigits(std::string& out, uint32_t value, int digits) {
+        const char* hex = "0123456789ABCDEF";
+        for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+            out += hex[(value >> shift) & 0xF];
+        }
+    }
+
+    void appendHex(std::string& out, uint32_t value, int digits) {
+        out += "0x";
+        appendDigits(out, value, digits);
+    }
+
+    bool isBranch(const Opcodes::Descriptor& desc) {
+        return desc.operandCount == 1 && Opcodes::isLabelOperand(desc.operands[0]);
+    }
+}
+
+const Opcodes::Descriptor* Disassembler::lookup(uint16_t word) {
+    static const std::array<uint8_t, 0x10000> table = buildDecodeTable();
+    uint8_t index = table[word];
+    return index == NO_INSTRUCTION ? nullptr : &Opcodes::TABLE[index];
+}
+
+void Disassembler::run(const MemoryImage& image) {
+    instructions.clear();
+    targets.clear();
+    for (const MemoryImage::Segment& segment : image.getSegments()) {
+        decode(segment);
+    }
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+    // A target in the second word of a JMP/CALL or past the flash can't get a
+    // label. Data often decodes as such branches; they are written as .dw.
+    unlabelled.clear();
+    for (const Instruction& ins : instructions) {
+        if (ins.desc != nullptr && ins.desc->size == 4
+            && std::binary_search(targets.begin(), targets.end(), ins.address + 2)) {
+            unlabelled.push_back(ins.address + 2);
+        }
+    }
+    for (auto it = std::upper_bound(targets.begin(), targets.end(), Assembler::FLASH_SIZE); it != targets.end(); ++it) {
+        unlabelled.push_back(*it);
+    }
+    std::sort(unlabelled.begin(), unlabelled.end());
+    targets.erase(std::remove_if(targets.begin(), targets.end(),
+                                 [this](uint32_t target) {
+                                     return std::binary_search(unlabelled.begin(), unlabelled.end(), target);
+                                 }),
+                  targets.end());
+    writeListing(image);
+}
+
+const std::vector<Disassembler::Instruction>& Disassembler::getInstructions() const {
+    return instructions;
+}
+
+const std::string& Disassembler::getListing() const {
+    return listing;
+}
+
+void Disassembler::decode(const MemoryImage::Segment& segment) {
+    const std::vector<uint8_t>& data = segment.data;
+    for (size_t i = 0; i < data.size(); i += 2) {
+        // A trailing odd byte reads as if the missing byte were erased
+        uint16_t word = static_cast<uint16_t>(data[i] | (i + 1 < data.size() ? data[i + 1] : 0xFF) << 8);
+        uint32_t address = segment.address + static_cast<uint32_t>(i);
+        Instruction ins{address, lookup(word), {0, 0}, word};
+        if (ins.desc != nullptr && ins.desc->size == 4) {
+            if (i + 3 >= data.size()) {
+                ins.desc = nullptr;  // Second word is missing
+            } else {
+                uint32_t code = static_cast<uint32_t>(word) << 16 | data[i + 2] | data[i + 3] << 8;
+                Opcodes::decode(*ins.desc, code, ins.values);
+                i += 2;
+            }
+        } else if (ins.desc != nullptr) {
+            Opcodes::decode(*ins.desc, word, ins.values);
+        }
+        if (ins.desc != nullptr && isBranch(*ins.desc)) {
+            targets.push_back(Encoder::labelTarget(ins.desc->operands[0], ins.values[0], address));
+        }
+        instructions.push_back(ins);
+    }
+}
+
+void Disassembler::writeLabel(uint32_t address) {
+    listing += "L_";
+    appendDigits(listing, address, address > 0xFFFF ? 6 : 4);
+}
+
+void Disassembler::writeListing(const MemoryImage& image) {
+    listing.clear();
+    listing.reserve(instructions.size() * 24 + targets.size() * 16 + 64);
+    listing += "; Disassembled by ATmega328Compiler\n";
+
+    // Targets outside the code get a label of their own in the gap
+    size_t target = 0;
+    auto placeLabelsBefore = [&](uint32_t end) {
+        for (; target < targets.size() && targets[target] < end; ++target) {
+            listing += ".org ";
+            appendHex(listing, targets[target] / 2, 4);
+            listing += "\n";
+            writeLabel(targets[target]);
+            listing += ":\n";
+        }
+    };
+
+    size_t next = 0;
+    for (const MemoryImage::Segment& segment : image.getSegments()) {
+        placeLabelsBefore(segment.address);
+        listing += ".org ";
+        appendHex(listing, segment.address / 2, 4);
+        listing += "\n";
+        for (; next < instructions.size() && instructions[next].address < segment.end(); ++next) {
+            const Instruction& ins = instructions[next];
+            for (; target < targets.size() && targets[target] <= ins.address; ++target) {
+                if (targets[target] == ins.address) {
+                    writeLabel(ins.address);
+                    listing += ":\n";
+                }
+            }
+            if (ins.desc == nullptr) {
+                listing += "    .dw ";
+                appendHex(listing, ins.word, 4);
+                listing += "\n";
+                continue;
+            }
+            if (isBranch(*ins.desc)
+                && std::binary_search(unlabelled.begin(), unlabelled.end(),
+                                      Encoder::labelTarget(ins.desc->operands[0], ins.values[0], ins.address))) {
+                uint32_t code = Opcodes::encode(*ins.desc, ins.values);
+                listing += "    .dw ";
+                if (ins.desc->size == 4) {
+                    appendHex(listing, code >> 16, 4);
+                    listing += ", ";
+                }
+                appendHex(listing, code & 0xFFFF, 4);
+                listing += "\n";
+                continue;
+            }
+
+            listing += "    ";
+            listing.append(ins.desc->mnemonic.data(), ins.desc->mnemonic.size());
+            for (uint8_t i = 0; i < ins.desc->operandCount; ++i) {
+                listing += i == 0 ? " " : ", ";
+                int32_t value = ins.values[i];
+                switch (ins.desc->operands[i]) {
+                    case Opcodes::OperandKind::Register:
+                    case Opcodes::OperandKind::UpperRegister:
+                        listing += 'R';
+                        if (value >= 10) {
+                            listing += static_cast<char>('0' + value / 10);
+                        }
+                        listing += static_cast<char>('0' + value % 10);
+                        break;
+                    case Opcodes::OperandKind::PointerX:
+                        listing += "X";
+                        break;
+                    case Opcodes::OperandKind::Absolute22:
+                    case Opcodes::OperandKind::Relative12:
+                    case Opcodes::OperandKind::Relative7:
+                        writeLabel(Encoder::labelTarget(ins.desc->operands[i], value, ins.address));
+                        break;
+                    default:
+                        appendHex(listing, static_cast<uint32_t>(value), 2);
+                        break;
+                }
+            }
+            listing += "\n";
+        }
+    }
+    placeLabelsBefore(UINT32_MAX);
+}
+
+std::string Disassembler::roundTrip(const MemoryImage& image) {
+    run(image);
+    if (!assembler.assemble(listing)) {
+        const Assembler::Diagnostic& diagnostic = assembler.getDiagnostics().front();
+        return "Disassembly does not assemble: " + diagnostic.message;
+    }
+
+    const std::vector<MemoryImage::Segment>& original = image.getSegments();
+    const std::vector<MemoryImage::Segment>& copy = assembler.getImage().getSegments();
+    for (size_t i = 0; i < original.size() || i < copy.size(); ++i) {
+        if (i == original.size() || i == copy.size() || original[i].address != copy[i].address) {
+            std::string message = "Round trip moved code at ";
+            appendHex(message, (i < original.size() ? original[i] : copy[i]).address, 4);
+            return message;
+        }
+        const std::vector<uint8_t>& a = original[i].data;
+        const std::vector<uint8_t>& b = copy[i].data;
+        auto mismatch = std::mismatch(a.begin(), a.end(), b.begin(), b.end());
+        if (mismatch.first != a.end() || mismatch.second != b.end()) {
+            std::string message = "Round trip changed the code at ";
+            appendHex(message, original[i].address + static_cast<uint32_t>(mismatch.first - a.begin()), 4);
+            return message;
+        }
+    }
+    return std::string();
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "Assembler.hpp"
+#include "MemoryImage.hpp"
+#include "OpcodeMap.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Turns a flash image back into source the assembler accepts. Instructions
+// are found through a 65536-entry table indexed by the first opcode word and
+// decoded with the encoder's own descriptors. Branch and jump targets get
+// L_<address> labels.
+class Disassembler {
+public:
+    struct Instruction {
+        uint32_t address;                 // byte address
+        const Opcodes::Descriptor* desc;  // nullptr for a word that is no instruction
+        int32_t values[2];
+        uint16_t word;                    // first word
+    };
+
+    // Descriptor of the instruction whose first word is word, or nullptr. The
+    // table is built on first use and shared by every thread.
+    static const Opcodes::Descriptor* lookup(uint16_t word);
+
+    // Decodes every segment of image and writes the listing
+    void run(const MemoryImage& image);
+    const std::vector<Instruction>& getInstructions() const;
+    const std::string& getListing() const;
+
+    // Disassembles image, assembles the listing again and compares the two
+    // images. Returns an empty string if they match, otherwise what differs.
+    std::string roundTrip(const MemoryImage& image);
+
+private:
+    std::vector<Instruction> instructions;
+    std::vector<uint32_t> targets;  // sorted byte addresses that get a label
+    std::vector<uint32_t> unlabelled;  // sorted targets no label can mark
+    std::string listing;
+    Assembler assembler;            // reused by every roundTrip() call
+
+    void decode(const MemoryImage::Segment& segment);
+    void writeListing(const MemoryImage& image);
+    void writeLabel(uint32_t address);
+};
@@ -0,0 +1,106 @@
+// Encoder.cpp
+// Operand resolution shared by the assembler front ends
+
+#include "Encoder.hpp"
+#include <stdexcept>
+
+namespace Encoder {
+
+std::string location(const Token& token) {
+    return " at line " + std::to_string(token.line);
+}
+
+std::string programTooLarge(std::string_view statement, uint32_t overflow) {
+    return "Program too large: " + std::string(statement) + " ends " + std::to_string(overflow)
+           + " bytes past the end of the flash";
+}
+
+std::string unknownInstruction(std::string_view mnemonic) {
+    return "Unknown instruction: " + std::string(mnemonic);
+}
+
+std::string wrongOperandCount(const Opcodes::Descriptor& desc) {
+    return std::string(desc.mnemonic) + " expects " + std::to_string(desc.operandCount) + " operand(s)";
+}
+
+std::string invalidRegister(std::string_view operand) {
+    return "Invalid register format: " + std::string(operand);
+}
+
+std::string expectedNumber(const Opcodes::Descriptor& desc, std::string_view operand) {
+    return "Expected a number for " + std::string(desc.mnemonic) + ": " + std::string(operand);
+}
+
+std::string expectedPointerX(const Opcodes::Descriptor& desc, std::string_view operand) {
+    return std::string(desc.mnemonic) + " only supports the X pointer. Found: " + std::string(operand);
+}
+
+std::string outOfRange(const Opcodes::Descriptor& desc, std::string_view operand) {
+    return std::string(desc.mnemonic) + " operand out of range: " + std::string(operand);
+}
+
+std::string unknownLabel(std::string_view name) {
+    return "Unknown label: " + std::string(name);
+}
+
+std::string duplicateLabel(std::string_view name) {
+    return "Duplicate label: " + std::string(name);
+}
+
+bool isDirective(const Token& token, std::string_view name) {
+    if (token.text.size() != name.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < name.size(); ++i) {
+        char c = token.text[i];
+        if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != name[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const Opcodes::Descriptor& lookupInstruction(const Statement& stmt) {
+    const Token& mnemonic = *stmt.mnemonic;
+    const Opcodes::Descriptor* desc = Opcodes::MAP.find(mnemonic.text);
+    if (desc == nullptr) {
+        throw SourceError(unknownInstruction(mnemonic.text) + location(mnemonic), mnemonic);
+    }
+    if (stmt.operandCount != desc->operandCount) {
+        throw SourceError(wrongOperandCount(*desc) + location(mnemonic), mnemonic);
+    }
+    return *desc;
+}
+
+int32_t operandValue(const Opcodes::Descriptor& desc, Opcodes::OperandKind kind, const Token& operand) {
+    switch (kind) {
+        case Opcodes::OperandKind::Register:
+        case Opcodes::OperandKind::UpperRegister:
+            if (operand.kind != TokenKind::Register) {
+                throw SourceError(invalidRegister(operand.text) + location(operand), operand);
+            }
+            return operand.value;
+        case Opcodes::OperandKind::Immediate8:
+        case Opcodes::OperandKind::IoAddress:
+            if (operand.kind != TokenKind::Integer) {
+                throw SourceError(expectedNumber(desc, operand.text) + location(operand), operand);
+            }
+            return operand.value;
+        case Opcodes::OperandKind::PointerX:
+            if (operand.text != "X" && operand.text != "x") {
+                throw SourceError(expectedPointerX(desc, operand.text) + location(operand), operand);
+            }
+            return 0;
+        default:
+            throw SourceError(std::string(desc.mnemonic) + " expects a label: "
+                              + std::string(operand.text) + location(operand), operand);
+    }
+}
+
+void checkRange(const Opcodes::Descriptor& desc, Opcodes::OperandKind kind, int32_t value, const Token& operand) {
+    if (value < Opcodes::operandMin(kind) || value > Opcodes::operandMax(kind)) {
+        throw SourceError(outOfRange(desc, operand.text) + location(operand), operand);
+    }
+}
+
+}
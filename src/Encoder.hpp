@@ -0,0 +1,70 @@
+#pragma once
+#include "Lexer.hpp"
+#include "OpcodeMap.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Operand helpers shared by every front end that feeds Opcodes::encode().
+// The label and byte helpers are constexpr for CompileTimeAssembler.hpp,
+// which also takes its error messages from here.
+namespace Encoder {
+    // " at line N" suffix for error messages
+    std::string location(const Token& token);
+
+    // Error for the statement that leaves the flash, without the location;
+    // overflow is how many bytes it ends past the end
+    std::string programTooLarge(std::string_view statement, uint32_t overflow);
+
+    // Messages of the checks below, without the location
+    std::string unknownInstruction(std::string_view mnemonic);
+    std::string wrongOperandCount(const Opcodes::Descriptor& desc);
+    std::string invalidRegister(std::string_view operand);
+    std::string expectedNumber(const Opcodes::Descriptor& desc, std::string_view operand);
+    std::string expectedPointerX(const Opcodes::Descriptor& desc, std::string_view operand);
+    std::string outOfRange(const Opcodes::Descriptor& desc, std::string_view operand);
+    std::string unknownLabel(std::string_view name);
+    std::string duplicateLabel(std::string_view name);
+
+    // Case-insensitive match of a directive token, name in lower case
+    bool isDirective(const Token& token, std::string_view name);
+
+    // Descriptor of the statement's instruction. Throws SourceError on an
+    // unknown mnemonic or the wrong number of operands.
+    const Opcodes::Descriptor& lookupInstruction(const Statement& stmt);
+
+    // Checks the token of a register, immediate or pointer operand and returns
+    // its value. Throws std::runtime_error on a token of the wrong kind.
+    int32_t operandValue(const Opcodes::Descriptor& desc, Opcodes::OperandKind kind, const Token& operand);
+    // Throws SourceError unless value fits the operand field
+    void checkRange(const Opcodes::Descriptor& desc, Opcodes::OperandKind kind, int32_t value, const Token& operand);
+
+    // Value of a label operand: the word address for JMP/CALL, otherwise the
+    // word distance from the instruction following address
+    constexpr int32_t labelValue(Opcodes::OperandKind kind, uint32_t target, uint32_t address) {
+        if (kind == Opcodes::OperandKind::Absolute22) {
+            return static_cast<int32_t>(target / 2);  // Word address
+        }
+        // Relative word distance from the following instruction
+        return (static_cast<int32_t>(target) - static_cast<int32_t>(address + 2)) / 2;
+    }
+
+    // Inverse of labelValue(): the byte address a label operand refers to
+    constexpr uint32_t labelTarget(Opcodes::OperandKind kind, int32_t value, uint32_t address) {
+        if (kind == Opcodes::OperandKind::Absolute22) {
+            return static_cast<uint32_t>(value) * 2;
+        }
+        return static_cast<uint32_t>(static_cast<int32_t>(address + 2) + value * 2);
+    }
+
+    // Little-endian bytes of an encoded instruction, first word first
+    constexpr void toBytes(uint32_t opcode, uint8_t size, uint8_t* bytes) {
+        // Two-word instructions keep their first word in the upper half
+        if (size == 4) {
+            *bytes++ = (opcode >> 16) & 0xFF;
+            *bytes++ = (opcode >> 24) & 0xFF;
+        }
+        bytes[0] = opcode & 0xFF;
+        bytes[1] = (opcode >> 8) & 0xFF;
+    }
+}
@@ -0,0 +1,85 @@
+// FlashDelta.cpp
+// Page-wise comparison of flash images
+
+#include "FlashDelta.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    // Every page that holds a byte of image, appended in ascending order
+    void occupiedPages(const MemoryImage& image, uint32_t pageSize, std::vector<uint32_t>& pages) {
+        for (const MemoryImage::Segment& segment : image.getSegments()) {
+            uint32_t first = segment.address / pageSize * pageSize;
+            if (!pages.empty() && pages.back() >= first) {
+                first = pages.back() + pageSize;
+            }
+            for (uint32_t page = first; page < segment.end(); page += pageSize) {
+                pages.push_back(page);
+            }
+        }
+    }
+}
+
+namespace FlashDelta {
+
+std::vector<uint32_t> changedPages(const MemoryImage& before, const MemoryImage& after, uint32_t pageSize) {
+    // Pages neither image touches are erased in both
+    std::vector<uint32_t> candidates;
+    occupiedPages(before, pageSize, candidates);
+    size_t middle = candidates.size();
+    occupiedPages(after, pageSize, candidates);
+    std::inplace_merge(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(middle), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    std::vector<uint32_t> pages;
+    std::vector<uint8_t> a(pageSize), b(pageSize);
+    for (uint32_t page : candidates) {
+        before.read(page, a.data(), pageSize);
+        after.read(page, b.data(), pageSize);
+        if (std::memcmp(a.data(), b.data(), pageSize) != 0) {
+            pages.push_back(page);
+        }
+    }
+    return pages;
+}
+
+MemoryImage extract(const MemoryImage& after, const std::vector<uint32_t>& pages, uint32_t pageSize) {
+    MemoryImage delta;
+    std::vector<uint8_t> bytes(pageSize);
+    for (uint32_t page : pages) {
+        after.read(page, bytes.data(), pageSize);
+        delta.write(page, bytes.data(), pageSize);
+    }
+    return delta;
+}
+
+void writePageList(const MemoryImage& after, const std::vector<uint32_t>& pages, std::string& out,
+                   uint32_t pageSize) {
+    out.reserve(out.size() + pages.size() * (2 + pageSize));
+    std::vector<uint8_t> bytes(pageSize);
+    for (uint32_t page : pages) {
+        uint32_t number = page / pageSize;
+        out.push_back(static_cast<char>(number & 0xFF));
+        out.push_back(static_cast<char>((number >> 8) & 0xFF));
+        after.read(page, bytes.data(), pageSize);
+        out.append(reinterpret_cast<const char*>(bytes.data()), pageSize);
+    }
+}
+
+std::string describe(const std::vector<uint32_t>& pages, uint32_t pageSize) {
+    std::string text;
+    for (size_t i = 0; i < pages.size();) {
+        size_t last = i;
+        while (last + 1 < pages.size() && pages[last + 1] == pages[last] + pageSize) {
+            ++last;
+        }
+        text += (text.empty() ? "" : ", ") + std::to_string(pages[i] / pageSize);
+        if (last != i) {
+            text += "-" + std::to_string(pages[last] / pageSize);
+        }
+        i = last + 1;
+    }
+    return text;
+}
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "MemoryImage.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Differences between two flash images in whole flash pages, for
+// programmers that can write single pages. Bytes that neither image holds
+// read as erased flash (0xFF), so a page whose code was removed counts as
+// changed and is written erased.
+namespace FlashDelta {
+    constexpr uint32_t PAGE_SIZE = 128;  // ATmega328 flash page in bytes
+
+    // Start addresses of the pages whose contents differ, ascending
+    std::vector<uint32_t> changedPages(const MemoryImage& before, const MemoryImage& after,
+                                       uint32_t pageSize = PAGE_SIZE);
+
+    // Image of the given pages of after, each one complete
+    MemoryImage extract(const MemoryImage& after, const std::vector<uint32_t>& pages, uint32_t pageSize = PAGE_SIZE);
+
+    // Appends the compact page list: per page its number as a 16-bit
+    // little-endian value, then its pageSize bytes
+    void writePageList(const MemoryImage& after, const std::vector<uint32_t>& pages, std::string& out,
+                       uint32_t pageSize = PAGE_SIZE);
+
+    // Page numbers as ranges, e.g. "0-3, 17, 40-41"
+    std::string describe(const std::vector<uint32_t>& pages, uint32_t pageSize = PAGE_SIZE);
+}
@@ -0,0 +1,92 @@
+// HeaderCache.cpp
+// Memory mapped precompiled header files
+
+#include "HeaderCache.hpp"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+HeaderCache::HeaderCache(const std::string& directory)
+    : directory(directory) {
+}
+
+HeaderCache::~HeaderCache() {
+#if defined(__unix__) || defined(__APPLE__)
+    for (const Mapping& mapping : mappings) {
+        munmap(mapping.address, mapping.size);
+    }
+#endif
+}
+
+uint64_t HeaderCache::key(std::string_view text) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (char c : text) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+std::string HeaderCache::pathOf(uint64_t key) const {
+    const char digits[] = "0123456789abcdef";
+    std::string name(16, '0');
+    for (int i = 15; i >= 0; --i) {
+        name[i] = digits[key & 0x0F];
+        key >>= 4;
+    }
+    return (std::filesystem::path(directory) / (name + ".pch")).string();
+}
+
+std::string_view HeaderCache::find(uint64_t key) {
+    std::string path = pathOf(key);
+#if defined(__unix__) || defined(__APPLE__)
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return {};
+    }
+    struct stat info;
+    void* address = MAP_FAILED;
+    if (fstat(file, &info) == 0 && info.st_size > 0) {
+        address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+    if (address == MAP_FAILED) {
+        return {};
+    }
+    mappings.push_back({address, static_cast<size_t>(info.st_size)});
+    return std::string_view(static_cast<const char*>(address), static_cast<size_t>(info.st_size));
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return {};
+    }
+    buffers.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return buffers.back();
+#endif
+}
+
+void HeaderCache::store(uint64_t key, const std::string& data) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::string path = pathOf(key);
+    std::string temporary = path + "." + std::to_string(std::random_device()()) + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!file) {
+            std::filesystem::remove(temporary, error);
+            return;  // A cache that cannot be written only costs speed
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+    }
+}
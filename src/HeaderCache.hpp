@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Precompiled headers on disk, one file per header content hash. Hits are
+// memory mapped and stay mapped as long as the cache object lives.
+class HeaderCache {
+public:
+    explicit HeaderCache(const std::string& directory);
+    ~HeaderCache();
+    HeaderCache(const HeaderCache&) = delete;
+    HeaderCache& operator=(const HeaderCache&) = delete;
+
+    // 64-bit FNV-1a hash of a header's text, the cache key
+    static uint64_t key(std::string_view text);
+    // Returns the precompiled header stored under key, or an empty view
+    std::string_view find(uint64_t key);
+    // Stores a precompiled header. Writers go through a temporary file that is
+    // renamed into place, so parallel builds never see a partial file.
+    void store(uint64_t key, const std::string& data);
+
+private:
+    struct Mapping {
+        void* address;
+        size_t size;
+    };
+
+    std::string directory;
+    std::vector<Mapping> mappings;
+    std::deque<std::string> buffers;  // file contents where mmap is not available
+
+    std::string pathOf(uint64_t key) const;
+};
@@ -0,0 +1,579 @@
+// IncrementalAssembler.cpp
+// In-memory assembly state that is updated line by line
+
+#include "IncrementalAssembler.hpp"
+#include "Encoder.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    std::vector<std::string_view> splitLines(std::string_view source) {
+        std::vector<std::string_view> result;
+        size_t pos = 0;
+        while (pos < source.size()) {
+            size_t end = source.find('\n', pos);
+            if (end == std::string_view::npos) {
+                end = source.size();
+            }
+            result.push_back(source.substr(pos, end - pos));
+            pos = end + 1;
+        }
+        return result;
+    }
+
+    // Lines move with every edit above them, so messages are kept without
+    // their " at line N" and the number is added when they are reported
+    std::string withoutLocation(const std::string& message) {
+        size_t at = message.rfind(" at line ");
+        return at == std::string::npos ? message : message.substr(0, at);
+    }
+
+    // Part of [address, address + size) that lies in the flash
+    uint32_t sizeInFlash(uint32_t address, uint32_t size) {
+        return address >= Assembler::FLASH_SIZE ? 0 : std::min(size, Assembler::FLASH_SIZE - address);
+    }
+}
+
+void IncrementalAssembler::setIncludeResolver(Assembler::IncludeResolver resolver) {
+    assembler.setIncludeResolver(std::move(resolver));
+}
+
+void IncrementalAssembler::setBinaryResolver(Assembler::IncludeResolver resolver) {
+    assembler.setBinaryResolver(std::move(resolver));
+}
+
+bool IncrementalAssembler::resolveSymbol(Token& operand, size_t index) const {
+    // Substitutes a .equ/.set/.def name like Assembler::substitute() would at
+    // this line. Returns false if only the Assembler can tell its value.
+    const SymbolTable& symbols = assembler.getSymbols();
+    uint32_t id = symbols.find(operand.text);
+    if (id == SymbolTable::NONE || symbols[id].kind == SymbolTable::Kind::Undefined) {
+        return true;  // A label defined by an edit, or an unknown name
+    }
+    const SymbolTable::Symbol& symbol = symbols[id];
+    if (symbol.kind == SymbolTable::Kind::Label) {
+        return symbol.file == 0;  // Labels of include files are not tracked here
+    }
+
+    // Names from include files are defined by the time the last .include is read
+    const Line* site = nullptr;
+    auto definition = definitions.find(std::string(operand.text));
+    if (definition == definitions.end()) {
+        site = symbol.file != 0 ? lastInclude : nullptr;
+    } else if (definition->second.count == 1 && symbol.file == 0) {
+        site = definition->second.line;
+    }
+    if (site == nullptr || site->index >= index) {
+        return false;
+    }
+    operand.kind = symbol.kind == SymbolTable::Kind::Register ? TokenKind::Register : TokenKind::Integer;
+    operand.value = symbol.value;
+    return true;
+}
+
+void IncrementalAssembler::parseLine(Line& line) {
+    // Start from a clean line; the text and position stay
+    Line parsed;
+    parsed.text = std::move(line.text);
+    parsed.index = line.index;
+    line = std::move(parsed);
+    try {
+        scratch.clear();
+        Lexer::tokenize(line.text, scratch, static_cast<uint32_t>(line.index + 1));
+        Statement stmt;
+        Lexer::readStatement(scratch, 0, stmt);
+
+        if (stmt.label != nullptr && stmt.label->kind == TokenKind::LocalLabel) {
+            line.opaque = true;
+        } else if (stmt.label != nullptr) {
+            Token name = *stmt.label;
+            if (!resolveSymbol(name, line.index) || name.kind != TokenKind::Identifier) {
+                line.opaque = true;  // Already defined as something else
+            }
+            line.label = std::string(stmt.label->text);
+        }
+        if (stmt.mnemonic == nullptr) {
+            return;
+        }
+        if (stmt.mnemonic->text[0] == '.') {
+            // Directives are handled by the Assembler; .org is resolved there
+            line.isOrg = Encoder::isDirective(*stmt.mnemonic, ".org");
+            line.opaque = true;
+            return;
+        }
+
+        const Opcodes::Descriptor& desc = Encoder::lookupInstruction(stmt);
+        line.mnemonic = *stmt.mnemonic;
+        for (uint8_t i = 0; i < stmt.operandCount; ++i) {
+            Token operand = *stmt.operands[i];
+            Opcodes::OperandKind kind = desc.operands[i];
+            if (operand.kind == TokenKind::LocalReference
+                || (operand.kind == TokenKind::Identifier && !resolveSymbol(operand, line.index))) {
+                line.opaque = true;
+                continue;
+            }
+            if (Opcodes::isLabelOperand(kind) && operand.kind == TokenKind::Identifier) {
+                line.labelOperand = static_cast<int8_t>(i);
+                line.target = *stmt.operands[i];
+                continue;
+            }
+            if (!line.opaque) {
+                line.values[i] = Encoder::operandValue(desc, kind, operand);
+                Encoder::checkRange(desc, kind, line.values[i], operand);
+            }
+        }
+        if (!line.opaque) {
+            line.desc = &desc;
+            line.size = desc.size;
+        }
+    } catch (const SourceError& ex) {
+        line.parseError = withoutLocation(ex.what());
+        line.desc = nullptr;
+        line.size = 0;
+    }
+}
+
+void IncrementalAssembler::attach(Line& line, std::unordered_set<std::string>& movedLabels) {
+    if (!line.label.empty()) {
+        auto it = labels.emplace(line.label, &line).first;
+        if (it->second == &line) {
+            movedLabels.insert(line.label);
+        } else if (line.index < it->second->index) {
+            // The earliest definition owns the label, as in the Assembler
+            Line* previous = it->second;
+            it->second = &line;
+            duplicates[line.label].push_back(previous);
+            updateFailing(*previous);
+            movedLabels.insert(line.label);
+        } else {
+            duplicates[line.label].push_back(&line);
+        }
+    }
+    if (line.labelOperand >= 0) {
+        references[std::string(line.target.text)].insert(&line);
+    }
+    updateFailing(line);
+}
+
+void IncrementalAssembler::detach(Line& line, std::unordered_set<std::string>& movedLabels) {
+    if (!line.label.empty()) {
+        auto it = labels.find(line.label);
+        auto dup = duplicates.find(line.label);
+        if (it->second == &line) {
+            movedLabels.insert(line.label);
+            if (dup == duplicates.end()) {
+                labels.erase(it);
+            } else {
+                // The earliest remaining definition takes over the label
+                auto earliest = std::min_element(dup->second.begin(), dup->second.end(),
+                                                 [](const Line* a, const Line* b) { return a->index < b->index; });
+                it->second = *earliest;
+                dup->second.erase(earliest);
+                updateFailing(*it->second);
+            }
+        } else {
+            dup->second.erase(std::find(dup->second.begin(), dup->second.end(), &line));
+        }
+        if (dup != duplicates.end() && dup->second.empty()) {
+            duplicates.erase(dup);
+        }
+    }
+    if (line.labelOperand >= 0) {
+        auto it = references.find(std::string(line.target.text));
+        it->second.erase(&line);
+        if (it->second.empty()) {
+            references.erase(it);
+        }
+    }
+    failing.erase(&line);
+}
+
+void IncrementalAssembler::updateFailing(Line& line) {
+    bool duplicate = !line.label.empty() && labels.find(line.label)->second != &line;
+    if (!line.parseError.empty() || !line.encodeError.empty() || duplicate) {
+        failing.insert(&line);
+    } else {
+        failing.erase(&line);
+    }
+}
+
+void IncrementalAssembler::encode(Line& line) {
+    ++encodedCount;
+    line.encodeError.clear();
+    if (line.desc != nullptr) {
+        const Opcodes::Descriptor& desc = *line.desc;
+        int32_t values[2] = {line.values[0], line.values[1]};
+        if (line.labelOperand >= 0) {
+            Opcodes::OperandKind kind = desc.operands[line.labelOperand];
+            auto it = labels.find(std::string(line.target.text));
+            if (it == labels.end()) {
+                line.encodeError = Encoder::unknownLabel(line.target.text);
+            } else {
+                values[line.labelOperand] = Encoder::labelValue(kind, it->second->start, line.address);
+                try {
+                    Encoder::checkRange(desc, kind, values[line.labelOperand], line.target);
+                } catch (const SourceError& ex) {
+                    line.encodeError = withoutLocation(ex.what());
+                }
+            }
+        }
+        if (line.encodeError.empty() && line.address + desc.size > Assembler::FLASH_SIZE) {
+            line.encodeError = Encoder::programTooLarge(line.mnemonic.text,
+                                                        line.address + desc.size - Assembler::FLASH_SIZE);
+        }
+
+        if (line.encodeError.empty()) {
+            Encoder::toBytes(Opcodes::encode(desc, values), desc.size, line.bytes);
+        } else {
+            std::fill(line.bytes, line.bytes + 4, 0);
+        }
+    }
+    updateFailing(line);
+}
+
+uint32_t IncrementalAssembler::endOf(size_t index) const {
+    const Line& line = *lines[index];
+    return line.opaque ? line.end : line.address + line.size;
+}
+
+void IncrementalAssembler::assembleAll() {
+    labels.clear();
+    duplicates.clear();
+    references.clear();
+    definitions.clear();
+    failing.clear();
+    failures.clear();
+    lastInclude = nullptr;
+    monotonic = true;
+    encodedCount = lines.size();
+
+    std::string source;
+    for (const auto& line : lines) {
+        source += line->text;
+        source += '\n';
+    }
+    assembled = assembler.assemble(source);
+    if (!assembled) {
+        // The client keeps the last image that assembled
+        for (const Assembler::Diagnostic& diagnostic : assembler.getDiagnostics()) {
+            if (!diagnostic.file.empty()) {
+                failures.push_back({nullptr, diagnostic.file + ": " + diagnostic.message});
+            } else if (diagnostic.line == 0 || diagnostic.line > lines.size()) {
+                failures.push_back({nullptr, diagnostic.message});
+            } else {
+                failures.push_back({lines[diagnostic.line - 1].get(), withoutLocation(diagnostic.message)});
+            }
+        }
+        return;
+    }
+
+    // .equ/.set/.def sites first, so a use can tell whether its name was
+    // defined once and above it
+    Statement stmt;
+    for (const auto& line : lines) {
+        scratch.clear();
+        Lexer::tokenize(line->text, scratch);
+        Lexer::readStatement(scratch, 0, stmt);
+        if (stmt.mnemonic == nullptr) {
+            continue;
+        }
+        if (Encoder::isDirective(*stmt.mnemonic, ".include")) {
+            lastInclude = line.get();
+        } else if ((Encoder::isDirective(*stmt.mnemonic, ".equ") || Encoder::isDirective(*stmt.mnemonic, ".set")
+                    || Encoder::isDirective(*stmt.mnemonic, ".def")) && stmt.operandCount == 2) {
+            Definition& definition = definitions[std::string(stmt.operands[0]->text)];
+            definition.line = line.get();
+            ++definition.count;
+        }
+    }
+
+    // Every line takes the addresses the Assembler gave it
+    const std::vector<uint32_t>& addresses = assembler.getLineAddresses();
+    std::unordered_set<std::string> movedLabels;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        Line& line = *lines[i];
+        parseLine(line);
+        line.start = addresses[i];
+        line.address = addresses[i];
+        if (line.isOrg) {
+            line.opaque = false;
+            line.orgAddress = addresses[i + 1];
+            line.address = line.orgAddress;
+            monotonic = monotonic && line.start <= line.orgAddress;
+        } else if (line.opaque || line.start + line.size != addresses[i + 1]) {
+            line.opaque = true;
+            line.desc = nullptr;
+            line.size = 0;
+            line.end = addresses[i + 1];
+            monotonic = monotonic && line.start <= line.end;
+        }
+        attach(line, movedLabels);
+    }
+    for (const auto& line : lines) {
+        encode(*line);
+    }
+    encodedCount = lines.size();
+
+    // Erased ranges first, then every run of bytes that differs
+    std::vector<int16_t> next(Assembler::FLASH_SIZE, -1);
+    for (const MemoryImage::Segment& segment : assembler.getImage().getSegments()) {
+        std::copy(segment.data.begin(), segment.data.end(), next.begin() + segment.address);
+    }
+    for (uint32_t address = 0; address < Assembler::FLASH_SIZE;) {
+        uint32_t start = address;
+        while (address < Assembler::FLASH_SIZE && flash[address] >= 0 && next[address] < 0) {
+            ++address;
+        }
+        if (address > start) {
+            changes.push_back({true, start, address - start, {}});
+        } else {
+            ++address;
+        }
+    }
+    for (uint32_t address = 0; address < Assembler::FLASH_SIZE;) {
+        Change change{false, address, 0, {}};
+        while (address < Assembler::FLASH_SIZE && next[address] >= 0 && next[address] != flash[address]) {
+            change.bytes.push_back(static_cast<uint8_t>(next[address++]));
+        }
+        if (!change.bytes.empty()) {
+            change.size = static_cast<uint32_t>(change.bytes.size());
+            changes.push_back(std::move(change));
+        } else {
+            ++address;
+        }
+    }
+    flash.swap(next);
+}
+
+void IncrementalAssembler::load(std::string_view source) {
+    lines.clear();
+    changes.clear();
+    flash.assign(Assembler::FLASH_SIZE, -1);
+    std::vector<std::string_view> texts = splitLines(source);
+    lines.reserve(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+        lines.push_back(std::make_unique<Line>());
+        lines.back()->text = std::string(texts[i]);
+        lines.back()->index = i;
+    }
+    assembleAll();
+}
+
+void IncrementalAssembler::edit(size_t first, size_t count, const std::vector<std::string>& replacement) {
+    if (first > lines.size() || count > lines.size() - first) {
+        throw std::out_of_range("Edit range outside of the file");
+    }
+    changes.clear();
+    encodedCount = 0;
+
+    // Lines the Assembler placed can only be replaced by assembling again
+    bool incremental = assembled;
+    for (size_t i = first; i < first + count; ++i) {
+        incremental = incremental && !lines[i]->opaque;
+    }
+
+    // Addresses after the edit only shift when the size or an .org changes
+    bool layoutChanged = false;
+    uint32_t removedSize = 0;
+    std::unordered_set<std::string> movedLabels;
+    std::vector<Change> erased;
+    for (size_t i = first; i < first + count && incremental; ++i) {
+        Line& line = *lines[i];
+        removedSize += line.size;
+        layoutChanged = layoutChanged || line.isOrg;
+        if (line.size > 0) {
+            erased.push_back({true, line.address, line.size, {}});
+        }
+        detach(line, movedLabels);
+    }
+
+    std::vector<std::unique_ptr<Line>> added;
+    for (const std::string& text : replacement) {
+        added.push_back(std::make_unique<Line>());
+        added.back()->text = text;
+    }
+    std::vector<Line*> addedLines;
+    for (auto& line : added) {
+        addedLines.push_back(line.get());
+    }
+    lines.erase(lines.begin() + static_cast<std::ptrdiff_t>(first),
+                lines.begin() + static_cast<std::ptrdiff_t>(first + count));
+    lines.insert(lines.begin() + static_cast<std::ptrdiff_t>(first),
+                 std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+    size_t renumberEnd = count == addedLines.size() ? first + count : lines.size();
+    for (size_t i = first; i < renumberEnd; ++i) {
+        lines[i]->index = i;
+    }
+    if (!incremental) {
+        assembleAll();
+        return;
+    }
+
+    uint32_t addedSize = 0;
+    for (Line* line : addedLines) {
+        parseLine(*line);
+        if (line->opaque) {
+            assembleAll();
+            return;
+        }
+        addedSize += line->size;
+    }
+    layoutChanged = layoutChanged || removedSize != addedSize;
+    if (layoutChanged && !monotonic) {
+        assembleAll();
+        return;
+    }
+    if (!layoutChanged) {
+        erased.clear();  // The new lines cover the same bytes
+    }
+    for (Line* line : addedLines) {
+        attach(*line, movedLabels);
+    }
+
+    // Lay out the new lines and whatever follows until an address matches again
+    const std::unordered_set<Line*> addedSet(addedLines.begin(), addedLines.end());
+    std::unordered_set<Line*> dirty = addedSet;
+    std::unordered_set<Line*> moved;
+    for (size_t i = first; i < lines.size(); ++i) {
+        Line& line = *lines[i];
+        uint32_t start = i == 0 ? 0 : endOf(i - 1);
+        if (i >= first + addedLines.size()) {
+            if (start == line.start) {
+                break;  // Sizes after the edit are unchanged, so nothing further moves
+            }
+            if (line.opaque || (line.isOrg && start > line.orgAddress)) {
+                assembleAll();  // Data or code from an include would move, or code overlaps
+                return;
+            }
+            if (!line.label.empty() && labels.find(line.label)->second == &line) {
+                movedLabels.insert(line.label);
+            }
+            if (line.size > 0) {
+                erased.push_back({true, line.address, line.size, {}});
+                moved.insert(&line);
+                dirty.insert(&line);
+            }
+        }
+        line.start = start;
+        line.address = line.isOrg ? line.orgAddress : start;
+    }
+
+    for (const std::string& label : movedLabels) {
+        auto it = references.find(label);
+        if (it != references.end()) {
+            dirty.insert(it->second.begin(), it->second.end());
+        }
+        auto dup = duplicates.find(label);
+        if (dup != duplicates.end()) {
+            for (Line* line : dup->second) {
+                updateFailing(*line);
+            }
+        }
+    }
+    for (Line* line : dirty) {
+        if (line->opaque) {
+            assembleAll();  // It refers to a label that moved
+            return;
+        }
+    }
+
+    std::vector<Change> written;
+    for (Line* line : dirty) {
+        uint8_t before[4];
+        std::copy(line->bytes, line->bytes + 4, before);
+        bool valid = line->encodeError.empty();
+        encode(*line);
+        if (line->size == 0) {
+            continue;
+        }
+        if (!line->encodeError.empty()) {
+            erased.push_back({true, line->address, line->size, {}});
+        } else if (!valid || moved.count(line) > 0 || addedSet.count(line) > 0
+                   || !std::equal(before, before + 4, line->bytes)) {
+            written.push_back({false, line->address, line->size, std::vector<uint8_t>(line->bytes, line->bytes + line->size)});
+        }
+    }
+
+    auto byAddress = [](const Change& a, const Change& b) { return a.address < b.address; };
+    std::sort(erased.begin(), erased.end(), byAddress);
+    std::sort(written.begin(), written.end(), byAddress);
+
+    // Report touching erased ranges as one
+    for (Change& range : erased) {
+        range.size = sizeInFlash(range.address, range.size);
+        if (range.size == 0) {
+            continue;
+        }
+        if (!changes.empty() && changes.back().address + changes.back().size >= range.address) {
+            uint32_t end = std::max(changes.back().address + changes.back().size, range.address + range.size);
+            changes.back().size = end - changes.back().address;
+        } else {
+            changes.push_back(range);
+        }
+    }
+    for (const Change& range : changes) {
+        std::fill(flash.begin() + range.address, flash.begin() + range.address + range.size, -1);
+    }
+    for (Change& change : written) {
+        std::copy(change.bytes.begin(), change.bytes.end(), flash.begin() + change.address);
+        changes.push_back(std::move(change));
+    }
+}
+
+const std::vector<IncrementalAssembler::Change>& IncrementalAssembler::getChanges() const {
+    return changes;
+}
+
+std::vector<IncrementalAssembler::Diagnostic> IncrementalAssembler::getDiagnostics() const {
+    std::vector<Diagnostic> result;
+    if (!assembled) {
+        for (const Failure& failure : failures) {
+            result.push_back({failure.line == nullptr ? 0 : failure.line->index + 1, failure.message});
+        }
+        return result;
+    }
+    if (failing.empty()) {
+        return result;
+    }
+    for (size_t i = 0; i < lines.size(); ++i) {
+        const Line& line = *lines[i];
+        if (failing.count(const_cast<Line*>(&line)) == 0) {
+            continue;
+        }
+        if (!line.parseError.empty()) {
+            result.push_back({i + 1, line.parseError});
+        }
+        if (!line.label.empty() && labels.find(line.label)->second != &line) {
+            result.push_back({i + 1, Encoder::duplicateLabel(line.label)});
+        }
+        if (!line.encodeError.empty()) {
+            result.push_back({i + 1, line.encodeError});
+        }
+    }
+    return result;
+}
+
+size_t IncrementalAssembler::getLineCount() const {
+    return lines.size();
+}
+
+size_t IncrementalAssembler::getEncodedCount() const {
+    return encodedCount;
+}
+
+MemoryImage IncrementalAssembler::buildImage() const {
+    MemoryImage image;
+    for (uint32_t address = 0; address < flash.size();) {
+        uint32_t start = address;
+        std::vector<uint8_t> bytes;
+        while (address < flash.size() && flash[address] >= 0) {
+            bytes.push_back(static_cast<uint8_t>(flash[address++]));
+        }
+        if (bytes.empty()) {
+            ++address;
+        } else {
+            image.write(start, bytes.data(), bytes.size());
+        }
+    }
+    return image;
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include "Assembler.hpp"
+#include "MemoryImage.hpp"
+#include "OpcodeMap.hpp"
+#include "Lexer.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Keeps one source file assembled in memory. Every line holds its parsed
+// operands and encoded bytes. An edit that only touches instructions, labels
+// and comments re-lexes the changed lines with the Lexer and re-encodes them
+// plus the instructions that reference labels they moved. Any other edit
+// (directives, local labels, redefined .set/.def names, code that would move
+// data or code from an include) runs the whole file through the Assembler and
+// reports the bytes that differ.
+class IncrementalAssembler {
+public:
+    // Bytes that changed, or a range that no longer holds code
+    struct Change {
+        bool erased;
+        uint32_t address;
+        uint32_t size;
+        std::vector<uint8_t> bytes;  // empty for erased ranges
+    };
+
+    struct Diagnostic {
+        size_t line;  // 1-based, 0 if the error is not on a line of this file
+        std::string message;
+    };
+
+    // Passed on to the Assembler; without them .include and .incbin are errors
+    void setIncludeResolver(Assembler::IncludeResolver resolver);
+    void setBinaryResolver(Assembler::IncludeResolver resolver);
+
+    void load(std::string_view source);
+    // Replaces count lines starting at the 0-based line first with replacement
+    void edit(size_t first, size_t count, const std::vector<std::string>& replacement);
+
+    // Changes caused by the last load() or edit(). Erased ranges come first.
+    const std::vector<Change>& getChanges() const;
+    std::vector<Diagnostic> getDiagnostics() const;
+    size_t getLineCount() const;
+    // Lines re-encoded by the last load() or edit()
+    size_t getEncodedCount() const;
+    // The flash image all changes so far add up to
+    MemoryImage buildImage() const;
+
+private:
+    struct Line {
+        std::string text;
+        size_t index = 0;                   // position in lines
+        std::string label;                  // label defined on this line
+        bool opaque = false;                // only the Assembler can place it, see edit()
+        bool isOrg = false;
+        uint32_t orgAddress = 0;
+        const Opcodes::Descriptor* desc = nullptr;
+        int32_t values[2] = {0, 0};         // operands that are not labels
+        int8_t labelOperand = -1;           // index of the label operand
+        Token mnemonic{};                   // the instruction; its text points into text
+        Token target{};                     // the label operand; its text points into text
+        uint32_t start = 0;                 // address before an .org takes effect
+        uint32_t address = 0;               // address of the encoded bytes
+        uint32_t end = 0;                   // address after an opaque line
+        uint8_t size = 0;
+        uint8_t bytes[4] = {0, 0, 0, 0};
+        std::string parseError;             // messages leave out the line number,
+        std::string encodeError;            // which is added when they are reported
+    };
+
+    // Where a .equ/.set/.def name is defined. Only names defined once are
+    // resolved without the Assembler.
+    struct Definition {
+        const Line* line = nullptr;
+        size_t count = 0;
+    };
+
+    // Error of a failed full assembly, nullptr if it is not on a line
+    struct Failure {
+        const Line* line;
+        std::string message;
+    };
+
+    Assembler assembler;  // its symbols are those of the last successful assembly
+    bool assembled = false;
+    bool monotonic = true;  // no .org goes back, so code can't be laid over other code
+    std::vector<Failure> failures;
+    std::vector<std::unique_ptr<Line>> lines;
+    std::unordered_map<std::string, Line*> labels;                   // the earliest definition
+    std::unordered_map<std::string, std::vector<Line*>> duplicates;  // the later ones
+    std::unordered_map<std::string, std::unordered_set<Line*>> references;
+    std::unordered_map<std::string, Definition> definitions;
+    const Line* lastInclude = nullptr;
+    std::unordered_set<Line*> failing;
+    std::vector<int16_t> flash;  // byte per address, -1 where nothing is
+    std::vector<Change> changes;
+    std::vector<Token> scratch;
+    size_t encodedCount = 0;
+
+    void assembleAll();
+    void parseLine(Line& line);
+    bool resolveSymbol(Token& operand, size_t index) const;
+    void attach(Line& line, std::unordered_set<std::string>& movedLabels);
+    void detach(Line& line, std::unordered_set<std::string>& movedLabels);
+    void encode(Line& line);
+    void updateFailing(Line& line);
+    uint32_t endOf(size_t index) const;
+};
@@ -0,0 +1,264 @@
+// IntelHex.cpp
+// Table driven Intel HEX writer and reader
+
+#include "IntelHex.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    // Two ASCII digits for every byte value
+    struct DigitTable {
+        char pairs[256][2];
+        constexpr DigitTable() : pairs() {
+            const char digits[] = "0123456789ABCDEF";
+            for (int i = 0; i < 256; ++i) {
+                pairs[i][0] = digits[i >> 4];
+                pairs[i][1] = digits[i & 0x0F];
+            }
+        }
+    };
+
+    // Value of every hex digit character, -1 for anything else
+    struct NibbleTable {
+        int8_t values[256];
+        constexpr NibbleTable() : values() {
+            for (int i = 0; i < 256; ++i) {
+                values[i] = -1;
+            }
+            for (int i = 0; i < 10; ++i) {
+                values['0' + i] = static_cast<int8_t>(i);
+            }
+            for (int i = 0; i < 6; ++i) {
+                values['A' + i] = static_cast<int8_t>(10 + i);
+                values['a' + i] = static_cast<int8_t>(10 + i);
+            }
+        }
+    };
+
+    constexpr DigitTable DIGITS;
+    constexpr NibbleTable NIBBLES;
+
+    // ':' + length + address + type + checksum + newline
+    const size_t RECORD_OVERHEAD = 1 + 2 + 4 + 2 + 2 + 1;
+
+    std::runtime_error parseError(const std::string& message, size_t line) {
+        return std::runtime_error("Invalid HEX record at line " + std::to_string(line) + ": " + message);
+    }
+}
+
+namespace IntelHex {
+
+Writer::Writer(const Options& options)
+    : options(options) {
+    if (this->options.recordLength == 0) {
+        throw std::runtime_error("HEX record length must be between 1 and 255");
+    }
+}
+
+void Writer::reserve(size_t dataSize) {
+    size_t records = dataSize / options.recordLength + 2;
+    text.reserve(text.size() + dataSize * 2 + records * RECORD_OVERHEAD + 64);
+}
+
+void Writer::record(uint8_t type, uint16_t address, const uint8_t* data, size_t size) {
+    size_t start = text.size();
+    text.resize(start + RECORD_OVERHEAD + size * 2);
+    char* out = &text[start];
+
+    uint8_t checksum = static_cast<uint8_t>(size + (address >> 8) + (address & 0xFF) + type);
+    auto put = [&out](uint8_t byte) {
+        out[0] = DIGITS.pairs[byte][0];
+        out[1] = DIGITS.pairs[byte][1];
+        out += 2;
+    };
+
+    *out++ = ':';
+    put(static_cast<uint8_t>(size));
+    put(static_cast<uint8_t>(address >> 8));
+    put(static_cast<uint8_t>(address & 0xFF));
+    put(type);
+    for (size_t i = 0; i < size; ++i) {
+        put(data[i]);
+        checksum += data[i];
+    }
+    put(static_cast<uint8_t>(~checksum + 1));
+    *out = '\n';
+}
+
+void Writer::addData(uint32_t address, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        // Select the 64 KB window holding address
+        uint32_t upper = address & 0xFFFF0000;
+        if (upper != upperAddress) {
+            uint8_t payload[2];
+            if (options.segmentAddressing) {
+                if (address > 0xFFFFF) {
+                    throw std::runtime_error("Address out of range for segment addressing");
+                }
+                uint16_t segment = static_cast<uint16_t>(upper >> 4);
+                payload[0] = static_cast<uint8_t>(segment >> 8);
+                payload[1] = static_cast<uint8_t>(segment & 0xFF);
+                record(ExtendedSegmentAddress, 0, payload, 2);
+            } else {
+                payload[0] = static_cast<uint8_t>(upper >> 24);
+                payload[1] = static_cast<uint8_t>(upper >> 16);
+                record(ExtendedLinearAddress, 0, payload, 2);
+            }
+            upperAddress = upper;
+        }
+
+        // Records never cross a 64 KB boundary
+        size_t count = std::min<size_t>(size, options.recordLength);
+        count = std::min<size_t>(count, 0x10000 - (address & 0xFFFF));
+        record(Data, static_cast<uint16_t>(address & 0xFFFF), data, count);
+        address += static_cast<uint32_t>(count);
+        data += count;
+        size -= count;
+    }
+}
+
+void Writer::flush(std::ostream& out) {
+    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    text.clear();
+}
+
+const std::string& Writer::finish() {
+    if (options.writeStartAddress) {
+        uint32_t start = options.startAddress;
+        uint8_t payload[4];
+        if (options.segmentAddressing) {
+            // CS:IP pair
+            uint16_t cs = static_cast<uint16_t>((start >> 4) & 0xF000);
+            uint16_t ip = static_cast<uint16_t>(start & 0xFFFF);
+            payload[0] = static_cast<uint8_t>(cs >> 8);
+            payload[1] = static_cast<uint8_t>(cs & 0xFF);
+            payload[2] = static_cast<uint8_t>(ip >> 8);
+            payload[3] = static_cast<uint8_t>(ip & 0xFF);
+            record(StartSegmentAddress, 0, payload, 4);
+        } else {
+            payload[0] = static_cast<uint8_t>(start >> 24);
+            payload[1] = static_cast<uint8_t>(start >> 16);
+            payload[2] = static_cast<uint8_t>(start >> 8);
+            payload[3] = static_cast<uint8_t>(start & 0xFF);
+            record(StartLinearAddress, 0, payload, 4);
+        }
+    }
+    record(EndOfFile, 0, nullptr, 0);
+    return text;
+}
+
+ParseResult parse(std::string_view text) {
+    ParseResult result;
+    uint32_t upperAddress = 0;
+    bool sawEnd = false;
+    size_t line = 0;
+    size_t pos = 0;
+    uint8_t bytes[255 + 5];
+
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string_view::npos) {
+            end = text.size();
+        }
+        std::string_view record = text.substr(pos, end - pos);
+        pos = end + 1;
+        ++line;
+        while (!record.empty() && (record.back() == '\r' || record.back() == ' ' || record.back() == '\t')) {
+            record.remove_suffix(1);
+        }
+        if (record.empty()) {
+            continue;
+        }
+        if (sawEnd) {
+            throw parseError("data after end-of-file record", line);
+        }
+        if (record[0] != ':' || record.size() < 11 || (record.size() - 1) % 2 != 0) {
+            throw parseError("malformed record", line);
+        }
+
+        // Decode every byte pair after the colon
+        size_t count = (record.size() - 1) / 2;
+        if (count > sizeof(bytes)) {
+            throw parseError("record too long", line);
+        }
+        uint8_t checksum = 0;
+        for (size_t i = 0; i < count; ++i) {
+            int8_t high = NIBBLES.values[static_cast<uint8_t>(record[1 + 2 * i])];
+            int8_t low = NIBBLES.values[static_cast<uint8_t>(record[2 + 2 * i])];
+            if (high < 0 || low < 0) {
+                throw parseError("invalid hex digit", line);
+            }
+            bytes[i] = static_cast<uint8_t>((high << 4) | low);
+            checksum += bytes[i];
+        }
+        uint8_t length = bytes[0];
+        if (count != static_cast<size_t>(length) + 5) {
+            throw parseError("length does not match record size", line);
+        }
+        if (checksum != 0) {
+            throw parseError("checksum mismatch", line);
+        }
+
+        uint16_t offset = static_cast<uint16_t>((bytes[1] << 8) | bytes[2]);
+        const uint8_t* payload = bytes + 4;
+        switch (bytes[3]) {
+            case Data: {
+                uint32_t address = upperAddress + offset;
+                if (!result.blocks.empty()) {
+                    Block& last = result.blocks.back();
+                    if (last.address + last.data.size() == address) {
+                        last.data.insert(last.data.end(), payload, payload + length);
+                        break;
+                    }
+                }
+                result.blocks.push_back({address, std::vector<uint8_t>(payload, payload + length)});
+                break;
+            }
+            case EndOfFile:
+                sawEnd = true;
+                break;
+            case ExtendedSegmentAddress:
+                if (length != 2) throw parseError("extended segment address needs 2 bytes", line);
+                upperAddress = static_cast<uint32_t>((payload[0] << 8) | payload[1]) << 4;
+                break;
+            case ExtendedLinearAddress:
+                if (length != 2) throw parseError("extended linear address needs 2 bytes", line);
+                upperAddress = static_cast<uint32_t>((payload[0] << 8) | payload[1]) << 16;
+                break;
+            case StartSegmentAddress:
+                if (length != 4) throw parseError("start segment address needs 4 bytes", line);
+                result.hasStartAddress = true;
+                result.startAddress = (static_cast<uint32_t>((payload[0] << 8) | payload[1]) << 4)
+                                      + static_cast<uint32_t>((payload[2] << 8) | payload[3]);
+                break;
+            case StartLinearAddress:
+                if (length != 4) throw parseError("start linear address needs 4 bytes", line);
+                result.hasStartAddress = true;
+                result.startAddress = (static_cast<uint32_t>(payload[0]) << 24) | (payload[1] << 16)
+                                      | (payload[2] << 8) | payload[3];
+                break;
+            default:
+                throw parseError("unknown record type", line);
+        }
+    }
+
+    if (!sawEnd) {
+        throw std::runtime_error("Invalid HEX file: missing end-of-file record");
+    }
+
+    // Records may come in any order; sort and merge touching blocks
+    std::sort(result.blocks.begin(), result.blocks.end(),
+              [](const Block& a, const Block& b) { return a.address < b.address; });
+    std::vector<Block> merged;
+    for (Block& block : result.blocks) {
+        if (!merged.empty() && merged.back().address + merged.back().data.size() == block.address) {
+            merged.back().data.insert(merged.back().data.end(), block.data.begin(), block.data.end());
+        } else {
+            merged.push_back(std::move(block));
+        }
+    }
+    result.blocks = std::move(merged);
+    return result;
+}
+
+}
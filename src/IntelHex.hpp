@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Intel HEX encoding and decoding. The writer formats the whole file into one
+// preallocated buffer through a byte-to-digits lookup table.
+namespace IntelHex {
+    enum RecordType : uint8_t {
+        Data = 0x00,
+        EndOfFile = 0x01,
+        ExtendedSegmentAddress = 0x02,
+        StartSegmentAddress = 0x03,
+        ExtendedLinearAddress = 0x04,
+        StartLinearAddress = 0x05
+    };
+
+    struct Options {
+        uint8_t recordLength = 16;       // data bytes per record, 1-255
+        bool segmentAddressing = false;  // type 02/03 instead of 04/05 records
+        bool writeStartAddress = false;
+        uint32_t startAddress = 0;
+    };
+
+    // Contiguous run of bytes read back from a HEX file
+    struct Block {
+        uint32_t address;
+        std::vector<uint8_t> data;
+    };
+
+    struct ParseResult {
+        std::vector<Block> blocks;     // sorted by address, adjacent runs merged
+        bool hasStartAddress = false;
+        uint32_t startAddress = 0;
+    };
+
+    class Writer {
+    public:
+        explicit Writer(const Options& options = Options());
+
+        // Reserves the buffer for dataSize bytes of payload
+        void reserve(size_t dataSize);
+        // Appends data records for size bytes placed at address
+        void addData(uint32_t address, const uint8_t* data, size_t size);
+        // Appends the start address and end-of-file records and returns the text
+        const std::string& finish();
+        // Writes the records appended so far to out and drops them, so a
+        // stream doesn't hold the whole file
+        void flush(std::ostream& out);
+
+    private:
+        Options options;
+        std::string text;
+        uint32_t upperAddress = 0;  // address bits selected by the last extended record
+
+        void record(uint8_t type, uint16_t address, const uint8_t* data, size_t size);
+    };
+
+    // Parses HEX text. Throws std::runtime_error on malformed records or
+    // checksum mismatches, naming the offending line.
+    ParseResult parse(std::string_view text);
+}
@@ -0,0 +1,264 @@
+// Lexer.cpp
+// Single pass tokenizer for ATmega328 assembly sources
+
+#include "Lexer.hpp"
+#include "SymbolTable.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    inline bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    inline bool isDataDirective(std::string_view text) {
+        return text.size() == 3 && text[0] == '.' && (text[1] == 'd' || text[1] == 'D')
+               && (text[2] == 'b' || text[2] == 'B' || text[2] == 'w' || text[2] == 'W');
+    }
+
+    // True if the identifier just appended to tokens is the first word of a
+    // statement, possibly after a label
+    bool startsStatement(const std::vector<Token>& tokens) {
+        size_t index = tokens.size() - 1;
+        if (index == 0 || tokens[index - 1].kind == TokenKind::EndOfLine) {
+            return true;
+        }
+        return index >= 2 && tokens[index - 1].kind == TokenKind::Colon
+               && (tokens[index - 2].kind == TokenKind::Identifier || tokens[index - 2].kind == TokenKind::LocalLabel)
+               && (index == 2 || tokens[index - 3].kind == TokenKind::EndOfLine);
+    }
+
+    // "1:" defines a local label, "1b"/"1f" refer to the nearest one backward or
+    // forward, as in GNU as. Returns Integer for anything else.
+    TokenKind localLabelKind(std::string_view text, bool colon, int32_t& number) {
+        size_t digits = 0;
+        int32_t value = 0;
+        while (digits < text.size() && digits < 5 && isDigit(text[digits])) {
+            value = value * 10 + (text[digits++] - '0');
+        }
+        if (digits == 0) {
+            return TokenKind::Integer;
+        }
+        number = value;
+        if (digits == text.size() && colon) {
+            return TokenKind::LocalLabel;
+        }
+        if (digits + 1 == text.size() && (text.back() == 'b' || text.back() == 'f')) {
+            return TokenKind::LocalReference;
+        }
+        return TokenKind::Integer;
+    }
+
+    std::string position(uint32_t line, uint32_t column) {
+        return " at line " + std::to_string(line) + ", column " + std::to_string(column);
+    }
+}
+
+bool Lexer::unescape(std::string_view text, std::vector<uint8_t>& out) {
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '\\') {
+            if (++i == text.size()) {
+                return false;
+            }
+            switch (text[i]) {
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case '0': c = '\0'; break;
+                case '\\': case '"': case '\'': c = text[i]; break;
+                default: return false;
+            }
+        }
+        out.push_back(static_cast<uint8_t>(c));
+    }
+    return true;
+}
+
+void Lexer::tokenize(std::string_view source, std::vector<Token>& tokens, uint32_t firstLine, uint16_t file,
+                     SymbolTable* symbols) {
+    const char* data = source.data();
+    const size_t size = source.size();
+    uint32_t line = firstLine;
+    size_t lineStart = 0;
+    size_t pos = 0;
+
+    while (pos < size) {
+        char c = data[pos];
+        uint32_t column = static_cast<uint32_t>(pos - lineStart + 1);
+
+        if (c == ' ' || c == '\t' || c == '\r') {
+            ++pos;
+        } else if (c == '\n') {
+            tokens.push_back({TokenKind::EndOfLine, file, 0, source.substr(pos, 0), line, column});
+            ++pos;
+            ++line;
+            lineStart = pos;
+        } else if (c == ';') {
+            // Comments run to the end of the line
+            while (pos < size && data[pos] != '\n') {
+                ++pos;
+            }
+        } else if (c == '#' && (tokens.empty() || tokens.back().kind == TokenKind::EndOfLine)) {
+            // Preprocessor lines such as include guards are ignored
+            while (pos < size && data[pos] != '\n') {
+                ++pos;
+            }
+        } else if (c == '"') {
+            size_t start = ++pos;
+            while (pos < size && data[pos] != '"' && data[pos] != '\n') {
+                pos += data[pos] == '\\' && pos + 1 < size && data[pos + 1] != '\n' ? 2 : 1;
+            }
+            if (pos == size || data[pos] != '"') {
+                throw SourceError("Unterminated string" + position(line, column), line, file);
+            }
+            tokens.push_back({TokenKind::String, file, 0, source.substr(start, pos - start), line, column});
+            ++pos;
+        } else if (c == '=') {
+            tokens.push_back({TokenKind::Equals, file, 0, source.substr(pos, 1), line, column});
+            ++pos;
+        } else if (c == ',') {
+            tokens.push_back({TokenKind::Comma, file, 0, source.substr(pos, 1), line, column});
+            ++pos;
+        } else if (c == ':') {
+            tokens.push_back({TokenKind::Colon, file, 0, source.substr(pos, 1), line, column});
+            ++pos;
+        } else if (isIdentifierStart(c)) {
+            size_t start = pos;
+            while (pos < size && isIdentifierChar(data[pos])) {
+                ++pos;
+            }
+            std::string_view text = source.substr(start, pos - start);
+            int32_t regNum = 0;
+            if (parseRegister(text, regNum)) {
+                tokens.push_back({TokenKind::Register, file, regNum, text, line, column});
+            } else {
+                int32_t id = symbols != nullptr ? static_cast<int32_t>(symbols->intern(text)) : 0;
+                tokens.push_back({TokenKind::Identifier, file, id, text, line, column});
+                if (isDataDirective(text) && startsStatement(tokens)) {
+                    pos = scanData(source, pos, line, lineStart, file, tokens);
+                }
+            }
+        } else if (isDigit(c) || c == '$' || ((c == '-' || c == '+') && pos + 1 < size && isDigit(data[pos + 1]))) {
+            size_t start = pos++;
+            while (pos < size && (isIdentifierChar(data[pos]) || data[pos] == '$')) {
+                ++pos;
+            }
+            std::string_view text = source.substr(start, pos - start);
+            int32_t value = 0;
+            TokenKind local = localLabelKind(text, pos < size && data[pos] == ':', value);
+            if (local != TokenKind::Integer) {
+                tokens.push_back({local, file, value, text, line, column});
+                continue;
+            }
+            if (!parseInteger(text, value)) {
+                throw SourceError("Invalid number '" + std::string(text) + "'" + position(line, column), line, file);
+            }
+            tokens.push_back({TokenKind::Integer, file, value, text, line, column});
+        } else {
+            throw SourceError("Unexpected character '" + std::string(1, c) + "'" + position(line, column), line, file);
+        }
+    }
+
+    // Terminate an unterminated last line
+    if (tokens.empty() || tokens.back().kind != TokenKind::EndOfLine || lineStart < size) {
+        tokens.push_back({TokenKind::EndOfLine, file, 0, source.substr(size, 0), line,
+                          static_cast<uint32_t>(size - lineStart + 1)});
+    }
+}
+
+size_t Lexer::scanData(std::string_view source, size_t pos, uint32_t line, size_t lineStart, uint16_t file,
+                       std::vector<Token>& tokens) {
+    // A table can hold thousands of literals; one token for the whole list
+    // keeps them out of the token array
+    const char* data = source.data();
+    const size_t size = source.size();
+    while (pos < size && (data[pos] == ' ' || data[pos] == '\t')) {
+        ++pos;
+    }
+    size_t start = pos;
+    const char* newline = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+    size_t stop = newline != nullptr ? static_cast<size_t>(newline - data) : size;
+
+    // memchr is vectorized; only lines with strings need a scan of every character
+    size_t end = stop;
+    if (std::memchr(data + pos, '"', stop - pos) == nullptr) {
+        const char* comment = static_cast<const char*>(std::memchr(data + pos, ';', stop - pos));
+        if (comment != nullptr) {
+            end = static_cast<size_t>(comment - data);
+        }
+    } else {
+        bool quoted = false;
+        for (; pos < stop; ++pos) {
+            char c = data[pos];
+            if (quoted) {
+                if (c == '\\' && pos + 1 < stop) {
+                    ++pos;
+                } else if (c == '"') {
+                    quoted = false;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == ';') {
+                break;
+            }
+        }
+        if (quoted) {
+            throw SourceError("Unterminated string" + position(line, static_cast<uint32_t>(start - lineStart + 1)),
+                              line, file);
+        }
+        end = pos;
+    }
+    while (end > start && (data[end - 1] == ' ' || data[end - 1] == '\t' || data[end - 1] == '\r')) {
+        --end;
+    }
+    uint32_t column = static_cast<uint32_t>(start - lineStart + 1);
+    if (end > start) {
+        tokens.push_back({TokenKind::Data, file, 0, source.substr(start, end - start), line, column});
+    }
+    return stop;
+}
+
+size_t Lexer::readStatement(const std::vector<Token>& tokens, size_t pos, Statement& stmt) {
+    stmt.label = nullptr;
+    stmt.mnemonic = nullptr;
+    stmt.operandCount = 0;
+
+    // Format: [label:] [mnemonic [operand {, operand}]]
+    if ((tokens[pos].kind == TokenKind::Identifier || tokens[pos].kind == TokenKind::LocalLabel)
+        && tokens[pos + 1].kind == TokenKind::Colon) {
+        stmt.label = &tokens[pos];
+        pos += 2;
+    }
+    if (tokens[pos].kind == TokenKind::Identifier) {
+        stmt.mnemonic = &tokens[pos++];
+        while (tokens[pos].kind != TokenKind::EndOfLine) {
+            const Token& operand = tokens[pos];
+            if (operand.kind == TokenKind::Comma || operand.kind == TokenKind::Colon || operand.kind == TokenKind::Equals) {
+                throw SourceError("Expected operand" + position(operand.line, operand.column), operand);
+            }
+            if (stmt.operandCount == 2) {
+                throw SourceError("Too many operands for " + std::string(stmt.mnemonic->text)
+                                  + position(operand.line, operand.column), operand);
+            }
+            stmt.operands[stmt.operandCount++] = &operand;
+            ++pos;
+            if (tokens[pos].kind == TokenKind::Comma
+                || (tokens[pos].kind == TokenKind::Equals && stmt.mnemonic->text[0] == '.')) {
+                ++pos;
+                if (tokens[pos].kind == TokenKind::EndOfLine) {
+                    throw SourceError("Expected operand" + position(tokens[pos].line, tokens[pos].column), tokens[pos]);
+                }
+            } else if (tokens[pos].kind != TokenKind::EndOfLine) {
+                throw SourceError("Expected ',' between operands"
+                                  + position(tokens[pos].line, tokens[pos].column), tokens[pos]);
+            }
+        }
+    } else if (tokens[pos].kind != TokenKind::EndOfLine) {
+        throw SourceError("Expected instruction" + position(tokens[pos].line, tokens[pos].column), tokens[pos]);
+    }
+
+    stmt.end = &tokens[pos];
+    return pos + 1;
+}
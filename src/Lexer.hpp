@@ -0,0 +1,198 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+class SymbolTable;
+
+enum class TokenKind : uint8_t {
+    Identifier,   // mnemonic, label or directive name; value holds the SymbolTable id
+    Register,     // R0-R31, value holds the register number
+    Integer,      // numeric literal, value holds the parsed number
+    String,       // "quoted text", text holds what is between the quotes, escapes unexpanded
+    Data,         // operand list of .db/.dw, kept as raw text for the bulk parser
+    LocalLabel,   // numeric local label "1:", value holds the number
+    LocalReference, // "1b"/"1f", the nearest local label backward/forward
+    Comma,
+    Colon,
+    Equals,
+    EndOfLine
+};
+
+struct Token {
+    TokenKind kind;
+    uint16_t file;          // 0 for the main source, otherwise the include number
+    int32_t value;
+    std::string_view text;  // span into the source buffer
+    uint32_t line;
+    uint32_t column;
+};
+
+// Error in the source text. The message already names the line; line() and
+// file() give it to callers that collect diagnostics.
+class SourceError : public std::runtime_error {
+public:
+    SourceError(const std::string& message, uint32_t line, uint16_t file = 0)
+        : std::runtime_error(message), sourceLine(line), sourceFile(file) {}
+    SourceError(const std::string& message, const Token& token)
+        : SourceError(message, token.line, token.file) {}
+    uint32_t line() const { return sourceLine; }
+    uint16_t file() const { return sourceFile; }
+
+private:
+    uint32_t sourceLine;
+    uint16_t sourceFile;
+};
+
+// One source line split into its parts. Pointers refer into the token array.
+struct Statement {
+    const Token* label;      // label defined on this line, or nullptr
+    const Token* mnemonic;   // instruction or directive, or nullptr
+    const Token* operands[2];
+    uint8_t operandCount;
+    const Token* end;        // the EndOfLine token of this line
+};
+
+// Value of every digit character up to base 16, 99 for anything else
+namespace Digits {
+    struct Table {
+        uint8_t values[256];
+        constexpr Table() : values() {
+            for (int i = 0; i < 256; ++i) {
+                values[i] = 99;
+            }
+            for (int i = 0; i < 10; ++i) {
+                values['0' + i] = static_cast<uint8_t>(i);
+            }
+            for (int i = 0; i < 6; ++i) {
+                values['a' + i] = static_cast<uint8_t>(10 + i);
+                values['A' + i] = static_cast<uint8_t>(10 + i);
+            }
+        }
+    };
+    inline constexpr Table TABLE;
+}
+
+// Single pass lexer over a source buffer. Tokens point into the buffer, so it
+// must outlive them. The scanners for single literals are constexpr, so
+// CompileTimeAssembler.hpp reads numbers and registers the same way.
+class Lexer {
+public:
+    // Appends the tokens of source to tokens. Every line, including the last,
+    // ends with an EndOfLine token. Line numbers start at firstLine. Lines
+    // starting with '#' (C preprocessor lines in device headers) are skipped.
+    // With a symbol table, every identifier is interned.
+    static void tokenize(std::string_view source, std::vector<Token>& tokens, uint32_t firstLine = 1,
+                         uint16_t file = 0, SymbolTable* symbols = nullptr);
+
+    // Parses decimal, 0x/$ hex and 0b binary literals with an optional sign.
+    // Returns false instead of throwing on malformed or oversized input.
+    static constexpr bool parseInteger(std::string_view text, int32_t& value);
+    // Parses the literal at the start of text, as parseInteger() does, and
+    // returns its length, or 0 if text doesn't start with a valid literal.
+    // Digits are decoded through a lookup table without branching on their range.
+    // Hex digits are not decoded 8 at a time in one word: .db/.dw items have
+    // 2-4 digits, too few to make up for the setup. The benchmark's data mix
+    // times such tables.
+    static constexpr size_t scanInteger(std::string_view text, int32_t& value);
+    // R0-R31 in either case
+    static constexpr bool parseRegister(std::string_view text, int32_t& value);
+    static constexpr bool isIdentifierStart(char c);
+    static constexpr bool isIdentifierChar(char c);
+    // Appends the bytes of the string literal body text to out, expanding
+    // \n, \r, \t, \0, \\, \" and \'. Returns false on an unknown escape.
+    static bool unescape(std::string_view text, std::vector<uint8_t>& out);
+
+    // Splits the line starting at tokens[pos] into stmt and returns the index
+    // of the first token of the next line. Directives may separate their
+    // operands with '=' instead of ',', as in ".equ NAME = 5".
+    static size_t readStatement(const std::vector<Token>& tokens, size_t pos, Statement& stmt);
+
+private:
+    // Reads the operand list of .db/.dw from pos to the end of the line into
+    // one Data token and returns the position of the line end
+    static size_t scanData(std::string_view source, size_t pos, uint32_t line, size_t lineStart, uint16_t file,
+                           std::vector<Token>& tokens);
+};
+
+constexpr bool Lexer::parseInteger(std::string_view text, int32_t& value) {
+    int32_t parsed = 0;
+    size_t length = scanInteger(text, parsed);
+    if (length == 0 || length != text.size()) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+constexpr size_t Lexer::scanInteger(std::string_view text, int32_t& value) {
+    size_t pos = 0;
+    bool negative = false;
+    if (pos < text.size() && (text[pos] == '-' || text[pos] == '+')) {
+        negative = text[pos] == '-';
+        ++pos;
+    }
+
+    uint32_t base = 10;
+    if (pos < text.size() && text[pos] == '$') {
+        base = 16;
+        ++pos;
+    } else if (pos + 1 < text.size() && text[pos] == '0' && (text[pos + 1] == 'x' || text[pos + 1] == 'X')) {
+        base = 16;
+        pos += 2;
+    } else if (pos + 1 < text.size() && text[pos] == '0' && (text[pos + 1] == 'b' || text[pos + 1] == 'B')) {
+        base = 2;
+        pos += 2;
+    }
+    size_t first = pos;
+    int64_t result = 0;
+    for (; pos < text.size(); ++pos) {
+        uint32_t digit = Digits::TABLE.values[static_cast<uint8_t>(text[pos])];
+        if (digit >= base) {
+            break;
+        }
+        result = result * base + digit;
+        if (result > 0xFFFFFFFFLL) {
+            return 0;
+        }
+    }
+    if (pos == first) {
+        return 0;
+    }
+    if (negative) {
+        result = -result;
+    }
+    if (result < INT32_MIN || result > INT32_MAX) {
+        return 0;
+    }
+    value = static_cast<int32_t>(result);
+    return pos;
+}
+
+constexpr bool Lexer::parseRegister(std::string_view text, int32_t& value) {
+    if (text.size() < 2 || text.size() > 3 || (text[0] != 'R' && text[0] != 'r')) {
+        return false;
+    }
+    int32_t number = 0;
+    for (size_t i = 1; i < text.size(); ++i) {
+        if (text[i] < '0' || text[i] > '9') {
+            return false;
+        }
+        number = number * 10 + (text[i] - '0');
+    }
+    if (number > 31) {
+        return false;
+    }
+    value = number;
+    return true;
+}
+
+constexpr bool Lexer::isIdentifierStart(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_' || c == '.';
+}
+
+constexpr bool Lexer::isIdentifierChar(char c) {
+    return isIdentifierStart(c) || (c >= '0' && c <= '9');
+}
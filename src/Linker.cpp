@@ -0,0 +1,135 @@
+// Linker.cpp
+// Placement, symbol resolution and relocation of object modules
+
+#include "Linker.hpp"
+#include "Assembler.hpp"
+#include "Encoder.hpp"
+#include "OpcodeMap.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    std::string hexAddress(uint32_t address) {
+        const char* digits = "0123456789ABCDEF";
+        std::string text = "0x0000";
+        for (int i = 5; i >= 2; --i, address >>= 4) {
+            text[i] = digits[address & 0xF];
+        }
+        return text;
+    }
+}
+
+void Linker::add(ObjectFile::Module module, const std::string& name) {
+    inputs.push_back({std::move(module), name, 0});
+}
+
+void Linker::link() {
+    image.clear();
+    globals.clear();
+    place();
+    defineGlobals();
+    for (const Input& input : inputs) {
+        for (const ObjectFile::Relocation& relocation : input.module.relocations) {
+            relocate(input, relocation);
+        }
+    }
+}
+
+const MemoryImage& Linker::getImage() const {
+    return image;
+}
+
+const std::unordered_map<std::string, uint32_t>& Linker::getSymbols() const {
+    return globals;
+}
+
+void Linker::place() {
+    // Absolute modules first, so relocatable ones can start behind them
+    uint32_t end = 0;
+    for (Input& input : inputs) {
+        if (input.module.absolute) {
+            for (const MemoryImage::Segment& section : input.module.sections) {
+                end = std::max(end, section.end());
+            }
+        }
+    }
+    for (Input& input : inputs) {
+        if (!input.module.absolute) {
+            input.base = end;
+            for (const MemoryImage::Segment& section : input.module.sections) {
+                end = std::max(end, input.base + section.end());
+            }
+            end = (end + 1) & ~1u;  // Instructions start on word addresses
+        }
+    }
+
+    for (const Input& input : inputs) {
+        for (const MemoryImage::Segment& section : input.module.sections) {
+            if (input.base + section.end() > Assembler::FLASH_SIZE) {
+                throw std::runtime_error("Program too large: " + input.name + " ends past the flash");
+            }
+            try {
+                image.write(input.base + section.address, section.data.data(), section.data.size());
+            } catch (const std::runtime_error& ex) {
+                throw std::runtime_error(input.name + ": " + ex.what());
+            }
+        }
+    }
+}
+
+void Linker::defineGlobals() {
+    std::unordered_map<std::string, const Input*> owners;
+    for (const Input& input : inputs) {
+        for (const ObjectFile::Symbol& symbol : input.module.symbols) {
+            if (symbol.binding != ObjectFile::Binding::Global) {
+                continue;
+            }
+            auto owner = owners.emplace(symbol.name, &input);
+            if (!owner.second) {
+                throw std::runtime_error("Symbol " + symbol.name + " is defined in " + owner.first->second->name
+                                         + " and in " + input.name);
+            }
+            globals[symbol.name] = input.base + symbol.value;
+        }
+    }
+}
+
+void Linker::relocate(const Input& input, const ObjectFile::Relocation& relocation) {
+    const ObjectFile::Symbol& symbol = input.module.symbols[relocation.symbol];
+    uint32_t target = input.base + symbol.value;
+    if (symbol.binding == ObjectFile::Binding::External) {
+        auto global = globals.find(symbol.name);
+        if (global == globals.end()) {
+            throw std::runtime_error("Undefined symbol " + symbol.name + " referenced in " + input.name);
+        }
+        target = global->second;
+    }
+
+    // Decode the placeholder, fill in the label operand and encode it again
+    const Opcodes::Descriptor& desc = Opcodes::TABLE[relocation.opcode];
+    uint32_t address = input.base + relocation.address;
+    uint32_t code = 0;
+    for (uint8_t i = 0; i < desc.size; i += 2) {
+        code = code << 16 | image.read(address + i) | image.read(address + i + 1) << 8;
+    }
+    int32_t values[2];
+    if (address + desc.size > Assembler::FLASH_SIZE || !Opcodes::decode(desc, code, values)) {
+        throw std::runtime_error(input.name + ": relocation at " + hexAddress(relocation.address) + " is not a "
+                                 + std::string(desc.mnemonic) + " instruction");
+    }
+    Opcodes::OperandKind kind = desc.operands[relocation.operand];
+    int32_t value = Encoder::labelValue(kind, target, address);
+    if (value < Opcodes::operandMin(kind) || value > Opcodes::operandMax(kind)) {
+        throw std::runtime_error(input.name + ": " + std::string(desc.mnemonic) + " at " + hexAddress(address)
+                                 + " cannot reach " + symbol.name + " at " + hexAddress(target));
+    }
+    values[relocation.operand] = value;
+
+    uint8_t bytes[4];
+    Encoder::toBytes(Opcodes::encode(desc, values), desc.size, bytes);
+    try {
+        image.patch(address, bytes, desc.size);
+    } catch (const std::runtime_error& ex) {
+        throw std::runtime_error(input.name + ": " + ex.what());
+    }
+}
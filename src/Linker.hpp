@@ -0,0 +1,37 @@
+#pragma once
+#include "MemoryImage.hpp"
+#include "ObjectFile.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Merges separately assembled modules into one flash image. Absolute modules
+// keep their addresses; relocatable modules follow the highest absolute code
+// in the order they were added. Global symbols are resolved across modules
+// and every relocation is re-encoded with the final address.
+class Linker {
+public:
+    // name identifies the module in error messages
+    void add(ObjectFile::Module module, const std::string& name);
+    // Throws std::runtime_error for undefined or duplicate symbols, overlapping
+    // code, targets out of reach and programs that don't fit into the flash
+    void link();
+
+    const MemoryImage& getImage() const;
+    const std::unordered_map<std::string, uint32_t>& getSymbols() const;  // global -> byte address
+
+private:
+    struct Input {
+        ObjectFile::Module module;
+        std::string name;
+        uint32_t base;
+    };
+    std::vector<Input> inputs;
+    MemoryImage image;
+    std::unordered_map<std::string, uint32_t> globals;
+
+    void place();
+    void defineGlobals();
+    void relocate(const Input& input, const ObjectFile::Relocation& relocation);
+};
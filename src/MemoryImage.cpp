@@ -0,0 +1,155 @@
+// MemoryImage.cpp
+// Sparse segmented flash image
+
+#include "MemoryImage.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+    std::string hexAddress(uint32_t address) {
+        const char digits[] = "0123456789ABCDEF";
+        std::string text = "0x0000";
+        for (int i = 5; i >= 2; --i) {
+            text[i] = digits[address & 0x0F];
+            address >>= 4;
+        }
+        return text;
+    }
+}
+
+size_t MemoryImage::findSegment(uint32_t address) const {
+    // Index of the first segment that starts after address
+    auto it = std::upper_bound(segments.begin(), segments.end(), address,
+                               [](uint32_t value, const Segment& segment) { return value < segment.address; });
+    return static_cast<size_t>(it - segments.begin());
+}
+
+void MemoryImage::write(uint32_t address, const uint8_t* data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    // Fast path: continue the segment written last
+    if (cursor < segments.size() && segments[cursor].end() == address
+        && (cursor + 1 == segments.size() || address + size <= segments[cursor + 1].address)) {
+        segments[cursor].data.insert(segments[cursor].data.end(), data, data + size);
+    } else {
+        size_t next = findSegment(address);
+        if (next > 0 && segments[next - 1].end() > address) {
+            throw std::runtime_error("Code overlaps existing code at address " + hexAddress(address));
+        }
+        if (next < segments.size() && address + size > segments[next].address) {
+            throw std::runtime_error("Code overlaps existing code at address " + hexAddress(segments[next].address));
+        }
+        if (next > 0 && segments[next - 1].end() == address) {
+            cursor = next - 1;
+            segments[cursor].data.insert(segments[cursor].data.end(), data, data + size);
+        } else {
+            std::vector<uint8_t> buffer;
+            if (!spare.empty()) {
+                buffer = std::move(spare.back());
+                spare.pop_back();
+            }
+            buffer.assign(data, data + size);
+            segments.insert(segments.begin() + static_cast<std::ptrdiff_t>(next), Segment{address, std::move(buffer)});
+            cursor = next;
+        }
+    }
+
+    // Join with the following segment once the gap is closed
+    if (cursor + 1 < segments.size() && segments[cursor].end() == segments[cursor + 1].address) {
+        std::vector<uint8_t>& tail = segments[cursor + 1].data;
+        segments[cursor].data.insert(segments[cursor].data.end(), tail.begin(), tail.end());
+        tail.clear();
+        spare.push_back(std::move(tail));
+        segments.erase(segments.begin() + static_cast<std::ptrdiff_t>(cursor + 1));
+    }
+}
+
+void MemoryImage::patch(uint32_t address, const uint8_t* data, size_t size) {
+    size_t next = findSegment(address);
+    if (next == 0 || segments[next - 1].end() < address + size) {
+        throw std::runtime_error("Patch outside of written code at address " + hexAddress(address));
+    }
+    Segment& segment = segments[next - 1];
+    std::memcpy(&segment.data[address - segment.address], data, size);
+}
+
+uint8_t MemoryImage::read(uint32_t address, uint8_t fill) const {
+    size_t next = findSegment(address);
+    if (next == 0 || segments[next - 1].end() <= address) {
+        return fill;
+    }
+    const Segment& segment = segments[next - 1];
+    return segment.data[address - segment.address];
+}
+
+void MemoryImage::read(uint32_t address, uint8_t* out, size_t size, uint8_t fill) const {
+    std::fill(out, out + size, fill);
+    uint64_t end = static_cast<uint64_t>(address) + size;
+    size_t next = findSegment(address);
+    for (size_t i = next == 0 ? 0 : next - 1; i < segments.size() && segments[i].address < end; ++i) {
+        const Segment& segment = segments[i];
+        uint32_t from = std::max(address, segment.address);
+        uint64_t to = std::min<uint64_t>(end, segment.end());
+        if (from < to) {
+            std::copy(segment.data.begin() + (from - segment.address), segment.data.begin() + (to - segment.address),
+                      out + (from - address));
+        }
+    }
+}
+
+const std::vector<MemoryImage::Segment>& MemoryImage::getSegments() const {
+    return segments;
+}
+
+bool MemoryImage::empty() const {
+    return segments.empty();
+}
+
+size_t MemoryImage::usedBytes() const {
+    size_t total = 0;
+    for (const Segment& segment : segments) {
+        total += segment.data.size();
+    }
+    return total;
+}
+
+uint32_t MemoryImage::endAddress() const {
+    return segments.empty() ? 0 : segments.back().end();
+}
+
+void MemoryImage::clear() {
+    // Keep the segment buffers for the next image instead of freeing them
+    for (Segment& segment : segments) {
+        segment.data.clear();
+        spare.push_back(std::move(segment.data));
+    }
+    segments.clear();
+    cursor = 0;
+}
+
+void MemoryImage::writeBinary(std::ostream& out, uint32_t minimumSize, uint8_t fill) const {
+    char fillBlock[512];
+    std::memset(fillBlock, fill, sizeof(fillBlock));
+    auto writeFill = [&](uint32_t count) {
+        while (count > 0) {
+            uint32_t chunk = std::min<uint32_t>(count, sizeof(fillBlock));
+            out.write(fillBlock, chunk);
+            count -= chunk;
+        }
+    };
+
+    uint32_t position = 0;
+    for (const Segment& segment : segments) {
+        writeFill(segment.address - position);
+        out.write(reinterpret_cast<const char*>(segment.data.data()), static_cast<std::streamsize>(segment.data.size()));
+        position = segment.end();
+    }
+    if (position < minimumSize) {
+        writeFill(minimumSize - position);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Sparse flash image: a sorted list of non-overlapping contiguous segments.
+// Memory stays proportional to the code size no matter where it is placed.
+class MemoryImage {
+public:
+    struct Segment {
+        uint32_t address;
+        std::vector<uint8_t> data;
+
+        uint32_t end() const { return address + static_cast<uint32_t>(data.size()); }
+    };
+
+    // Places size bytes at address. Appending right after the last write is
+    // O(1); writing over bytes that are already occupied throws.
+    void write(uint32_t address, const uint8_t* data, size_t size);
+    // Overwrites bytes that were written before, e.g. to patch a fixup
+    void patch(uint32_t address, const uint8_t* data, size_t size);
+    // Returns the byte at address, or fill if nothing was written there
+    uint8_t read(uint32_t address, uint8_t fill = 0xFF) const;
+    // Copies size bytes starting at address to out, fill where nothing was written
+    void read(uint32_t address, uint8_t* out, size_t size, uint8_t fill = 0xFF) const;
+
+    const std::vector<Segment>& getSegments() const;
+    bool empty() const;
+    size_t usedBytes() const;
+    // One past the highest occupied address
+    uint32_t endAddress() const;
+    // Empties the image but keeps its buffers for reuse
+    void clear();
+
+    // Writes the image as a flat binary from address 0 up to
+    // max(endAddress(), minimumSize). Gaps are streamed as fill bytes without
+    // ever being held in memory.
+    void writeBinary(std::ostream& out, uint32_t minimumSize, uint8_t fill = 0xFF) const;
+
+private:
+    std::vector<Segment> segments;
+    size_t cursor = 0;  // segment that received the last write
+    std::vector<std::vector<uint8_t>> spare;  // emptied buffers from clear()
+
+    size_t findSegment(uint32_t address) const;
+};
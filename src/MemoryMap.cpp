@@ -0,0 +1,253 @@
+// MemoryMap.cpp
+// Flash usage per label, section and instruction
+
+#include "MemoryMap.hpp"
+#include "Disassembler.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+
+namespace {
+    std::string hexAddress(uint32_t address) {
+        const char* digits = "0123456789ABCDEF";
+        std::string text = "0x0000";
+        for (int i = 5; i >= 2; --i, address >>= 4) {
+            text[i] = digits[address & 0xF];
+        }
+        return text;
+    }
+
+    void writeName(std::ostream& out, const std::string& name) {
+        // Labels are identifiers, so nothing needs escaping
+        if (name.empty()) {
+            out << "null";
+        } else {
+            out << "\"" << name << "\"";
+        }
+    }
+}
+
+void MemoryMap::run(const MemoryImage& image, const SymbolTable& table,
+                    const std::vector<Assembler::SourceLine>& lines) {
+    sections.clear();
+    used = static_cast<uint32_t>(image.usedBytes());
+    end = image.endAddress();
+    for (const MemoryImage::Segment& segment : image.getSegments()) {
+        sections.push_back({segment.address, static_cast<uint32_t>(segment.data.size())});
+    }
+
+    // Decode every instruction start once
+    std::vector<uint32_t> starts;
+    starts.reserve(lines.size());
+    for (const Assembler::SourceLine& line : lines) {
+        starts.push_back(line.address);
+    }
+    std::sort(starts.begin(), starts.end());
+    starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+    std::vector<Instruction> instructions;
+    instructions.reserve(starts.size());
+    for (uint32_t address : starts) {
+        uint16_t word = static_cast<uint16_t>(image.read(address) | image.read(address + 1) << 8);
+        const Opcodes::Descriptor* desc = Disassembler::lookup(word);
+        instructions.push_back({address, desc != nullptr ? desc->size : 2u,
+                                desc != nullptr ? desc->mnemonic : std::string_view("?")});
+    }
+    measure(table, instructions);
+}
+
+void MemoryMap::run(const std::vector<Assembler::Placement>& layout, const SymbolTable& table) {
+    std::vector<Assembler::Placement> placed = layout;
+    std::stable_sort(placed.begin(), placed.end(),
+                     [](const Assembler::Placement& a, const Assembler::Placement& b) { return a.address < b.address; });
+
+    // Adjacent statements form one section, as segments of the image would
+    sections.clear();
+    used = 0;
+    end = 0;
+    std::vector<Instruction> instructions;
+    for (const Assembler::Placement& placement : placed) {
+        if (sections.empty() || sections.back().address + sections.back().size != placement.address) {
+            sections.push_back({placement.address, 0});
+        }
+        sections.back().size += placement.size;
+        used += placement.size;
+        end = std::max(end, placement.address + placement.size);
+        if (placement.desc != nullptr) {
+            instructions.push_back({placement.address, placement.size, placement.desc->mnemonic});
+        }
+    }
+    measure(table, instructions);
+}
+
+void MemoryMap::measure(const SymbolTable& table, const std::vector<Instruction>& instructions) {
+    symbols.clear();
+    opcodes.clear();
+
+    // Numeric local labels are left out, they name nothing
+    std::vector<std::pair<uint32_t, std::string_view>> labels;
+    for (uint32_t id = 0; id < table.size(); ++id) {
+        const SymbolTable::Symbol& symbol = table[id];
+        if (symbol.kind == SymbolTable::Kind::Label && !SymbolTable::isLocal(symbol.name)) {
+            labels.emplace_back(static_cast<uint32_t>(symbol.value), symbol.name);
+        }
+    }
+    std::sort(labels.begin(), labels.end());
+
+    // Labels in gaps or behind the code get no bytes
+    size_t next = 0;
+    for (const Section& section : sections) {
+        uint32_t sectionEnd = section.address + section.size;
+        for (; next < labels.size() && labels[next].first < section.address; ++next) {
+            symbols.push_back({std::string(labels[next].second), labels[next].first, 0, 0, 0});
+        }
+        size_t first = symbols.size();
+        if (next == labels.size() || labels[next].first != section.address) {
+            symbols.push_back({std::string(), section.address, 0, 0, 0});
+        }
+        for (; next < labels.size() && labels[next].first < sectionEnd; ++next) {
+            symbols.push_back({std::string(labels[next].second), labels[next].first, 0, 0, 0});
+        }
+        for (size_t i = first; i < symbols.size(); ++i) {
+            size_t following = i + 1;
+            while (following < symbols.size() && symbols[following].address == symbols[i].address) {
+                ++following;
+            }
+            uint32_t limit = following < symbols.size() ? symbols[following].address : sectionEnd;
+            symbols[i].size = limit - symbols[i].address;
+        }
+    }
+    for (; next < labels.size(); ++next) {
+        symbols.push_back({std::string(labels[next].second), labels[next].first, 0, 0, 0});
+    }
+
+    // offsets[i] is the number of instruction bytes before the i-th instruction
+    std::vector<uint32_t> offsets(instructions.size() + 1, 0);
+    std::map<std::string_view, Opcode> histogram;
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        const Instruction& instruction = instructions[i];
+        offsets[i + 1] = offsets[i] + instruction.size;
+        Opcode& opcode = histogram.emplace(instruction.mnemonic, Opcode{instruction.mnemonic, 0, 0}).first->second;
+        ++opcode.count;
+        opcode.bytes += instruction.size;
+    }
+    auto before = [&instructions](uint32_t address) {
+        return static_cast<size_t>(std::lower_bound(instructions.begin(), instructions.end(), address,
+                                                    [](const Instruction& instruction, uint32_t value) {
+                                                        return instruction.address < value;
+                                                    })
+                                   - instructions.begin());
+    };
+    for (Symbol& symbol : symbols) {
+        size_t from = before(symbol.address);
+        size_t to = before(symbol.address + symbol.size);
+        symbol.instructions = static_cast<uint32_t>(to - from);
+        uint32_t code = std::min(offsets[to] - offsets[from], symbol.size);
+        symbol.dataBytes = symbol.size - code;
+    }
+
+    for (const auto& entry : histogram) {
+        opcodes.push_back(entry.second);
+    }
+    std::stable_sort(opcodes.begin(), opcodes.end(), [](const Opcode& a, const Opcode& b) { return a.count > b.count; });
+}
+
+const std::vector<MemoryMap::Symbol>& MemoryMap::getSymbols() const {
+    return symbols;
+}
+
+const std::vector<MemoryMap::Section>& MemoryMap::getSections() const {
+    return sections;
+}
+
+const std::vector<MemoryMap::Opcode>& MemoryMap::getOpcodes() const {
+    return opcodes;
+}
+
+std::vector<size_t> MemoryMap::largest(size_t count) const {
+    std::vector<size_t> order(symbols.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [this](size_t a, size_t b) { return symbols[a].size > symbols[b].size; });
+    order.resize(std::min(count, order.size()));
+    return order;
+}
+
+uint32_t MemoryMap::usedBytes() const {
+    return used;
+}
+
+uint32_t MemoryMap::freeBytes() const {
+    return used < Assembler::FLASH_SIZE ? Assembler::FLASH_SIZE - used : 0;
+}
+
+uint32_t MemoryMap::headroom() const {
+    return end < Assembler::FLASH_SIZE ? Assembler::FLASH_SIZE - end : 0;
+}
+
+void MemoryMap::writeText(std::ostream& out, size_t count) const {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << "Flash: " << used << " of " << Assembler::FLASH_SIZE << " bytes used (" << std::fixed
+        << std::setprecision(1) << 100.0 * used / Assembler::FLASH_SIZE << " %), " << freeBytes() << " free, "
+        << headroom() << " above the highest code\n";
+    out.flags(flags);
+    out.precision(precision);
+    out << "Sections:\n";
+    for (const Section& section : sections) {
+        out << "  " << hexAddress(section.address) << "-" << hexAddress(section.address + section.size - 1) << "  "
+            << section.size << " bytes\n";
+    }
+    out << "Symbols:\n";
+    for (const Symbol& symbol : symbols) {
+        out << "  " << hexAddress(symbol.address) << "  " << std::setw(5) << symbol.size << " bytes  "
+            << std::setw(4) << symbol.instructions << " instruction(s)";
+        if (symbol.dataBytes != 0) {
+            out << ", " << symbol.dataBytes << " data bytes";
+        }
+        out << "  " << (symbol.name.empty() ? "(no label)" : symbol.name) << "\n";
+    }
+    out << "Largest:\n";
+    for (size_t index : largest(count)) {
+        const Symbol& symbol = symbols[index];
+        out << "  " << std::setw(5) << symbol.size << " bytes  " << (symbol.name.empty() ? "(no label)" : symbol.name)
+            << " at " << hexAddress(symbol.address) << "\n";
+    }
+    out << "Opcodes:\n";
+    for (const Opcode& opcode : opcodes) {
+        out << "  " << std::left << std::setw(6) << opcode.mnemonic << std::right << std::setw(6) << opcode.count
+            << "  " << opcode.bytes << " bytes\n";
+    }
+}
+
+void MemoryMap::writeJson(std::ostream& out, size_t count) const {
+    out << "{\n  \"flash\": {\"size\": " << Assembler::FLASH_SIZE << ", \"used\": " << used << ", \"free\": "
+        << freeBytes() << ", \"headroom\": " << headroom() << "},\n  \"sections\": [";
+    for (size_t i = 0; i < sections.size(); ++i) {
+        out << (i == 0 ? "\n" : ",\n") << "    {\"address\": " << sections[i].address << ", \"size\": "
+            << sections[i].size << "}";
+    }
+    out << "\n  ],\n  \"symbols\": [";
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        const Symbol& symbol = symbols[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": ";
+        writeName(out, symbol.name);
+        out << ", \"address\": " << symbol.address << ", \"size\": " << symbol.size << ", \"instructions\": "
+            << symbol.instructions << ", \"dataBytes\": " << symbol.dataBytes << "}";
+    }
+    out << "\n  ],\n  \"largest\": [";
+    std::vector<size_t> order = largest(count);
+    for (size_t i = 0; i < order.size(); ++i) {
+        const Symbol& symbol = symbols[order[i]];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": ";
+        writeName(out, symbol.name);
+        out << ", \"address\": " << symbol.address << ", \"size\": " << symbol.size << "}";
+    }
+    out << "\n  ],\n  \"opcodes\": [";
+    for (size_t i = 0; i < opcodes.size(); ++i) {
+        out << (i == 0 ? "\n" : ",\n") << "    {\"mnemonic\": \"" << opcodes[i].mnemonic << "\", \"count\": "
+            << opcodes[i].count << ", \"bytes\": " << opcodes[i].bytes << "}";
+    }
+    out << "\n  ]\n}\n";
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "Assembler.hpp"
+#include "MemoryImage.hpp"
+#include "SymbolTable.hpp"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Where the flash goes. Every label gets the bytes from its address up to the
+// next label or the end of its segment; labels on one address share them.
+// Instructions are counted per mnemonic by decoding the addresses in the
+// assembler's line table, so .db/.dw/.incbin bytes count as data.
+class MemoryMap {
+public:
+    struct Symbol {
+        std::string name;       // empty for code before the first label of a segment
+        uint32_t address;
+        uint32_t size;          // bytes
+        uint32_t instructions;
+        uint32_t dataBytes;     // bytes that are no instruction
+    };
+
+    struct Section {
+        uint32_t address;
+        uint32_t size;
+    };
+
+    struct Opcode {
+        std::string_view mnemonic;
+        uint32_t count;
+        uint32_t bytes;
+    };
+
+    void run(const MemoryImage& image, const SymbolTable& symbols, const std::vector<Assembler::SourceLine>& lines);
+    // Map of a program that didn't fit, from Assembler::getOverflowLayout().
+    // Only the labels laid out before the error are defined.
+    void run(const std::vector<Assembler::Placement>& layout, const SymbolTable& symbols);
+
+    const std::vector<Symbol>& getSymbols() const;       // by address
+    const std::vector<Section>& getSections() const;     // by address
+    const std::vector<Opcode>& getOpcodes() const;       // most used first
+    // Indices into getSymbols(), largest first
+    std::vector<size_t> largest(size_t count) const;
+    uint32_t usedBytes() const;
+    uint32_t freeBytes() const;      // flash not occupied by any section
+    uint32_t headroom() const;       // flash above the highest section
+
+    // count limits the list of largest symbols
+    void writeText(std::ostream& out, size_t count = 10) const;
+    void writeJson(std::ostream& out, size_t count = 10) const;
+
+private:
+    struct Instruction {
+        uint32_t address;
+        uint32_t size;
+        std::string_view mnemonic;
+    };
+
+    // Sizes the labels within sections and counts the instructions, which
+    // are sorted by address
+    void measure(const SymbolTable& table, const std::vector<Instruction>& instructions);
+
+    std::vector<Symbol> symbols;
+    std::vector<Section> sections;
+    std::vector<Opcode> opcodes;
+    uint32_t used = 0;
+    uint32_t end = 0;
+};
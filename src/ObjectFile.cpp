@@ -0,0 +1,141 @@
+// ObjectFile.cpp
+// Serialized relocatable modules
+
+#include "ObjectFile.hpp"
+#include "OpcodeMap.hpp"
+#include <cstring>
+
+namespace {
+    // Bump the version whenever the layout or the meaning of a value changes
+    constexpr char MAGIC[8] = {'A', 'V', 'R', 'O', 'B', 'J', '0', '1'};
+
+    // Header: magic, flags, section count, symbol count, relocation count,
+    // name bytes, code bytes. Sections: address, size. Symbols: name offset,
+    // name length in the low 24 bits and binding in the high 8 bits, value.
+    // Relocations: address, opcode index in the low 16 bits and operand index
+    // in the next 8, symbol index. Then the names and the code of every
+    // section. All fields are 32-bit little-endian.
+    constexpr size_t HEADER_SIZE = sizeof(MAGIC) + 24;
+    constexpr size_t SECTION_SIZE = 8;
+    constexpr size_t SYMBOL_SIZE = 12;
+    constexpr size_t RELOCATION_SIZE = 12;
+    constexpr uint32_t ABSOLUTE = 0x01;
+
+    void put32(std::string& out, uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+        }
+    }
+
+    uint32_t get32(const char* data) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+    }
+}
+
+namespace ObjectFile {
+
+void write(const Module& module, std::string& out) {
+    uint32_t nameBytes = 0;
+    for (const Symbol& symbol : module.symbols) {
+        nameBytes += static_cast<uint32_t>(symbol.name.size());
+    }
+    uint32_t codeBytes = 0;
+    for (const MemoryImage::Segment& section : module.sections) {
+        codeBytes += static_cast<uint32_t>(section.data.size());
+    }
+    out.reserve(out.size() + HEADER_SIZE + module.sections.size() * SECTION_SIZE
+                + module.symbols.size() * SYMBOL_SIZE + module.relocations.size() * RELOCATION_SIZE
+                + nameBytes + codeBytes);
+
+    out.append(MAGIC, sizeof(MAGIC));
+    put32(out, module.absolute ? ABSOLUTE : 0);
+    put32(out, static_cast<uint32_t>(module.sections.size()));
+    put32(out, static_cast<uint32_t>(module.symbols.size()));
+    put32(out, static_cast<uint32_t>(module.relocations.size()));
+    put32(out, nameBytes);
+    put32(out, codeBytes);
+    for (const MemoryImage::Segment& section : module.sections) {
+        put32(out, section.address);
+        put32(out, static_cast<uint32_t>(section.data.size()));
+    }
+    uint32_t offset = 0;
+    for (const Symbol& symbol : module.symbols) {
+        put32(out, offset);
+        put32(out, static_cast<uint32_t>(symbol.name.size()) | static_cast<uint32_t>(symbol.binding) << 24);
+        put32(out, symbol.value);
+        offset += static_cast<uint32_t>(symbol.name.size());
+    }
+    for (const Relocation& relocation : module.relocations) {
+        put32(out, relocation.address);
+        put32(out, relocation.opcode | static_cast<uint32_t>(relocation.operand) << 16);
+        put32(out, relocation.symbol);
+    }
+    for (const Symbol& symbol : module.symbols) {
+        out.append(symbol.name);
+    }
+    for (const MemoryImage::Segment& section : module.sections) {
+        out.append(reinterpret_cast<const char*>(section.data.data()), section.data.size());
+    }
+}
+
+bool read(std::string_view data, Module& module) {
+    if (data.size() < HEADER_SIZE || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+    const char* header = data.data() + sizeof(MAGIC);
+    uint64_t sections = get32(header + 4);
+    uint64_t symbols = get32(header + 8);
+    uint64_t relocations = get32(header + 12);
+    uint64_t nameBytes = get32(header + 16);
+    uint64_t codeBytes = get32(header + 20);
+    if (HEADER_SIZE + sections * SECTION_SIZE + symbols * SYMBOL_SIZE + relocations * RELOCATION_SIZE
+        + nameBytes + codeBytes != data.size()) {
+        return false;
+    }
+    module.absolute = (get32(header) & ABSOLUTE) != 0;
+    module.sections.clear();
+    module.symbols.clear();
+    module.relocations.clear();
+
+    const char* entry = data.data() + HEADER_SIZE;
+    const char* names = entry + sections * SECTION_SIZE + symbols * SYMBOL_SIZE + relocations * RELOCATION_SIZE;
+    const char* code = names + nameBytes;
+    uint64_t codeOffset = 0;
+    for (uint64_t i = 0; i < sections; ++i, entry += SECTION_SIZE) {
+        uint32_t size = get32(entry + 4);
+        if (codeOffset + size > codeBytes) {
+            return false;
+        }
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(code + codeOffset);
+        module.sections.push_back({get32(entry), std::vector<uint8_t>(bytes, bytes + size)});
+        codeOffset += size;
+    }
+    if (codeOffset != codeBytes) {
+        return false;
+    }
+    for (uint64_t i = 0; i < symbols; ++i, entry += SYMBOL_SIZE) {
+        uint32_t lengthAndBinding = get32(entry + 4);
+        uint32_t length = lengthAndBinding & 0xFFFFFF;
+        if (static_cast<uint64_t>(get32(entry)) + length > nameBytes
+            || (lengthAndBinding >> 24) > static_cast<uint32_t>(Binding::External)) {
+            return false;
+        }
+        module.symbols.push_back({std::string(names + get32(entry), length),
+                                  static_cast<Binding>(lengthAndBinding >> 24), get32(entry + 8)});
+    }
+    for (uint64_t i = 0; i < relocations; ++i, entry += RELOCATION_SIZE) {
+        uint32_t opcodeAndOperand = get32(entry + 4);
+        Relocation relocation{get32(entry), static_cast<uint16_t>(opcodeAndOperand & 0xFFFF),
+                              static_cast<uint8_t>(opcodeAndOperand >> 16), get32(entry + 8)};
+        if (relocation.opcode >= Opcodes::TABLE_SIZE || relocation.symbol >= symbols
+            || relocation.operand >= Opcodes::TABLE[relocation.opcode].operandCount
+            || !Opcodes::isLabelOperand(Opcodes::TABLE[relocation.opcode].operands[relocation.operand])) {
+            return false;
+        }
+        module.relocations.push_back(relocation);
+    }
+    return true;
+}
+
+}
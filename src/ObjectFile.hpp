@@ -0,0 +1,44 @@
+#pragma once
+#include "MemoryImage.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Relocatable output of one separately assembled source. A module without
+// .org is relocatable: the linker places it after the absolute modules and
+// patches the relocations. Modules that use .org are placed as written.
+namespace ObjectFile {
+    enum class Binding : uint8_t {
+        Local,    // label of this module, only referenced by its relocations
+        Global,   // label exported with .global
+        External  // defined by another module
+    };
+
+    struct Symbol {
+        std::string name;
+        Binding binding;
+        uint32_t value;  // byte address within the module, 0 for External
+    };
+
+    // Label operand the linker fills in
+    struct Relocation {
+        uint32_t address;  // byte address of the instruction within the module
+        uint16_t opcode;   // index into Opcodes::TABLE
+        uint8_t operand;   // operand index of the label
+        uint32_t symbol;   // index into Module::symbols
+    };
+
+    struct Module {
+        bool absolute = false;
+        std::vector<MemoryImage::Segment> sections;
+        std::vector<Symbol> symbols;
+        std::vector<Relocation> relocations;
+    };
+
+    // Appends the binary form of module to out
+    void write(const Module& module, std::string& out);
+    // Returns false if data is not a complete object file of this assembler
+    // version or refers to symbols or opcodes that don't exist
+    bool read(std::string_view data, Module& module);
+}
@@ -1,28 +1,284 @@
 #pragma once
-#include <unordered_map>
-#include <string>
+#include <string_view>
+#include <cstddef>
 #include <cstdint>
 
 namespace Opcodes {
-    const std::unordered_map<std::string, uint16_t> MAP = {
-        {"NOP", 0x0000},
-        {"LDI", 0xE000},
-        {"ADD", 0x0C00},
-        {"SUB", 0x1800},
-        {"JMP", 0x940C},
-        {"OUT", 0xB800},
-        {"IN", 0xB000},
-        {"CALL", 0x940E},
-        {"RET", 0x9508},
-        {"LD", 0x900C},
-        {"ST", 0x920C},
-        {"CP", 0x1400},
-        {"BRNE", 0xF401},
-        {"BRGE", 0xF404},
-        {"BRLT", 0xF400},
-        {"DEC", 0x940A},
-        {"CLR", 0x2400},
-        {"RCALL", 0xD000},
-        {"RJMP", 0x940C}
+    // Kind of value accepted by an operand slot
+    enum class OperandKind : uint8_t {
+        None,
+        Register,       // R0-R31
+        UpperRegister,  // R16-R31, encoded as Rd - 16
+        Immediate8,     // 0-255
+        IoAddress,      // 0-63
+        PointerX,       // the literal X, implied by the opcode
+        Absolute22,     // label, encoded as a word address
+        Relative12,     // label, encoded as a word offset from PC + 1 (-2048..2047)
+        Relative7       // label, encoded as a word offset from PC + 1 (-64..63)
     };
-}
\ No newline at end of file
+
+    // Scatters the value of one operand into the set bits of mask, lowest value
+    // bit into lowest mask bit. Two-word instructions keep their first word in
+    // the upper 16 bits of opcode and mask.
+    struct Field {
+        uint8_t operand;
+        uint32_t mask;
+    };
+
+    struct Descriptor {
+        std::string_view mnemonic;
+        uint32_t opcode;
+        uint8_t size;          // bytes
+        uint8_t cycles;        // cycles when a branch is not taken
+        uint8_t cyclesTaken;   // cycles when a branch is taken
+        uint8_t operandCount;
+        OperandKind operands[2];
+        uint8_t fieldCount;
+        Field fields[2];
+    };
+
+    using K = OperandKind;
+
+    // New opcodes are added here, the encoder and the lookup pick them up.
+    inline constexpr Descriptor TABLE[] = {
+        // Format: NOP (0000 0000 0000 0000)
+        {"NOP",   0x0000,     2, 1, 1, 0, {},                              0, {}},
+        // Format: LDI Rd,K (1110 KKKK dddd KKKK)
+        {"LDI",   0xE000,     2, 1, 1, 2, {K::UpperRegister, K::Immediate8}, 2, {{0, 0x00F0}, {1, 0x0F0F}}},
+        // Format: ADD Rd,Rr (0000 11rd dddd rrrr)
+        {"ADD",   0x0C00,     2, 1, 1, 2, {K::Register, K::Register},     2, {{0, 0x01F0}, {1, 0x020F}}},
+        // Format: SUB Rd,Rr (0001 10rd dddd rrrr)
+        {"SUB",   0x1800,     2, 1, 1, 2, {K::Register, K::Register},     2, {{0, 0x01F0}, {1, 0x020F}}},
+        // Format: JMP k (1001 010k kkkk 110k kkkk kkkk kkkk kkkk)
+        {"JMP",   0x940C0000, 4, 3, 3, 1, {K::Absolute22},                1, {{0, 0x01F1FFFF}}},
+        // Format: OUT A,Rr (1011 1AAr rrrr AAAA)
+        {"OUT",   0xB800,     2, 1, 1, 2, {K::IoAddress, K::Register},    2, {{0, 0x060F}, {1, 0x01F0}}},
+        // Format: IN Rd,A (1011 0AAd dddd AAAA)
+        {"IN",    0xB000,     2, 1, 1, 2, {K::Register, K::IoAddress},    2, {{0, 0x01F0}, {1, 0x060F}}},
+        // Format: CALL k (1001 010k kkkk 111k kkkk kkkk kkkk kkkk)
+        {"CALL",  0x940E0000, 4, 4, 4, 1, {K::Absolute22},                1, {{0, 0x01F1FFFF}}},
+        // Format: RET (1001 0101 0000 1000)
+        {"RET",   0x9508,     2, 4, 4, 0, {},                              0, {}},
+        // Format: LD Rd,X (1001 000d dddd 1100)
+        {"LD",    0x900C,     2, 2, 2, 2, {K::Register, K::PointerX},     1, {{0, 0x01F0}}},
+        // Format: ST X,Rr (1001 001r rrrr 1100)
+        {"ST",    0x920C,     2, 2, 2, 2, {K::PointerX, K::Register},     1, {{1, 0x01F0}}},
+        // Format: PUSH Rr (1001 001r rrrr 1111)
+        {"PUSH",  0x920F,     2, 2, 2, 1, {K::Register},                  1, {{0, 0x01F0}}},
+        // Format: POP Rd (1001 000d dddd 1111)
+        {"POP",   0x900F,     2, 2, 2, 1, {K::Register},                  1, {{0, 0x01F0}}},
+        // Format: CP Rd,Rr (0001 01rd dddd rrrr)
+        {"CP",    0x1400,     2, 1, 1, 2, {K::Register, K::Register},     2, {{0, 0x01F0}, {1, 0x020F}}},
+        // Format: BRNE k (1111 01kk kkkk k001)
+        {"BRNE",  0xF401,     2, 1, 2, 1, {K::Relative7},                 1, {{0, 0x03F8}}},
+        // Format: BREQ k (1111 00kk kkkk k001)
+        {"BREQ",  0xF001,     2, 1, 2, 1, {K::Relative7},                 1, {{0, 0x03F8}}},
+        // Format: BRGE k (1111 01kk kkkk k100)
+        {"BRGE",  0xF404,     2, 1, 2, 1, {K::Relative7},                 1, {{0, 0x03F8}}},
+        // Format: BRLT k (1111 00kk kkkk k100)
+        {"BRLT",  0xF004,     2, 1, 2, 1, {K::Relative7},                 1, {{0, 0x03F8}}},
+        // Format: DEC Rd (1001 010d dddd 1010)
+        {"DEC",   0x940A,     2, 1, 1, 1, {K::Register},                  1, {{0, 0x01F0}}},
+        // Format: CLR Rd (EOR Rd,Rd: 0010 01dd dddd dddd)
+        {"CLR",   0x2400,     2, 1, 1, 1, {K::Register},                  2, {{0, 0x01F0}, {0, 0x020F}}},
+        // Format: RCALL k (1101 kkkk kkkk kkkk)
+        {"RCALL", 0xD000,     2, 3, 3, 1, {K::Relative12},                1, {{0, 0x0FFF}}},
+        // Format: RJMP k (1100 kkkk kkkk kkkk)
+        {"RJMP",  0xC000,     2, 2, 2, 1, {K::Relative12},                1, {{0, 0x0FFF}}}
+    };
+
+    inline constexpr size_t TABLE_SIZE = sizeof(TABLE) / sizeof(TABLE[0]);
+
+    constexpr bool isLabelOperand(OperandKind kind) {
+        return kind == K::Absolute22 || kind == K::Relative12 || kind == K::Relative7;
+    }
+
+    constexpr int32_t operandMin(OperandKind kind) {
+        switch (kind) {
+            case K::UpperRegister: return 16;
+            case K::Relative12: return -2048;
+            case K::Relative7: return -64;
+            default: return 0;
+        }
+    }
+
+    constexpr int32_t operandMax(OperandKind kind) {
+        switch (kind) {
+            case K::Register:
+            case K::UpperRegister: return 31;
+            case K::Immediate8: return 0xFF;
+            case K::IoAddress: return 0x3F;
+            case K::Absolute22: return 0x3FFFFF;
+            case K::Relative12: return 2047;
+            case K::Relative7: return 63;
+            default: return 0;
+        }
+    }
+
+    // Places the low bits of value into the set bits of mask (a software PDEP)
+    constexpr uint32_t deposit(uint32_t value, uint32_t mask) {
+        uint32_t result = 0;
+        for (uint32_t bit = 1; mask != 0; bit <<= 1) {
+            uint32_t lowest = mask & (~mask + 1);
+            if (value & bit) {
+                result |= lowest;
+            }
+            mask &= mask - 1;
+        }
+        return result;
+    }
+
+    // Encodes an instruction from operand values that were already range checked.
+    // Upper registers are passed as their register number.
+    constexpr uint32_t encode(const Descriptor& desc, const int32_t* values) {
+        uint32_t code = desc.opcode;
+        for (uint8_t i = 0; i < desc.fieldCount; ++i) {
+            const Field& field = desc.fields[i];
+            int32_t value = values[field.operand];
+            if (desc.operands[field.operand] == K::UpperRegister) {
+                value -= 16;
+            }
+            code |= deposit(static_cast<uint32_t>(value), field.mask);
+        }
+        return code;
+    }
+
+    // Collects the bits of value selected by mask into the low bits (a software
+    // PEXT), the inverse of deposit()
+    constexpr uint32_t extract(uint32_t value, uint32_t mask) {
+        uint32_t result = 0;
+        for (uint32_t bit = 1; mask != 0; bit <<= 1) {
+            uint32_t lowest = mask & (~mask + 1);
+            if (value & lowest) {
+                result |= bit;
+            }
+            mask &= mask - 1;
+        }
+        return result;
+    }
+
+    constexpr uint32_t bitCount(uint32_t value) {
+        uint32_t count = 0;
+        for (; value != 0; value &= value - 1) {
+            ++count;
+        }
+        return count;
+    }
+
+    // Recovers the operand values of an encoded instruction, the inverse of
+    // encode(). Returns false if code is not an instance of desc. Relative
+    // operands come back sign-extended, upper registers as register numbers.
+    constexpr bool decode(const Descriptor& desc, uint32_t code, int32_t* values) {
+        uint32_t variable = 0;
+        for (uint8_t i = 0; i < desc.fieldCount; ++i) {
+            variable |= desc.fields[i].mask;
+        }
+        uint32_t width = desc.size == 4 ? 0xFFFFFFFFu : 0xFFFFu;
+        if ((code & width & ~variable) != desc.opcode) {
+            return false;
+        }
+
+        bool assigned[2] = {false, false};
+        values[0] = values[1] = 0;
+        for (uint8_t i = 0; i < desc.fieldCount; ++i) {
+            const Field& field = desc.fields[i];
+            OperandKind kind = desc.operands[field.operand];
+            int32_t value = static_cast<int32_t>(extract(code, field.mask));
+            if (operandMin(kind) < 0 && (value & (1 << (bitCount(field.mask) - 1)))) {
+                value -= 1 << bitCount(field.mask);
+            } else if (kind == K::UpperRegister) {
+                value += 16;
+            }
+            // Operands spread over two fields (CLR as EOR Rd,Rd) must agree
+            if (assigned[field.operand] && values[field.operand] != value) {
+                return false;
+            }
+            values[field.operand] = value;
+            assigned[field.operand] = true;
+        }
+        return true;
+    }
+
+    // Conditional branch that tests the opposite flag state (BRNE <-> BREQ).
+    // BRBS and BRBC differ only in bit 10. Returns nullptr if the inverse is not
+    // in TABLE.
+    constexpr const Descriptor* invertedBranch(const Descriptor& desc) {
+        if (desc.operands[0] != K::Relative7) {
+            return nullptr;
+        }
+        for (const auto& candidate : TABLE) {
+            if (candidate.operands[0] == K::Relative7 && candidate.opcode == (desc.opcode ^ 0x0400)) {
+                return &candidate;
+            }
+        }
+        return nullptr;
+    }
+
+    // Perfect hash over TABLE. The seed is searched at compile time, so adding
+    // a row never needs hand-tuned constants.
+    inline constexpr size_t SLOT_COUNT = 256;
+    inline constexpr uint8_t EMPTY_SLOT = 0xFF;
+    static_assert(TABLE_SIZE < EMPTY_SLOT, "Opcode table too large for the slot index");
+
+    constexpr size_t slotOf(std::string_view mnemonic, uint32_t seed) {
+        uint32_t hash = 2166136261u ^ seed;
+        for (char c : mnemonic) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 16777619u;
+        }
+        return (hash ^ (hash >> 15)) & (SLOT_COUNT - 1);
+    }
+
+    constexpr uint32_t findSeed() {
+        for (uint32_t seed = 0;; ++seed) {
+            bool used[SLOT_COUNT] = {};
+            bool perfect = true;
+            for (const auto& desc : TABLE) {
+                size_t slot = slotOf(desc.mnemonic, seed);
+                if (used[slot]) {
+                    perfect = false;
+                    break;
+                }
+                used[slot] = true;
+            }
+            if (perfect) {
+                return seed;
+            }
+        }
+    }
+
+    struct SlotTable {
+        uint32_t seed;
+        uint8_t index[SLOT_COUNT];
+    };
+
+    constexpr SlotTable buildSlots() {
+        SlotTable slots{findSeed(), {}};
+        for (size_t i = 0; i < SLOT_COUNT; ++i) {
+            slots.index[i] = EMPTY_SLOT;
+        }
+        for (size_t i = 0; i < TABLE_SIZE; ++i) {
+            slots.index[slotOf(TABLE[i].mnemonic, slots.seed)] = static_cast<uint8_t>(i);
+        }
+        return slots;
+    }
+
+    inline constexpr SlotTable SLOTS = buildSlots();
+
+    // Read-only view over TABLE with constant-time lookup by mnemonic
+    class OpcodeView {
+    public:
+        constexpr const Descriptor* find(std::string_view mnemonic) const {
+            uint8_t index = SLOTS.index[slotOf(mnemonic, SLOTS.seed)];
+            if (index == EMPTY_SLOT || TABLE[index].mnemonic != mnemonic) {
+                return nullptr;
+            }
+            return &TABLE[index];
+        }
+        constexpr const Descriptor* begin() const { return TABLE; }
+        constexpr const Descriptor* end() const { return TABLE + TABLE_SIZE; }
+        constexpr size_t size() const { return TABLE_SIZE; }
+    };
+
+    inline constexpr OpcodeView MAP{};
+}
@@ -0,0 +1,323 @@
+// Peephole.cpp
+// Optional rewrites of the resolved instruction stream
+
+#include "Peephole.hpp"
+#include "Encoder.hpp"
+#include <stdexcept>
+#include <string>
+
+namespace {
+    constexpr size_t NONE = static_cast<size_t>(-1);
+
+    constexpr std::string_view RULE_NAMES[Peephole::RULE_COUNT] = {
+        "clr-ldi", "repeated-out", "jump-to-next", "jump-chain"
+    };
+
+    bool hasLabelOperand(const Opcodes::Descriptor& desc) {
+        return desc.operandCount == 1 && Opcodes::isLabelOperand(desc.operands[0]);
+    }
+
+    bool isUnconditionalJump(const Opcodes::Descriptor& desc) {
+        return desc.mnemonic == "RJMP" || desc.mnemonic == "JMP";
+    }
+
+    constexpr int32_t SREG_IO = 0x3F;
+
+    // Instructions that set S, V, N and Z, everything CLR sets, without
+    // reading SREG first. OUT to SREG replaces all of it.
+    bool writesFlags(const Peephole::Instruction& ins) {
+        std::string_view mnemonic = ins.desc->mnemonic;
+        return mnemonic == "ADD" || mnemonic == "SUB" || mnemonic == "CP" || mnemonic == "DEC" || mnemonic == "CLR"
+            || (mnemonic == "OUT" && ins.values[0] == SREG_IO);
+    }
+
+    // Instructions known not to read SREG. IN from SREG reads it, and so may
+    // LD, whose X pointer can address SREG in the data space; jumps, branches,
+    // calls, returns and anything not listed here count as readers.
+    bool ignoresFlags(const Peephole::Instruction& ins) {
+        std::string_view mnemonic = ins.desc->mnemonic;
+        return mnemonic == "NOP" || mnemonic == "LDI" || mnemonic == "OUT" || mnemonic == "ST"
+            || mnemonic == "PUSH" || mnemonic == "POP" || (mnemonic == "IN" && ins.values[1] != SREG_IO);
+    }
+
+    // I/O registers that only store what is written to them, so writing the
+    // same value twice has no effect: PORTx, DDRx and GPIORx. Everything else
+    // may count, clear flags or start an operation on a write, e.g. PINx,
+    // TIFRx, TCNT0, SPDR, EECR, SPL/SPH and SREG.
+    bool isPlainStorage(int32_t ioAddress) {
+        switch (ioAddress) {
+            case 0x04: case 0x05:  // DDRB, PORTB
+            case 0x07: case 0x08:  // DDRC, PORTC
+            case 0x0A: case 0x0B:  // DDRD, PORTD
+            case 0x1E: case 0x2A: case 0x2B:  // GPIOR0-2
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    std::string hexAddress(uint32_t address) {
+        const char digits[] = "0123456789ABCDEF";
+        std::string text = "0x0000";
+        for (int i = 5; i >= 2; --i) {
+            text[i] = digits[address & 0x0F];
+            address >>= 4;
+        }
+        return text;
+    }
+}
+
+namespace Peephole {
+
+std::string_view ruleName(Rule rule) {
+    return RULE_NAMES[static_cast<size_t>(rule)];
+}
+
+bool parseRule(std::string_view name, Rule& rule) {
+    for (size_t i = 0; i < RULE_COUNT; ++i) {
+        if (RULE_NAMES[i] == name) {
+            rule = static_cast<Rule>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Options::any() const {
+    for (bool rule : enabled) {
+        if (rule) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Optimizer::Optimizer(const Options& options) : options(options) {
+}
+
+const Report& Optimizer::getReport() const {
+    return report;
+}
+
+uint32_t Optimizer::relocate(uint32_t address) const {
+    auto it = moved.find(address);
+    return it == moved.end() ? address : it->second;
+}
+
+void Optimizer::run(std::vector<Instruction>& code, const std::vector<uint32_t>& labels) {
+    program = &code;
+    indexOf.clear();
+    targets.clear();
+    moved.clear();
+    for (RuleReport& rule : report) {
+        rule = RuleReport();
+    }
+
+    // Turn label operands into absolute addresses, so rules can move code
+    // without tracking relative offsets
+    targets.insert(labels.begin(), labels.end());
+    for (size_t i = 0; i < code.size(); ++i) {
+        Instruction& ins = code[i];
+        indexOf.emplace(ins.address, i);
+        if (hasLabelOperand(*ins.desc)) {
+            ins.target = Encoder::labelTarget(ins.desc->operands[0], ins.values[0], ins.address);
+            targets.insert(ins.target);
+        }
+    }
+
+    // Rules only shrink the code or shorten jump chains, so this terminates
+    bool (Optimizer::*const rules[RULE_COUNT])(size_t) = {
+        &Optimizer::clearBeforeLoad, &Optimizer::repeatedOut, &Optimizer::jumpToNext, &Optimizer::jumpChain
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 0; i < code.size(); ++i) {
+            for (size_t rule = 0; rule < RULE_COUNT; ++rule) {
+                if (options.enabled[rule] && !code[i].removed && (this->*rules[rule])(i)) {
+                    changed = true;
+                }
+            }
+        }
+    }
+    layout();
+    program = nullptr;
+}
+
+size_t Optimizer::successor(size_t index) const {
+    // Code placed by .org starts a new run, it is never adjacent
+    const std::vector<Instruction>& code = *program;
+    if (index + 1 < code.size() && code[index + 1].address == code[index].address + code[index].desc->size) {
+        return index + 1;
+    }
+    return NONE;
+}
+
+size_t Optimizer::next(size_t index) const {
+    do {
+        index = successor(index);
+    } while (index != NONE && (*program)[index].removed);
+    return index;
+}
+
+size_t Optimizer::resolve(uint32_t address) const {
+    auto it = indexOf.find(address);
+    if (it == indexOf.end()) {
+        return NONE;
+    }
+    size_t index = it->second;
+    return (*program)[index].removed ? next(index) : index;
+}
+
+bool Optimizer::flagsDeadAfter(size_t index) const {
+    // Straight-line scan: the flags are dead if they are overwritten before
+    // any instruction that might read them
+    for (size_t i = next(index); i != NONE; i = next(i)) {
+        const Instruction& ins = (*program)[i];
+        if (writesFlags(ins)) {
+            return true;
+        }
+        if (!ignoresFlags(ins)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+void Optimizer::remove(size_t index, Rule rule, int32_t cycles) {
+    Instruction& ins = (*program)[index];
+    ins.removed = true;
+    RuleReport& entry = report[static_cast<size_t>(rule)];
+    ++entry.applied;
+    entry.bytesSaved += ins.desc->size;
+    entry.cyclesSaved += cycles;
+}
+
+bool Optimizer::clearBeforeLoad(size_t index) {
+    const Instruction& clear = (*program)[index];
+    size_t load = next(index);
+    if (clear.desc->mnemonic != "CLR" || load == NONE) {
+        return false;
+    }
+    const Instruction& ldi = (*program)[load];
+    if (ldi.desc->mnemonic != "LDI" || ldi.values[0] != clear.values[0] || !flagsDeadAfter(load)) {
+        return false;
+    }
+    remove(index, Rule::ClearBeforeLoad, clear.desc->cycles);
+    return true;
+}
+
+bool Optimizer::repeatedOut(size_t index) {
+    const Instruction& first = (*program)[index];
+    size_t second = next(index);
+    if (first.desc->mnemonic != "OUT" || second == NONE || !isPlainStorage(first.values[0])) {
+        return false;
+    }
+    const Instruction& repeat = (*program)[second];
+    if (repeat.desc != first.desc || repeat.values[0] != first.values[0] || repeat.values[1] != first.values[1]) {
+        return false;
+    }
+    // Code that jumps to the second OUT, or to removed code before it, relies on it
+    for (size_t i = successor(index); i != NONE && i <= second; i = successor(i)) {
+        if (targets.count((*program)[i].address) != 0) {
+            return false;
+        }
+    }
+    remove(second, Rule::RepeatedOut, repeat.desc->cycles);
+    return true;
+}
+
+bool Optimizer::jumpToNext(size_t index) {
+    const Instruction& jump = (*program)[index];
+    const Opcodes::Descriptor& desc = *jump.desc;
+    if (!isUnconditionalJump(desc) && desc.operands[0] != Opcodes::OperandKind::Relative7) {
+        return false;
+    }
+    size_t following = next(index);
+    if (following == NONE || resolve(jump.target) != following) {
+        return false;
+    }
+    remove(index, Rule::JumpToNext, isUnconditionalJump(desc) ? desc.cyclesTaken : desc.cycles);
+    return true;
+}
+
+bool Optimizer::jumpChain(size_t index) {
+    Instruction& ins = (*program)[index];
+    const Opcodes::Descriptor& desc = *ins.desc;
+    if (!hasLabelOperand(desc)) {
+        return false;
+    }
+
+    // Follow the chain of unconditional jumps. A chain longer than the
+    // program is a loop, which is left alone.
+    uint32_t target = ins.target;
+    int32_t cycles = 0;
+    size_t hops = 0;
+    for (size_t hop = resolve(target); hop != NONE && isUnconditionalJump(*(*program)[hop].desc);
+         hop = resolve(target)) {
+        if (hop == index || ++hops > program->size()) {
+            return false;
+        }
+        target = (*program)[hop].target;
+        cycles += (*program)[hop].desc->cyclesTaken;
+    }
+    if (hops == 0) {
+        return false;
+    }
+
+    // Relative operands must still reach the final target
+    Opcodes::OperandKind kind = desc.operands[0];
+    int32_t value = Encoder::labelValue(kind, target, ins.address);
+    if (value < Opcodes::operandMin(kind) || value > Opcodes::operandMax(kind)) {
+        return false;
+    }
+    ins.target = target;
+    RuleReport& entry = report[static_cast<size_t>(Rule::JumpChain)];
+    ++entry.applied;
+    entry.cyclesSaved += cycles;
+    return true;
+}
+
+void Optimizer::layout() {
+    std::vector<Instruction>& code = *program;
+
+    // Close the gaps inside every run of adjacent code. Removed instructions
+    // map to the instruction that follows them.
+    uint32_t cursor = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        Instruction& ins = code[i];
+        if (i == 0 || code[i - 1].address + code[i - 1].desc->size != ins.address) {
+            if (i != 0) {
+                moved.emplace(code[i - 1].address + code[i - 1].desc->size, cursor);
+            }
+            cursor = ins.address;
+        }
+        moved.emplace(ins.address, cursor);
+        if (!ins.removed) {
+            cursor += ins.desc->size;
+        }
+    }
+    if (!code.empty()) {
+        moved.emplace(code.back().address + code.back().desc->size, cursor);
+    }
+
+    size_t kept = 0;
+    for (Instruction& ins : code) {
+        if (ins.removed) {
+            continue;
+        }
+        ins.address = relocate(ins.address);
+        if (hasLabelOperand(*ins.desc)) {
+            Opcodes::OperandKind kind = ins.desc->operands[0];
+            ins.target = relocate(ins.target);
+            ins.values[0] = Encoder::labelValue(kind, ins.target, ins.address);
+            if (ins.values[0] < Opcodes::operandMin(kind) || ins.values[0] > Opcodes::operandMax(kind)) {
+                throw std::runtime_error(std::string(ins.desc->mnemonic) + " at " + hexAddress(ins.address)
+                                         + " is out of range after peephole optimization");
+            }
+        }
+        code[kept++] = ins;
+    }
+    code.resize(kept);
+}
+
+}
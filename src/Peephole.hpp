@@ -0,0 +1,81 @@
+#pragma once
+#include "OpcodeMap.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Optional rewrites of the resolved instruction stream, run after the second
+// pass and before the code is written. Every rule can be switched on its own.
+namespace Peephole {
+    enum class Rule : uint8_t {
+        ClearBeforeLoad,  // CLR Rn; LDI Rn,K -> LDI Rn,K when the flags are dead
+        RepeatedOut,      // OUT A,Rr; OUT A,Rr -> OUT A,Rr for PORTx, DDRx and GPIORx
+        JumpToNext,       // RJMP/JMP/BRxx to the following instruction is dropped
+        JumpChain         // jumps, calls and branches to an RJMP/JMP go to its target
+    };
+    inline constexpr size_t RULE_COUNT = 4;
+
+    // Command line name of a rule ("clr-ldi", "repeated-out", "jump-to-next", "jump-chain")
+    std::string_view ruleName(Rule rule);
+    // Returns false if name is not a rule name
+    bool parseRule(std::string_view name, Rule& rule);
+
+    struct Options {
+        bool enabled[RULE_COUNT] = {};
+        bool any() const;
+    };
+
+    struct RuleReport {
+        size_t applied = 0;
+        int32_t bytesSaved = 0;
+        int32_t cyclesSaved = 0;
+    };
+    using Report = RuleReport[RULE_COUNT];
+
+    // One encoded instruction with its operand fields kept apart
+    struct Instruction {
+        const Opcodes::Descriptor* desc;
+        int32_t values[2];   // operand values as passed to Opcodes::encode()
+        uint32_t address;
+        uint32_t target;     // byte address a label operand refers to
+        uint32_t line;       // source line
+        bool removed;
+    };
+
+    class Optimizer {
+    public:
+        explicit Optimizer(const Options& options);
+
+        // Rewrites program in place and assigns the final addresses. Instructions
+        // must be in source order, labels holds every label address. Addresses set
+        // by .org stay where they are. Throws std::runtime_error if a relative
+        // operand no longer reaches its target.
+        void run(std::vector<Instruction>& program, const std::vector<uint32_t>& labels);
+
+        // Address after the last run() of the code that was at address
+        uint32_t relocate(uint32_t address) const;
+        const Report& getReport() const;
+
+    private:
+        Options options;
+        Report report;
+        std::vector<Instruction>* program = nullptr;
+        std::unordered_map<uint32_t, size_t> indexOf;
+        std::unordered_set<uint32_t> targets;
+        std::unordered_map<uint32_t, uint32_t> moved;
+
+        size_t successor(size_t index) const;
+        size_t next(size_t index) const;
+        size_t resolve(uint32_t address) const;
+        bool flagsDeadAfter(size_t index) const;
+        void remove(size_t index, Rule rule, int32_t cycles);
+        bool clearBeforeLoad(size_t index);
+        bool repeatedOut(size_t index);
+        bool jumpToNext(size_t index);
+        bool jumpChain(size_t index);
+        void layout();
+    };
+}
@@ -0,0 +1,90 @@
+// Precompiled.cpp
+// Serialized header definitions
+
+#include "Precompiled.hpp"
+#include <cstring>
+
+namespace {
+    // Bump the version whenever the layout or the meaning of a value changes
+    constexpr char MAGIC[8] = {'A', 'V', 'R', 'P', 'C', 'H', '0', '1'};
+
+    // Header: magic, symbol count, name bytes. Entries: name offset, name
+    // length in the low 24 bits and kind in the high 8 bits, value. All fields
+    // are 32-bit little-endian.
+    constexpr size_t HEADER_SIZE = sizeof(MAGIC) + 8;
+    constexpr size_t ENTRY_SIZE = 12;
+
+    void put32(std::string& out, uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+        }
+    }
+
+    uint32_t get32(const char* data) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+    }
+}
+
+namespace Precompiled {
+
+void write(const std::vector<Symbol>& symbols, std::string& out) {
+    uint32_t nameBytes = 0;
+    for (const Symbol& symbol : symbols) {
+        nameBytes += static_cast<uint32_t>(symbol.name.size());
+    }
+    out.reserve(out.size() + HEADER_SIZE + symbols.size() * ENTRY_SIZE + nameBytes);
+
+    out.append(MAGIC, sizeof(MAGIC));
+    put32(out, static_cast<uint32_t>(symbols.size()));
+    put32(out, nameBytes);
+    uint32_t offset = 0;
+    for (const Symbol& symbol : symbols) {
+        put32(out, offset);
+        put32(out, static_cast<uint32_t>(symbol.name.size()) | static_cast<uint32_t>(symbol.kind) << 24);
+        put32(out, static_cast<uint32_t>(symbol.value));
+        offset += static_cast<uint32_t>(symbol.name.size());
+    }
+    for (const Symbol& symbol : symbols) {
+        out.append(symbol.name.data(), symbol.name.size());
+    }
+}
+
+bool View::open(std::string_view data) {
+    if (data.size() < HEADER_SIZE || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+    uint64_t symbols = get32(data.data() + sizeof(MAGIC));
+    uint64_t nameBytes = get32(data.data() + sizeof(MAGIC) + 4);
+    if (HEADER_SIZE + symbols * ENTRY_SIZE + nameBytes != data.size()) {
+        return false;
+    }
+    entries = data.data() + HEADER_SIZE;
+    names = entries + symbols * ENTRY_SIZE;
+    count = static_cast<size_t>(symbols);
+
+    // Validate every entry once, so operator[] needs no checks
+    for (size_t i = 0; i < count; ++i) {
+        const char* entry = entries + i * ENTRY_SIZE;
+        uint32_t lengthAndKind = get32(entry + 4);
+        if (static_cast<uint64_t>(get32(entry)) + (lengthAndKind & 0xFFFFFF) > nameBytes
+            || (lengthAndKind >> 24) > static_cast<uint32_t>(Kind::Register)) {
+            count = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t View::size() const {
+    return count;
+}
+
+Symbol View::operator[](size_t index) const {
+    const char* entry = entries + index * ENTRY_SIZE;
+    uint32_t lengthAndKind = get32(entry + 4);
+    return {std::string_view(names + get32(entry), lengthAndKind & 0xFFFFFF),
+            static_cast<Kind>(lengthAndKind >> 24), static_cast<int32_t>(get32(entry + 8))};
+}
+
+}
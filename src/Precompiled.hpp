@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Binary form of the definitions in a header that holds nothing but .equ,
+// .set and .def lines. A View reads it in place, e.g. from a memory mapped
+// file, so installing a large device header needs no lexing at all.
+namespace Precompiled {
+    enum class Kind : uint8_t {
+        Constant,  // .equ
+        Variable,  // .set
+        Register   // .def
+    };
+
+    struct Symbol {
+        std::string_view name;
+        Kind kind;
+        int32_t value;  // register number for .def
+    };
+
+    // Appends the binary form of symbols, in definition order, to out
+    void write(const std::vector<Symbol>& symbols, std::string& out);
+
+    // Read-only access to write() output
+    class View {
+    public:
+        // Returns false if data is not a complete precompiled header of this
+        // assembler version
+        bool open(std::string_view data);
+        size_t size() const;
+        Symbol operator[](size_t index) const;
+
+    private:
+        const char* entries = nullptr;
+        const char* names = nullptr;
+        size_t count = 0;
+    };
+}
@@ -0,0 +1,114 @@
+// SymbolTable.cpp
+// Interned, arena-backed symbol table
+
+#include "SymbolTable.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+    // FNV-1a; symbol names are short, so this beats anything wider
+    uint32_t hashName(std::string_view name) {
+        uint32_t hash = 2166136261u;
+        for (char c : name) {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+        }
+        return hash;
+    }
+}
+
+SymbolTable::SymbolTable() : slots(1024, NONE) {}
+
+void SymbolTable::clear() {
+    symbols.clear();
+    hashes.clear();
+    std::fill(slots.begin(), slots.end(), NONE);
+    blockIndex = 0;
+    blockUsed = 0;
+}
+
+uint32_t SymbolTable::intern(std::string_view name) {
+    uint32_t hash = hashName(name);
+    size_t mask = slots.size() - 1;
+    size_t slot = hash & mask;
+    for (; slots[slot] != NONE; slot = (slot + 1) & mask) {
+        uint32_t id = slots[slot];
+        if (hashes[id] == hash && symbols[id].name == name) {
+            return id;
+        }
+    }
+
+    uint32_t id = static_cast<uint32_t>(symbols.size());
+    symbols.push_back({store(name), Kind::Undefined, 0, 0});
+    hashes.push_back(hash);
+    slots[slot] = id;
+    if (symbols.size() * 2 > slots.size()) {
+        grow();
+    }
+    return id;
+}
+
+uint32_t SymbolTable::find(std::string_view name) const {
+    return find(name, hashName(name));
+}
+
+uint32_t SymbolTable::find(std::string_view name, uint32_t hash) const {
+    size_t mask = slots.size() - 1;
+    for (size_t slot = hash & mask; slots[slot] != NONE; slot = (slot + 1) & mask) {
+        uint32_t id = slots[slot];
+        if (hashes[id] == hash && symbols[id].name == name) {
+            return id;
+        }
+    }
+    return NONE;
+}
+
+uint32_t SymbolTable::internLocal(uint32_t number, uint32_t instance) {
+    char name[24];
+    int length = std::snprintf(name, sizeof(name), "%u@%u", number, instance);
+    return intern(std::string_view(name, static_cast<size_t>(length)));
+}
+
+bool SymbolTable::isLocal(std::string_view name) {
+    return !name.empty() && name[0] >= '0' && name[0] <= '9';
+}
+
+size_t SymbolTable::size() const {
+    return symbols.size();
+}
+
+SymbolTable::Symbol& SymbolTable::operator[](uint32_t id) {
+    return symbols[id];
+}
+
+const SymbolTable::Symbol& SymbolTable::operator[](uint32_t id) const {
+    return symbols[id];
+}
+
+std::string_view SymbolTable::store(std::string_view name) {
+    // Blocks left over from earlier sources are reused before allocating
+    while (blockIndex < blocks.size() && blockUsed + name.size() > blocks[blockIndex].size) {
+        ++blockIndex;
+        blockUsed = 0;
+    }
+    if (blockIndex == blocks.size()) {
+        size_t size = std::max(BLOCK_SIZE, name.size());
+        blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+    }
+    char* copy = blocks[blockIndex].data.get() + blockUsed;
+    std::memcpy(copy, name.data(), name.size());
+    blockUsed += name.size();
+    return std::string_view(copy, name.size());
+}
+
+void SymbolTable::grow() {
+    slots.assign(slots.size() * 2, NONE);
+    size_t mask = slots.size() - 1;
+    for (uint32_t id = 0; id < symbols.size(); ++id) {
+        size_t slot = hashes[id] & mask;
+        while (slots[slot] != NONE) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = id;
+    }
+}
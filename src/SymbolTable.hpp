@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Labels, .equ/.set constants and .def register aliases of one source, keyed
+// by interned ids. Names are copied into an arena, so they stay valid until
+// the table is cleared, and the lexer hands out ids instead of strings. The
+// id lookup is a flat open-addressing hash; clearing keeps all storage.
+class SymbolTable {
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    enum class Kind : uint8_t {
+        Undefined,  // interned but not defined (yet)
+        Label,
+        Constant,   // .equ
+        Variable,   // .set
+        Register    // .def
+    };
+
+    struct Symbol {
+        std::string_view name;  // points into the arena
+        Kind kind;
+        uint16_t file;          // defining file, see Token::file
+        int32_t value;          // byte address of a label, register number for .def
+    };
+
+    SymbolTable();
+
+    void clear();
+    // Id of name, added as Undefined the first time it is seen
+    uint32_t intern(std::string_view name);
+    // Id of name, or NONE if it was never interned
+    uint32_t find(std::string_view name) const;
+    // Id of the given definition (1 for the first) of the numeric local label
+    // number, named "<number>@<instance>"
+    uint32_t internLocal(uint32_t number, uint32_t instance);
+    // True for the names internLocal() makes; identifiers never start with a digit
+    static bool isLocal(std::string_view name);
+
+    size_t size() const;
+    Symbol& operator[](uint32_t id);
+    const Symbol& operator[](uint32_t id) const;
+
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks;  // reused in order after clear()
+    size_t blockIndex = 0;
+    size_t blockUsed = 0;
+    std::vector<Symbol> symbols;
+    std::vector<uint32_t> hashes;  // per id, so growing never rehashes a name
+    std::vector<uint32_t> slots;   // ids, NONE for empty; size is a power of two
+
+    uint32_t find(std::string_view name, uint32_t hash) const;
+    std::string_view store(std::string_view name);
+    void grow();
+};
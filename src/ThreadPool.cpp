@@ -0,0 +1,101 @@
+// ThreadPool.cpp
+// Work-stealing thread pool used by the batch mode
+
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+    }
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back(&ThreadPool::run, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return threads.size();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        // Lock order is always stateMutex before a queue mutex
+        std::lock_guard<std::mutex> lock(stateMutex);
+        WorkQueue& queue = *queues[nextQueue++ % queues.size()];
+        std::lock_guard<std::mutex> queueLock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+        ++queued;
+        ++pending;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    idle.wait(lock, [this] { return pending == 0; });
+}
+
+bool ThreadPool::takeTask(size_t index, std::function<void()>& task) {
+    bool found = false;
+    {
+        // Newest task of our own queue first
+        WorkQueue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    // Otherwise steal the oldest task of another worker
+    for (size_t i = 1; !found && i < queues.size(); ++i) {
+        WorkQueue& victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (found) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        --queued;
+    }
+    return found;
+}
+
+void ThreadPool::run(size_t index) {
+    for (;;) {
+        std::function<void()> task;
+        if (takeTask(index, task)) {
+            task();
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (--pending == 0) {
+                idle.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(stateMutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
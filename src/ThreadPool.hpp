@@ -0,0 +1,45 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size work-stealing pool. Every worker owns a deque; it pops its own
+// newest task first and steals the oldest task of another worker when idle.
+class ThreadPool {
+public:
+    // A thread count of zero uses one thread per hardware core
+    explicit ThreadPool(size_t threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Tasks must not throw
+    void submit(std::function<void()> task);
+    // Blocks until every submitted task has finished
+    void wait();
+    size_t size() const;
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex stateMutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t queued = 0;    // tasks waiting in a queue
+    size_t pending = 0;   // tasks submitted but not finished
+    size_t nextQueue = 0;
+    bool stopping = false;
+
+    void run(size_t index);
+    bool takeTask(size_t index, std::function<void()>& task);
+};
@@ -0,0 +1,50 @@
+// TimeReport.cpp
+// Per-phase timing output shared by the CLI and the benchmark
+
+#include "TimeReport.hpp"
+#include <iomanip>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+void printTimeReport(std::ostream& out, const std::vector<PhaseTime>& phases, size_t sourceBytes, size_t sourceLines) {
+    double total = 0.0;
+    for (const PhaseTime& phase : phases) {
+        total += phase.milliseconds;
+    }
+
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+    for (const PhaseTime& phase : phases) {
+        double share = total > 0.0 ? phase.milliseconds * 100.0 / total : 0.0;
+        out << "  " << std::left << std::setw(12) << phase.name << std::right
+            << std::setw(10) << phase.milliseconds << " ms"
+            << std::setw(8) << std::setprecision(1) << share << " %\n" << std::setprecision(3);
+    }
+    out << "  " << std::left << std::setw(12) << "total" << std::right << std::setw(10) << total << " ms\n";
+    if (total > 0.0 && sourceBytes != 0) {
+        double seconds = total / 1000.0;
+        out << std::setprecision(2)
+            << "  throughput  " << (sourceBytes / seconds / (1024.0 * 1024.0)) << " MiB/s";
+        if (sourceLines != 0) {
+            out << ", " << std::setprecision(0) << (sourceLines / seconds) << " lines/s";
+        }
+        out << "\n";
+    }
+    out.flags(flags);
+}
+
+size_t peakResidentBytes() {
+#if defined(__APPLE__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss);  // bytes on macOS
+#elif defined(__unix__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;  // kilobytes on Linux
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Wall time spent in one stage of ATmega328Compiler::compile()
+struct PhaseTime {
+    const char* name;
+    double milliseconds;
+};
+
+// Prints one row per phase with its share of the total and the source throughput
+void printTimeReport(std::ostream& out, const std::vector<PhaseTime>& phases, size_t sourceBytes, size_t sourceLines);
+
+// Peak resident set size of this process in bytes, or 0 where it is unknown
+size_t peakResidentBytes();
@@ -1,20 +1,472 @@
 #include "ATmega328Compiler.hpp"
+#include "BatchBuilder.hpp"
+#include "AssemblerServer.hpp"
+#include <cctype>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <string>
+#include <vector>
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] <hex/bin/obj> <input.asm> <output.bin>`\n"
+              << "       " << program << " [options] --batch <hex/bin/obj> <input.asm> <output> [<input.asm> <output> ...]\n"
+              << "       " << program << " [options] --link <hex/bin> <output> <module.obj> [<module.obj> ...]\n"
+              << "       " << program << " [options] --stream <hex/bin> < input.asm > output\n"
+              << "       " << program << " [options] --disassemble <image.hex/image.bin> [<listing.asm>]\n"
+              << "       " << program << " [options] --manifest <jobs.txt>\n"
+              << "       " << program << " [-I <dir>] --server\n"
+              << "Options:\n"
+              << "  -v, --verbose     Print every label and encoded instruction\n"
+              << "  --single-pass     Assemble in one pass, back-patching forward references\n"
+              << "  --relax           Use the shortest jump/call encoding, expand far branches\n"
+              << "  --peephole <rules>  Optimize the code with the comma separated rules, or all:\n"
+              << "                    clr-ldi, repeated-out, jump-to-next, jump-chain\n"
+              << "  --analyze         Print cycles per block and loop, WCET and stack depth\n"
+              << "  --analyze-json <file>  Write the analysis as JSON\n"
+              << "  --loop-bound <label>=<n>  Iteration bound of the loop starting at label\n"
+              << "  --cycle-budget <name>=<n>  Fail if the WCET of subroutine name exceeds n cycles\n"
+              << "  --map             Print the flash used per label and section and the opcode histogram\n"
+              << "  --map-json <file>  Write the memory map as JSON\n"
+              << "  --line-map <file>  Write the source line of every instruction (for the simulator)\n"
+              << "  -I <dir>          Search .include files in dir\n"
+              << "  --header-cache <dir>  Keep precompiled .equ/.def headers in dir\n"
+              << "  --build-cache <dir>  Reuse outputs of unchanged builds stored in dir\n"
+              << "  --build-cache-size <MiB>  Size limit of the build cache (default 256)\n"
+              << "  --build-cache-stats  Print the hits, misses and size of the build cache\n"
+              << "  -j <threads>      Worker threads for batch builds (default: one per core)\n"
+              << "  --hex-record-length <n>  Data bytes per HEX record, 1-255 (default 16)\n"
+              << "  --hex-segments    Write extended segment (02/03) instead of linear (04/05) records\n"
+              << "  --hex-start <address>  Write a start address record\n"
+              << "  --verify          Read HEX output back and compare it with the code\n"
+              << "  --round-trip      Disassemble the image, reassemble it and compare the result\n"
+              << "  --delta <previous> <delta>  Write the flash pages that differ from the previous\n"
+              << "                    HEX/BIN image, as HEX if delta ends in .hex, else as a page list\n"
+              << "  --time-report     Print the time spent in every compile phase\n"
+              << "  --version         Print the assembler version\n";
+}
+
+// Parses "all" or a comma separated list of rule names
+static bool parsePeepholeRules(const std::string& list, Peephole::Options& options) {
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        std::string name = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        Peephole::Rule rule;
+        if (name == "all") {
+            for (bool& enabled : options.enabled) {
+                enabled = true;
+            }
+        } else if (Peephole::parseRule(name, rule)) {
+            options.enabled[static_cast<size_t>(rule)] = true;
+        } else {
+            return false;
+        }
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+// Prints the memory map with --map and writes it to the --map-json file
+static void writeMemoryMap(const MemoryMap& memoryMap, bool text, const std::string& jsonFile) {
+    if (text) {
+        memoryMap.writeText(std::cout);
+    }
+    if (!jsonFile.empty()) {
+        std::ofstream json(jsonFile);
+        memoryMap.writeJson(json);
+        if (!json) {
+            throw std::runtime_error("Failed to write memory map: " + jsonFile);
+        }
+    }
+}
+
+// Parses a decimal or 0x hex option value; returns false instead of
+// throwing on anything else
+static bool parseNumber(const std::string& text, uint64_t& value) {
+    bool hex = text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X');
+    std::string digits = hex ? text.substr(2) : text;
+    if (digits.empty() || !std::isxdigit(static_cast<unsigned char>(digits[0]))) {
+        return false;  // stoull would skip spaces and accept a sign
+    }
+    try {
+        size_t used = 0;
+        value = std::stoull(digits, &used, hex ? 16 : 10);
+        return used == digits.size();
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// Splits "name=value" into its parts; returns false on a malformed argument
+static bool parseAssignment(const std::string& text, std::string& name, uint64_t& value) {
+    size_t equals = text.find('=');
+    if (equals == 0 || equals == std::string::npos || equals + 1 == text.size()) {
+        return false;
+    }
+    name = text.substr(0, equals);
+    return parseNumber(text.substr(equals + 1), value);
+}
+
+// Checks every budget against the analysis and returns the number exceeded
+static size_t checkCycleBudgets(const CycleAnalyzer& analysis, const std::vector<std::pair<std::string, uint64_t>>& budgets) {
+    size_t exceeded = 0;
+    for (const auto& [name, budget] : budgets) {
+        const CycleAnalyzer::Subroutine* subroutine = analysis.findSubroutine(name);
+        if (subroutine == nullptr) {
+            std::cerr << "Cycle budget: no subroutine " << name << "\n";
+            ++exceeded;
+        } else if (subroutine->wcet == CycleAnalyzer::UNBOUNDED) {
+            std::cerr << "Cycle budget: " << name << " has no bounded WCET (budget " << budget << ")\n";
+            ++exceeded;
+        } else if (subroutine->wcet > budget) {
+            std::cerr << "Cycle budget: " << name << " WCET " << subroutine->wcet << " exceeds " << budget << "\n";
+            ++exceeded;
+        }
+    }
+    return exceeded;
+}
+
+static void printBuildCacheStatistics(const std::string& directory) {
+    BuildCache::Statistics statistics = BuildCache(directory).getStatistics();
+    std::cout << "Build cache " << directory << ": " << statistics.hits << " hit(s), " << statistics.misses
+              << " miss(es), " << statistics.entries << " entries, " << statistics.bytes / 1024 << " KiB\n";
+}
+
+static void printDeltaSummary(const std::vector<uint32_t>& pages, const std::string& deltaFileName) {
+    std::cout << "Flash delta: " << pages.size() << " of " << ATmega328Compiler::FLASH_SIZE / FlashDelta::PAGE_SIZE
+              << " pages changed";
+    if (!pages.empty()) {
+        std::cout << " (" << FlashDelta::describe(pages) << "), " << pages.size() * FlashDelta::PAGE_SIZE
+                  << " bytes to program";
+    }
+    std::cout << ". Written to " << deltaFileName << "\n";
+}
+
+static int runBatch(BatchBuilder& batch) {
+    size_t failed = batch.run();
+    for (const BatchJob& job : batch.getJobs()) {
+        if (job.success) {
+            std::cout << job.inputFileName << " -> " << job.outputFileName << (job.cached ? " (cached)" : "") << "\n";
+        } else {
+            std::cerr << "Error: " << job.inputFileName << ": " << job.error << "\n";
+        }
+    }
+    std::cout << (batch.getJobs().size() - failed) << " of " << batch.getJobs().size()
+              << " job(s) assembled successfully\n";
+    return failed == 0 ? 0 : 1;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << "<hex/bin> <input.asm> <output.bin>`\n";
-        return 0;
+    bool verbose = false;
+    bool singlePass = false;
+    bool batchMode = false;
+    bool linkMode = false;
+    bool disassembleMode = false;
+    bool streamMode = false;
+    bool roundTrip = false;
+    bool timeReport = false;
+    bool verify = false;
+    bool relax = false;
+    Peephole::Options peephole;
+    bool analyze = false;
+    std::string analysisJson;
+    std::string lineMap;
+    bool map = false;
+    std::string mapJson;
+    std::vector<std::string> includePaths;
+    std::string headerCache;
+    std::string buildCache;
+    uint64_t buildCacheSize = BuildCache::DEFAULT_MAX_BYTES;
+    bool buildCacheStats = false;
+    std::string previousImage;
+    std::string deltaFile;
+    std::unordered_map<std::string, uint32_t> loopBounds;
+    std::vector<std::pair<std::string, uint64_t>> cycleBudgets;
+    IntelHex::Options hexOptions;
+    std::string manifest;
+    size_t threads = 0;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-v" || arg == "--verbose") {
+            verbose = true;
+        } else if (arg == "--single-pass") {
+            singlePass = true;
+        } else if (arg == "--version") {
+            std::cout << "ATmega328Compiler " << ASSEMBLER_VERSION << "\n";
+            return 0;
+        } else if (arg == "--time-report") {
+            timeReport = true;
+        } else if (arg == "--hex-record-length" && i + 1 < argc) {
+            uint64_t length = 0;
+            if (!parseNumber(argv[++i], length) || length == 0 || length > 255) {
+                std::cerr << "Error: HEX record length must be between 1 and 255\n";
+                return 1;
+            }
+            hexOptions.recordLength = static_cast<uint8_t>(length);
+        } else if (arg == "--hex-segments") {
+            hexOptions.segmentAddressing = true;
+        } else if (arg == "--hex-start" && i + 1 < argc) {
+            uint64_t start = 0;
+            if (!parseNumber(argv[++i], start) || start >= ATmega328Compiler::FLASH_SIZE) {
+                std::cerr << "Error: Expected a flash address for --hex-start, got '" << argv[i] << "'\n";
+                return 1;
+            }
+            hexOptions.writeStartAddress = true;
+            hexOptions.startAddress = static_cast<uint32_t>(start);
+        } else if (arg == "--relax") {
+            relax = true;
+        } else if (arg == "--peephole" && i + 1 < argc) {
+            if (!parsePeepholeRules(argv[++i], peephole)) {
+                std::cerr << "Error: Unknown peephole rule in '" << argv[i] << "'\n";
+                return 1;
+            }
+        } else if (arg == "--analyze") {
+            analyze = true;
+        } else if (arg == "--map") {
+            map = true;
+        } else if (arg == "--map-json" && i + 1 < argc) {
+            mapJson = argv[++i];
+        } else if (arg == "--line-map" && i + 1 < argc) {
+            lineMap = argv[++i];
+        } else if (arg == "-I" && i + 1 < argc) {
+            includePaths.push_back(argv[++i]);
+        } else if (arg == "--header-cache" && i + 1 < argc) {
+            headerCache = argv[++i];
+        } else if (arg == "--build-cache" && i + 1 < argc) {
+            buildCache = argv[++i];
+        } else if (arg == "--build-cache-size" && i + 1 < argc) {
+            uint64_t size = 0;
+            if (!parseNumber(argv[++i], size) || size == 0 || size > UINT32_MAX) {
+                std::cerr << "Error: Expected a build cache size of at least 1 MiB, got '" << argv[i] << "'\n";
+                return 1;
+            }
+            buildCacheSize = size * 1024 * 1024;
+        } else if (arg == "--build-cache-stats") {
+            buildCacheStats = true;
+        } else if (arg == "--analyze-json" && i + 1 < argc) {
+            analysisJson = argv[++i];
+        } else if ((arg == "--loop-bound" || arg == "--cycle-budget") && i + 1 < argc) {
+            std::string name;
+            uint64_t value = 0;
+            if (!parseAssignment(argv[++i], name, value) || (arg == "--loop-bound" && (value == 0 || value > UINT32_MAX))) {
+                std::cerr << "Error: Expected <name>=<n> for " << arg << "\n";
+                return 1;
+            }
+            if (arg == "--loop-bound") {
+                loopBounds[name] = static_cast<uint32_t>(value);
+            } else {
+                cycleBudgets.push_back({name, value});
+            }
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg == "--server") {
+            // Editor integrations talk to the server over stdin/stdout
+            AssemblerServer server(includePaths);
+            server.run(std::cin, std::cout);
+            return 0;
+        } else if (arg == "--batch") {
+            batchMode = true;
+        } else if (arg == "--link") {
+            linkMode = true;
+        } else if (arg == "--stream") {
+            streamMode = true;
+        } else if (arg == "--disassemble") {
+            disassembleMode = true;
+        } else if (arg == "--delta" && i + 2 < argc) {
+            previousImage = argv[++i];
+            deltaFile = argv[++i];
+        } else if (arg == "--round-trip") {
+            roundTrip = true;
+        } else if (arg == "--manifest" && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (arg == "-j" && i + 1 < argc) {
+            uint64_t count = 0;
+            if (!parseNumber(argv[++i], count) || count > 1024) {
+                std::cerr << "Error: Expected a thread count between 0 and 1024 for -j, got '" << argv[i] << "'\n";
+                return 1;
+            }
+            threads = static_cast<size_t>(count);
+        } else {
+            args.push_back(arg);
+        }
     }
 
     try {
-        ATmega328Compiler compiler(argv[1], argv[2], argv[3]);
-        compiler.compile();
-        std::cout << "Compilation successful. Output written to " << argv[3] << "\n";
+        if (buildCacheStats && buildCache.empty()) {
+            std::cerr << "Error: --build-cache-stats needs --build-cache <dir>\n";
+            return 1;
+        }
+        if (buildCacheStats && args.empty() && manifest.empty()) {
+            printBuildCacheStatistics(buildCache);
+            return 0;
+        }
+        if (!manifest.empty() || batchMode) {
+            if ((!manifest.empty() && !args.empty()) || (batchMode && (args.size() < 3 || args.size() % 2 == 0))) {
+                printUsage(argv[0]);
+                return 0;
+            }
+            BatchBuilder batch(threads);
+            batch.setSinglePass(singlePass);
+            batch.setRelaxBranches(relax);
+            batch.setPeepholeOptions(peephole);
+            batch.setHexOptions(hexOptions);
+            batch.setRoundTrip(roundTrip);
+            batch.setIncludePaths(includePaths);
+            batch.setHeaderCache(headerCache);
+            batch.setBuildCache(buildCache, buildCacheSize);
+            if (!manifest.empty()) {
+                batch.loadManifest(manifest);
+            }
+            for (size_t i = 1; i + 1 < args.size(); i += 2) {
+                batch.addJob(args[0], args[i], args[i + 1]);
+            }
+            int result = runBatch(batch);
+            if (buildCacheStats) {
+                printBuildCacheStatistics(buildCache);
+            }
+            return result;
+        }
+
+        if (linkMode) {
+            if (args.size() < 3) {
+                printUsage(argv[0]);
+                return 0;
+            }
+            ATmega328Compiler linker(args[0], std::string(), args[1]);
+            linker.setHexOptions(hexOptions);
+            linker.setVerifyOutput(verify);
+            linker.setRoundTrip(roundTrip);
+            linker.setDelta(previousImage, deltaFile);
+            linker.link(std::vector<std::string>(args.begin() + 2, args.end()));
+            std::cout << "Linked " << (args.size() - 2) << " module(s). Output written to " << args[1] << "\n";
+            if (!deltaFile.empty()) {
+                printDeltaSummary(linker.getDeltaPages(), deltaFile);
+            }
+            if (timeReport) {
+                std::cout << "Time report for " << args[1] << ":\n";
+                printTimeReport(std::cout, linker.getPhaseTimes(), 0, 0);
+            }
+            return 0;
+        }
+
+        if (streamMode) {
+            // Reads stdin and writes stdout, so messages go to stderr
+            if (args.size() != 1) {
+                printUsage(argv[0]);
+                return 0;
+            }
+            std::ios::sync_with_stdio(false);
+            ATmega328Compiler compiler(args[0], "-", "-");
+            compiler.setHexOptions(hexOptions);
+            compiler.setIncludePaths(includePaths);
+            compiler.setRelaxBranches(relax);
+            compiler.setPeepholeOptions(peephole);
+            compiler.compileStream(std::cin, std::cout);
+            if (timeReport) {
+                std::cerr << "Time report for stdin:\n";
+                printTimeReport(std::cerr, compiler.getPhaseTimes(), compiler.getSourceSize(), compiler.getLineCount());
+                std::cerr << "  peak RSS    " << peakResidentBytes() / 1024 << " KiB\n";
+            }
+            return 0;
+        }
+
+        if (disassembleMode) {
+            if (args.empty() || args.size() > 2) {
+                printUsage(argv[0]);
+                return 0;
+            }
+            ATmega328Compiler disassembler("asm", args[0], args.size() == 2 ? args[1] : std::string());
+            disassembler.setRoundTrip(roundTrip);
+            disassembler.disassemble();
+            if (timeReport) {
+                std::cerr << "Time report for " << args[0] << ":\n";
+                printTimeReport(std::cerr, disassembler.getPhaseTimes(), disassembler.getSourceSize(), 0);
+            }
+            return 0;
+        }
+
+        if (args.size() != 3) {
+            printUsage(argv[0]);
+            return 0;
+        }
+
+        ATmega328Compiler compiler(args[0], args[1], args[2]);
+        compiler.setVerbose(verbose);
+        compiler.setSinglePass(singlePass);
+        compiler.setHexOptions(hexOptions);
+        compiler.setVerifyOutput(verify);
+        compiler.setRoundTrip(roundTrip);
+        compiler.setRelaxBranches(relax);
+        compiler.setPeepholeOptions(peephole);
+        compiler.setLineMapFile(lineMap);
+        compiler.setIncludePaths(includePaths);
+        compiler.setHeaderCache(headerCache);
+        compiler.setBuildCache(buildCache, buildCacheSize);
+        compiler.setDelta(previousImage, deltaFile);
+        compiler.setMemoryMap(map || !mapJson.empty());
+        compiler.setCycleAnalysis(analyze || !analysisJson.empty() || !cycleBudgets.empty(), loopBounds);
+        try {
+            compiler.compile();
+        } catch (const std::exception&) {
+            if (compiler.hasMemoryMap()) {
+                writeMemoryMap(compiler.getMemoryMap(), map, mapJson);
+            }
+            throw;
+        }
+        if (compiler.isCached()) {
+            std::cout << "Build cache hit. Output written to " << args[2] << "\n";
+        } else {
+            std::cout << "Compilation successful. Output written to " << args[2] << "\n";
+        }
+        if (!deltaFile.empty() && args[0] != "obj") {
+            printDeltaSummary(compiler.getDeltaPages(), deltaFile);
+        }
+        if (buildCacheStats) {
+            printBuildCacheStatistics(buildCache);
+        }
+        if (relax && !compiler.isCached()) {
+            const ATmega328Compiler::RelaxationReport& report = compiler.getRelaxationReport();
+            std::cout << "Relaxation: " << report.shortened << " shortened, " << report.lengthened << " lengthened, "
+                      << report.expanded << " branch(es) expanded; " << report.bytesSaved << " bytes and "
+                      << report.cyclesSaved << " cycles saved\n";
+        }
+        for (size_t i = 0; i < Peephole::RULE_COUNT; ++i) {
+            if (peephole.enabled[i] && !compiler.isCached()) {
+                const Peephole::RuleReport& rule = compiler.getPeepholeReport()[i];
+                std::cout << "Peephole " << Peephole::ruleName(static_cast<Peephole::Rule>(i)) << ": applied "
+                          << rule.applied << " time(s), " << rule.bytesSaved << " bytes and "
+                          << rule.cyclesSaved << " cycles saved\n";
+            }
+        }
+        writeMemoryMap(compiler.getMemoryMap(), map, mapJson);
+        if (analyze) {
+            compiler.getCycleAnalysis().writeText(std::cout);
+        }
+        if (!analysisJson.empty()) {
+            std::ofstream json(analysisJson);
+            compiler.getCycleAnalysis().writeJson(json);
+            if (!json) {
+                throw std::runtime_error("Failed to write analysis: " + analysisJson);
+            }
+        }
+        if (checkCycleBudgets(compiler.getCycleAnalysis(), cycleBudgets) != 0) {
+            return 1;
+        }
+        if (timeReport) {
+            std::cout << "Time report for " << args[1] << ":\n";
+            printTimeReport(std::cout, compiler.getPhaseTimes(), compiler.getSourceSize(), compiler.getLineCount());
+            std::cout << "  peak RSS    " << peakResidentBytes() / 1024 << " KiB\n";
+        }
     } catch (const std::exception& ex) {
         std::cerr << "Error: " << ex.what() << "\n";
         return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}